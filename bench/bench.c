@@ -0,0 +1,496 @@
+// Mounts archives with zipfs and prints one JSON object of measurements per
+// archive, so that results can be appended to a file and compared over time.
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#define BENCH_MOUNT_TIMEOUT 60.0
+#define BENCH_FIRST_BYTE_SAMPLES 32
+#define BENCH_RANDOM_READS 4096
+#define BENCH_RANDOM_READ_SIZE 4096
+// Random reads of deflated entries without an index can be slow, so they stop
+// after so many seconds.
+#define BENCH_RANDOM_SECONDS 10.0
+#define BENCH_READ_BUF_SIZE (1 << 20)
+
+struct bench_file_t {
+    char *path;
+    unsigned long long size;
+};
+
+// Everything found under the mountpoint.
+static struct bench_file_t *files;
+static size_t num_files;
+static size_t cap_files;
+static char **dirs;
+static size_t num_dirs;
+static size_t cap_dirs;
+
+static struct bench_result_t {
+    double mount_ms;
+    double readdir_per_s;
+    double getattr_per_s;
+    double first_byte_us;
+    double first_byte_max_us;
+    size_t random_reads;
+    double random_mb_s;
+    double random_iops;
+    double seq_mb_s;
+    double seq_files_per_s;
+    long max_rss_kb;
+} result;
+
+static const char *zipfs_path;
+static const char *mountpoint;
+static char **zipfs_opts;
+static int num_zipfs_opts;
+static char *read_buf;
+static unsigned long long rand_state = 0x9e3779b97f4a7c15ULL;
+
+static double bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static unsigned long long bench_rand(void) {
+    rand_state ^= rand_state >> 12;
+    rand_state ^= rand_state << 25;
+    rand_state ^= rand_state >> 27;
+    return rand_state * 0x2545f4914f6cdd1dULL;
+}
+
+static int bench_mounted(void) {
+    char parent[4096];
+    snprintf(parent, sizeof(parent), "%s/..", mountpoint);
+    struct stat st;
+    struct stat parent_st;
+    return stat(mountpoint, &st) == 0 && stat(parent, &parent_st) == 0 &&
+           st.st_dev != parent_st.st_dev;
+}
+
+// Starts zipfs in the foreground and waits for the archive to be mounted,
+// returning its process or -1 on error.
+static pid_t bench_mount(const char *zip_file, double *elapsed) {
+    char **argv = (char **)calloc(num_zipfs_opts + 5, sizeof(char *));
+    if (argv == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+    argv[0] = (char *)zipfs_path;
+    argv[1] = (char *)zip_file;
+    argv[2] = (char *)mountpoint;
+    argv[3] = "-f";
+    for (int i = 0; i < num_zipfs_opts; ++i) {
+        argv[4 + i] = zipfs_opts[i];
+    }
+
+    double start = bench_now();
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("fork()");
+        free(argv);
+        return -1;
+    }
+    if (pid == 0) {
+        execv(zipfs_path, argv);
+        perror("execv()");
+        _exit(127);
+    }
+    free(argv);
+
+    while (!bench_mounted()) {
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            eprintfln("zipfs exited before mounting '%s'", zip_file);
+            return -1;
+        }
+        if (bench_now() - start > BENCH_MOUNT_TIMEOUT) {
+            eprintfln("Mount '%s' timed out", zip_file);
+            kill(pid, SIGTERM);
+            waitpid(pid, &status, 0);
+            return -1;
+        }
+        usleep(1000);
+    }
+    *elapsed = bench_now() - start;
+    return pid;
+}
+
+// Unmounts the archive and waits for zipfs, recording its peak RSS.
+static int bench_unmount(pid_t pid) {
+    pid_t umount_pid = fork();
+    if (umount_pid < 0) {
+        perror("fork()");
+        return -1;
+    }
+    if (umount_pid == 0) {
+#ifdef __APPLE__
+        execlp("umount", "umount", mountpoint, (char *)NULL);
+#else
+        execlp("fusermount3", "fusermount3", "-u", mountpoint, (char *)NULL);
+#endif
+        perror("execlp()");
+        _exit(127);
+    }
+    int status;
+    waitpid(umount_pid, &status, 0);
+
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) {
+        perror("wait4()");
+        return -1;
+    }
+#ifdef __APPLE__
+    long rss_kb = usage.ru_maxrss / 1024;
+#else
+    long rss_kb = usage.ru_maxrss;
+#endif
+    if (rss_kb > result.max_rss_kb) {
+        result.max_rss_kb = rss_kb;
+    }
+    return WIFEXITED(status) && WEXITSTATUS(status) == 0 ? 0 : -1;
+}
+
+static int bench_add_file(const char *path, unsigned long long size) {
+    if (num_files == cap_files) {
+        size_t cap = cap_files ? cap_files * 2 : 1024;
+        struct bench_file_t *p = (struct bench_file_t *)realloc(
+            files, cap * sizeof(struct bench_file_t));
+        if (p == NULL) {
+            perror("realloc()");
+            return -1;
+        }
+        files = p;
+        cap_files = cap;
+    }
+    files[num_files].path = strdup(path);
+    files[num_files].size = size;
+    return files[num_files++].path != NULL ? 0 : -1;
+}
+
+static int bench_add_dir(const char *path) {
+    if (num_dirs == cap_dirs) {
+        size_t cap = cap_dirs ? cap_dirs * 2 : 1024;
+        char **p = (char **)realloc(dirs, cap * sizeof(char *));
+        if (p == NULL) {
+            perror("realloc()");
+            return -1;
+        }
+        dirs = p;
+        cap_dirs = cap;
+    }
+    dirs[num_dirs] = strdup(path);
+    return dirs[num_dirs++] != NULL ? 0 : -1;
+}
+
+// Lists a directory and everything below, returning the number of entries.
+static long long bench_walk(const char *path) {
+    DIR *dir = opendir(path);
+    if (dir == NULL) {
+        perror("opendir()");
+        return -1;
+    }
+
+    long long n = 0;
+    struct dirent *ent;
+    char child[4096];
+    while ((ent = readdir(dir)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0) {
+            continue;
+        }
+        ++n;
+        snprintf(child, sizeof(child), "%s/%s", path, ent->d_name);
+        if (ent->d_type == DT_DIR) {
+            long long m = bench_add_dir(child) == 0 ? bench_walk(child) : -1;
+            if (m < 0) {
+                closedir(dir);
+                return -1;
+            }
+            n += m;
+        } else if (bench_add_file(child, 0) != 0) {
+            closedir(dir);
+            return -1;
+        }
+    }
+    closedir(dir);
+    return n;
+}
+
+static int bench_cmp_double(const void *a, const void *b) {
+    double x = *(const double *)a;
+    double y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Measures listing, attributes and the latency of the first byte of files
+// spread over the archive, right after mounting.
+static int bench_metadata(void) {
+    double start = bench_now();
+    long long entries = bench_walk(mountpoint);
+    if (entries < 0) {
+        return -1;
+    }
+    double elapsed = bench_now() - start;
+    result.readdir_per_s = elapsed > 0 ? entries / elapsed : 0;
+
+    start = bench_now();
+    struct stat st;
+    for (size_t i = 0; i < num_dirs; ++i) {
+        if (lstat(dirs[i], &st) != 0) {
+            perror("lstat()");
+            return -1;
+        }
+    }
+    for (size_t i = 0; i < num_files; ++i) {
+        if (lstat(files[i].path, &st) != 0) {
+            perror("lstat()");
+            return -1;
+        }
+        files[i].size = st.st_size;
+    }
+    elapsed = bench_now() - start;
+    result.getattr_per_s =
+        elapsed > 0 ? (num_dirs + num_files) / elapsed : 0;
+
+    double latencies[BENCH_FIRST_BYTE_SAMPLES];
+    size_t n = num_files < BENCH_FIRST_BYTE_SAMPLES ? num_files
+                                                    : BENCH_FIRST_BYTE_SAMPLES;
+    for (size_t i = 0; i < n; ++i) {
+        const char *path = files[i * num_files / n].path;
+        start = bench_now();
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            perror("open()");
+            return -1;
+        }
+        char c;
+        if (read(fd, &c, 1) < 0) {
+            perror("read()");
+            close(fd);
+            return -1;
+        }
+        latencies[i] = (bench_now() - start) * 1e6;
+        close(fd);
+    }
+    if (n > 0) {
+        qsort(latencies, n, sizeof(double), bench_cmp_double);
+        result.first_byte_us = latencies[n / 2];
+        result.first_byte_max_us = latencies[n - 1];
+    }
+    return 0;
+}
+
+// Reads small blocks at offsets spread evenly over the data of all files.
+static int bench_random(void) {
+    unsigned long long total = 0;
+    for (size_t i = 0; i < num_files; ++i) {
+        total += files[i].size;
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    unsigned long long bytes = 0;
+    double start = bench_now();
+    double elapsed = 0;
+    size_t n = 0;
+    for (; n < BENCH_RANDOM_READS && elapsed < BENCH_RANDOM_SECONDS; ++n) {
+        unsigned long long pos = bench_rand() % total;
+        size_t i = 0;
+        while (pos >= files[i].size) {
+            pos -= files[i].size;
+            ++i;
+        }
+        pos &= ~(unsigned long long)(BENCH_RANDOM_READ_SIZE - 1);
+
+        int fd = open(files[i].path, O_RDONLY);
+        if (fd < 0) {
+            perror("open()");
+            return -1;
+        }
+        ssize_t ret = pread(fd, read_buf, BENCH_RANDOM_READ_SIZE, pos);
+        close(fd);
+        if (ret < 0) {
+            perror("pread()");
+            return -1;
+        }
+        bytes += ret;
+        elapsed = bench_now() - start;
+    }
+    result.random_reads = n;
+    result.random_mb_s = elapsed > 0 ? bytes / elapsed / (1 << 20) : 0;
+    result.random_iops = elapsed > 0 ? n / elapsed : 0;
+    return 0;
+}
+
+// Reads every file from beginning to end.
+static int bench_sequential(void) {
+    unsigned long long bytes = 0;
+    double start = bench_now();
+    for (size_t i = 0; i < num_files; ++i) {
+        int fd = open(files[i].path, O_RDONLY);
+        if (fd < 0) {
+            perror("open()");
+            return -1;
+        }
+        ssize_t ret;
+        while ((ret = read(fd, read_buf, BENCH_READ_BUF_SIZE)) > 0) {
+            bytes += ret;
+        }
+        close(fd);
+        if (ret < 0) {
+            perror("read()");
+            return -1;
+        }
+    }
+    double elapsed = bench_now() - start;
+    result.seq_mb_s = elapsed > 0 ? bytes / elapsed / (1 << 20) : 0;
+    result.seq_files_per_s = elapsed > 0 ? num_files / elapsed : 0;
+    return 0;
+}
+
+static void bench_reset(void) {
+    for (size_t i = 0; i < num_files; ++i) {
+        free(files[i].path);
+    }
+    for (size_t i = 0; i < num_dirs; ++i) {
+        free(dirs[i]);
+    }
+    num_files = 0;
+    num_dirs = 0;
+    memset(&result, 0, sizeof(result));
+}
+
+// Runs each phase on a fresh mount, so that no phase is served from what the
+// kernel or zipfs cached during another.
+static int bench_archive(const char *zip_file) {
+    int (*phases[])(void) = {bench_metadata, bench_random, bench_sequential};
+    for (size_t i = 0; i < sizeof(phases) / sizeof(phases[0]); ++i) {
+        double elapsed;
+        pid_t pid = bench_mount(zip_file, &elapsed);
+        if (pid < 0) {
+            return -1;
+        }
+        if (i == 0) {
+            result.mount_ms = elapsed * 1e3;
+        }
+        int ret = phases[i]();
+        if (bench_unmount(pid) != 0) {
+            eprintfln("Unmount '%s' error", zip_file);
+            ret = -1;
+        }
+        if (ret != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void bench_print_string(const char *str) {
+    putchar('"');
+    for (; *str != '\0'; ++str) {
+        if (*str == '"' || *str == '\\') {
+            putchar('\\');
+        }
+        putchar(*str);
+    }
+    putchar('"');
+}
+
+static void bench_print(const char *label, const char *zip_file) {
+    struct stat st;
+    unsigned long long zip_size = stat(zip_file, &st) == 0 ? st.st_size : 0;
+    const char *name = strrchr(zip_file, '/');
+
+    printf("{\"label\": ");
+    bench_print_string(label);
+    printf(", \"archive\": ");
+    bench_print_string(name != NULL ? name + 1 : zip_file);
+    printf(", \"archive_bytes\": %llu, \"files\": %zu, \"dirs\": %zu, "
+           "\"mount_ms\": %.3f, \"readdir_entries_per_s\": %.1f, "
+           "\"getattr_ops_per_s\": %.1f, \"first_byte_median_us\": %.1f, "
+           "\"first_byte_max_us\": %.1f, \"random_reads\": %zu, "
+           "\"random_read_mb_s\": %.2f, \"random_read_iops\": %.1f, "
+           "\"seq_read_mb_s\": %.2f, \"seq_read_files_per_s\": %.1f, "
+           "\"max_rss_kb\": %ld}\n",
+           zip_size, num_files, num_dirs, result.mount_ms,
+           result.readdir_per_s, result.getattr_per_s, result.first_byte_us,
+           result.first_byte_max_us, result.random_reads, result.random_mb_s,
+           result.random_iops, result.seq_mb_s, result.seq_files_per_s,
+           result.max_rss_kb);
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    // zipfs options follow "--".
+    for (int i = 1; i < argc; ++i) {
+        if (strcmp(argv[i], "--") == 0) {
+            zipfs_opts = argv + i + 1;
+            num_zipfs_opts = argc - i - 1;
+            argc = i;
+            break;
+        }
+    }
+
+    const char *label = "";
+    int usage = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "+l:")) != -1) {
+        if (opt == 'l') {
+            label = optarg;
+        } else {
+            usage = 1;
+        }
+    }
+    int num_zips = argc - optind - 2;
+    if (usage || num_zips < 1) {
+        eprintfln("usage: %s [-l label] <zipfs> <mountpoint> <zip-file>... "
+                  "[-- zipfs-options]",
+                  argv[0]);
+        return 1;
+    }
+    zipfs_path = argv[optind];
+    mountpoint = argv[optind + 1];
+
+    if (mkdir(mountpoint, 0755) != 0 && errno != EEXIST) {
+        perror("mkdir()");
+        return 1;
+    }
+    read_buf = (char *)malloc(BENCH_READ_BUF_SIZE);
+    if (read_buf == NULL) {
+        perror("malloc()");
+        return 1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < num_zips; ++i) {
+        const char *zip_file = argv[optind + 2 + i];
+        bench_reset();
+        if (bench_archive(zip_file) != 0) {
+            eprintfln("Benchmark of '%s' failed", zip_file);
+            ret = 1;
+            continue;
+        }
+        bench_print(label, zip_file);
+    }
+    bench_reset();
+    free(files);
+    free(dirs);
+    free(read_buf);
+    return ret;
+}
@@ -0,0 +1,199 @@
+// Generates the synthetic archives measured by zipfs-bench.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "zip.h"
+
+#define GEN_CHUNK_SIZE (1 << 20)
+#define GEN_NUM_WORDS 256
+// The writer has no zip64, which archives of more entries need.
+#define GEN_MAX_ENTRIES 65535
+
+// Words which make up compressible data, about as compressible as text.
+static char gen_words[GEN_NUM_WORDS][16];
+static unsigned long long gen_state = 0x9e3779b97f4a7c15ULL;
+static char gen_chunk[GEN_CHUNK_SIZE];
+
+static unsigned long long gen_rand(void) {
+    // xorshift64*, so that archives are the same on every run.
+    gen_state ^= gen_state >> 12;
+    gen_state ^= gen_state << 25;
+    gen_state ^= gen_state >> 27;
+    return gen_state * 0x2545f4914f6cdd1dULL;
+}
+
+static void gen_init_words(void) {
+    for (size_t i = 0; i < GEN_NUM_WORDS; ++i) {
+        size_t len = 2 + gen_rand() % 12;
+        for (size_t j = 0; j < len; ++j) {
+            gen_words[i][j] = 'a' + gen_rand() % 26;
+        }
+        gen_words[i][len] = ' ';
+        gen_words[i][len + 1] = '\0';
+    }
+}
+
+// Fills a buffer with random words, or random bytes if not compressible.
+static void gen_fill(char *buf, size_t size, int compressible) {
+    size_t pos = 0;
+    if (!compressible) {
+        while (pos < size) {
+            unsigned long long r = gen_rand();
+            size_t n = size - pos < sizeof(r) ? size - pos : sizeof(r);
+            memcpy(buf + pos, &r, n);
+            pos += n;
+        }
+        return;
+    }
+    while (pos < size) {
+        const char *word = gen_words[gen_rand() % GEN_NUM_WORDS];
+        size_t n = strlen(word);
+        if (n > size - pos) {
+            n = size - pos;
+        }
+        memcpy(buf + pos, word, n);
+        pos += n;
+    }
+}
+
+// Scales a number of entries, up to what an archive without zip64 holds.
+static size_t gen_count(size_t n, double scale) {
+    double count = n * scale;
+    return count < GEN_MAX_ENTRIES ? (size_t)count : GEN_MAX_ENTRIES;
+}
+
+static int gen_entry(struct zip_t *zip, const char *name,
+                     unsigned long long size, int compressible) {
+    if (zip_entry_open(zip, name) != 0) {
+        eprintfln("Open entry '%s' error", name);
+        return -1;
+    }
+    int ret = 0;
+    while (ret == 0 && size > 0) {
+        size_t n = size < GEN_CHUNK_SIZE ? size : GEN_CHUNK_SIZE;
+        gen_fill(gen_chunk, n, compressible);
+        if (zip_entry_write(zip, gen_chunk, n) != 0) {
+            eprintfln("Write entry '%s' error", name);
+            ret = -1;
+        }
+        size -= n;
+    }
+    if (zip_entry_close(zip) != 0) {
+        eprintfln("Close entry '%s' error", name);
+        ret = -1;
+    }
+    return ret;
+}
+
+// Many tiny deflated files spread over a flat set of directories.
+static int gen_tiny(struct zip_t *zip, double scale) {
+    size_t n = gen_count(60000, scale);
+    char name[64];
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "dir%03zu/file%06zu.txt", i % 100, i);
+        if (gen_entry(zip, name, 64 + gen_rand() % 4032, 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// A few huge deflated members, which are streamed.
+static int gen_huge(struct zip_t *zip, double scale) {
+    unsigned long long size = (unsigned long long)(256.0 * (1 << 20) * scale);
+    char name[64];
+    for (size_t i = 0; i < 4; ++i) {
+        snprintf(name, sizeof(name), "huge%zu.bin", i);
+        if (gen_entry(zip, name, size, 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Incompressible media files, which are stored.
+static int gen_media(struct zip_t *zip, double scale) {
+    size_t n = gen_count(64, scale);
+    char name[64];
+    for (size_t i = 0; i < n; ++i) {
+        snprintf(name, sizeof(name), "media/clip%04zu.mp4", i);
+        if (gen_entry(zip, name, 16 << 20, 0) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Small deflated files at the leaves of a tree 12 directories deep, with 4
+// subdirectories per directory.
+static int gen_deep(struct zip_t *zip, double scale) {
+    size_t n = gen_count(20000, scale);
+    char name[256];
+    for (size_t i = 0; i < n; ++i) {
+        size_t pos = 0;
+        size_t path = i;
+        for (int depth = 0; depth < 12; ++depth) {
+            pos += snprintf(name + pos, sizeof(name) - pos, "d%zu/", path % 4);
+            path /= 4;
+        }
+        snprintf(name + pos, sizeof(name) - pos, "file%06zu.txt", i);
+        if (gen_entry(zip, name, 1024, 1) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static const struct gen_profile_t {
+    const char *name;
+    // Media is stored, everything else deflated.
+    int level;
+    int (*gen)(struct zip_t *zip, double scale);
+} gen_profiles[] = {
+    {"tiny", 6, gen_tiny},
+    {"huge", 6, gen_huge},
+    {"media", 0, gen_media},
+    {"deep", 6, gen_deep},
+};
+
+int main(int argc, char **argv) {
+    if (argc < 3 || argc > 4) {
+        eprintfln("usage: %s <tiny|huge|media|deep> <zip-file> [scale]",
+                  argv[0]);
+        return 1;
+    }
+    double scale = argc == 4 ? atof(argv[3]) : 1.0;
+    if (scale <= 0) {
+        eprintfln("Invalid scale '%s'", argv[3]);
+        return 1;
+    }
+
+    const struct gen_profile_t *profile = NULL;
+    for (size_t i = 0; i < sizeof(gen_profiles) / sizeof(gen_profiles[0]);
+         ++i) {
+        if (strcmp(argv[1], gen_profiles[i].name) == 0) {
+            profile = &gen_profiles[i];
+        }
+    }
+    if (profile == NULL) {
+        eprintfln("Unknown profile '%s'", argv[1]);
+        return 1;
+    }
+
+    struct zip_t *zip = zip_open(argv[2], profile->level, 'w');
+    if (zip == NULL) {
+        eprintfln("Create ZIP file '%s' error", argv[2]);
+        return 1;
+    }
+    gen_init_words();
+    int ret = profile->gen(zip, scale);
+    zip_close(zip);
+    if (ret != 0) {
+        remove(argv[2]);
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,330 @@
+#include "cache.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+#define CACHE_MIN_BUCKETS 64
+
+// splitmix64 finalizer, so that sequential keys spread over the shards.
+static unsigned long long cache_hash(unsigned long long key) {
+    key = (key ^ (key >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    key = (key ^ (key >> 27)) * 0x94d049bb133111ebULL;
+    return key ^ (key >> 31);
+}
+
+static struct cache_shard_t *cache_shard(struct cache_t *cache,
+                                         unsigned long long h) {
+    return &cache->shards[h % cache->num_shards];
+}
+
+static size_t shard_bucket(const struct cache_shard_t *shard,
+                           unsigned long long h) {
+    return (h >> 32) & (shard->num_buckets - 1);
+}
+
+static struct cache_entry_t *shard_find(struct cache_shard_t *shard,
+                                        unsigned long long key,
+                                        unsigned long long h) {
+    struct cache_entry_t *entry = shard->buckets[shard_bucket(shard, h)];
+    while (entry != NULL && entry->key != key) {
+        entry = entry->hash_next;
+    }
+    return entry;
+}
+
+static int shard_rehash(struct cache_shard_t *shard, size_t num_buckets) {
+    struct cache_entry_t **buckets =
+        (struct cache_entry_t **)calloc(num_buckets, sizeof(*buckets));
+    if (buckets == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+
+    size_t old_num_buckets = shard->num_buckets;
+    struct cache_entry_t **old_buckets = shard->buckets;
+    shard->buckets = buckets;
+    shard->num_buckets = num_buckets;
+    for (size_t i = 0; i < old_num_buckets; ++i) {
+        struct cache_entry_t *entry = old_buckets[i];
+        while (entry != NULL) {
+            struct cache_entry_t *next = entry->hash_next;
+            size_t b = shard_bucket(shard, cache_hash(entry->key));
+            entry->hash_next = buckets[b];
+            buckets[b] = entry;
+            entry = next;
+        }
+    }
+    free(old_buckets);
+    return 0;
+}
+
+static struct cache_entry_t *shard_insert(struct cache_shard_t *shard,
+                                          unsigned long long key,
+                                          unsigned long long h) {
+    if (shard->num_entries >= shard->num_buckets &&
+        shard_rehash(shard, shard->num_buckets * 2) != 0) {
+        return NULL;
+    }
+
+    struct cache_entry_t *entry =
+        (struct cache_entry_t *)calloc(1, sizeof(*entry));
+    if (entry == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    entry->key = key;
+    entry->state = CACHE_EMPTY;
+
+    size_t b = shard_bucket(shard, h);
+    entry->hash_next = shard->buckets[b];
+    shard->buckets[b] = entry;
+    ++shard->num_entries;
+    return entry;
+}
+
+static void shard_remove(struct cache_shard_t *shard,
+                         struct cache_entry_t *entry) {
+    struct cache_entry_t **p =
+        &shard->buckets[shard_bucket(shard, cache_hash(entry->key))];
+    while (*p != entry) {
+        p = &(*p)->hash_next;
+    }
+    *p = entry->hash_next;
+    --shard->num_entries;
+
+    shard->used -= entry->size;
+    free(entry->data);
+    free(entry);
+}
+
+static void lru_unlink(struct cache_shard_t *shard,
+                       struct cache_entry_t *entry) {
+    if (entry->lru_prev != NULL) {
+        entry->lru_prev->lru_next = entry->lru_next;
+    } else {
+        shard->lru_head = entry->lru_next;
+    }
+    if (entry->lru_next != NULL) {
+        entry->lru_next->lru_prev = entry->lru_prev;
+    } else {
+        shard->lru_tail = entry->lru_prev;
+    }
+    entry->lru_prev = entry->lru_next = NULL;
+}
+
+static void lru_append(struct cache_shard_t *shard,
+                       struct cache_entry_t *entry) {
+    entry->lru_prev = shard->lru_tail;
+    entry->lru_next = NULL;
+    if (shard->lru_tail != NULL) {
+        shard->lru_tail->lru_next = entry;
+    } else {
+        shard->lru_head = entry;
+    }
+    shard->lru_tail = entry;
+}
+
+static void shard_evict(struct cache_shard_t *shard) {
+    while (shard->used > shard->budget && shard->lru_head != NULL) {
+        struct cache_entry_t *entry = shard->lru_head;
+        debug_eprintfln("Entry %llu with size %zu evicted", entry->key,
+                        entry->size);
+        lru_unlink(shard, entry);
+        shard_remove(shard, entry);
+    }
+}
+
+// Takes a reference, which also takes a loaded entry out of the LRU list.
+static void shard_ref(struct cache_shard_t *shard,
+                      struct cache_entry_t *entry) {
+    if (entry->refs++ == 0 && entry->state == CACHE_READY) {
+        lru_unlink(shard, entry);
+    }
+}
+
+static void shard_unref(struct cache_shard_t *shard,
+                        struct cache_entry_t *entry) {
+    if (--entry->refs != 0) {
+        return;
+    }
+
+    if (entry->state == CACHE_READY) {
+        lru_append(shard, entry);
+        shard_evict(shard);
+    } else {
+        // Nobody is interested in the entry, and there is nothing to keep.
+        shard_remove(shard, entry);
+    }
+}
+
+struct cache_t *cache_create(size_t budget, size_t num_shards) {
+    struct cache_t *cache = (struct cache_t *)calloc(1, sizeof(*cache));
+    if (cache == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    cache->shards =
+        (struct cache_shard_t *)calloc(num_shards, sizeof(*cache->shards));
+    if (cache->shards == NULL) {
+        perror("calloc()");
+        free(cache);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < num_shards; ++i) {
+        struct cache_shard_t *shard = &cache->shards[i];
+        if (shard_rehash(shard, CACHE_MIN_BUCKETS) != 0) {
+            cache_free(cache);
+            return NULL;
+        }
+        pthread_mutex_init(&shard->mutex, NULL);
+        pthread_cond_init(&shard->loaded, NULL);
+        shard->budget = budget / num_shards;
+        ++cache->num_shards;
+    }
+
+    debug_eprintfln("Cache with %zu shards of %zu bytes created",
+                    cache->num_shards, budget / num_shards);
+    return cache;
+}
+
+void cache_free(struct cache_t *cache) {
+    if (cache == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < cache->num_shards; ++i) {
+        struct cache_shard_t *shard = &cache->shards[i];
+        for (size_t b = 0; b < shard->num_buckets; ++b) {
+            struct cache_entry_t *entry = shard->buckets[b];
+            while (entry != NULL) {
+                struct cache_entry_t *next = entry->hash_next;
+                free(entry->data);
+                free(entry);
+                entry = next;
+            }
+        }
+        free(shard->buckets);
+        pthread_mutex_destroy(&shard->mutex);
+        pthread_cond_destroy(&shard->loaded);
+    }
+    free(cache->shards);
+    free(cache);
+}
+
+struct cache_entry_t *cache_acquire(struct cache_t *cache,
+                                    unsigned long long key, int *load) {
+    unsigned long long h = cache_hash(key);
+    struct cache_shard_t *shard = cache_shard(cache, h);
+
+    pthread_mutex_lock(&shard->mutex);
+
+    struct cache_entry_t *entry = shard_find(shard, key, h);
+    if (entry == NULL) {
+        entry = shard_insert(shard, key, h);
+        if (entry == NULL) {
+            pthread_mutex_unlock(&shard->mutex);
+            return NULL;
+        }
+    }
+    shard_ref(shard, entry);
+
+    while (entry->state == CACHE_LOADING) {
+        pthread_cond_wait(&shard->loaded, &shard->mutex);
+    }
+    if (entry->state == CACHE_EMPTY) {
+        entry->state = CACHE_LOADING;
+        *load = 1;
+    } else {
+        *load = 0;
+    }
+
+    pthread_mutex_unlock(&shard->mutex);
+    return entry;
+}
+
+void cache_complete(struct cache_t *cache, struct cache_entry_t *entry,
+                    char *data, size_t size) {
+    struct cache_shard_t *shard = cache_shard(cache, cache_hash(entry->key));
+
+    pthread_mutex_lock(&shard->mutex);
+    entry->data = data;
+    entry->size = size;
+    entry->state = CACHE_READY;
+    shard->used += size;
+    shard_evict(shard);
+    pthread_cond_broadcast(&shard->loaded);
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+void cache_abort(struct cache_t *cache, struct cache_entry_t *entry) {
+    struct cache_shard_t *shard = cache_shard(cache, cache_hash(entry->key));
+
+    pthread_mutex_lock(&shard->mutex);
+    entry->state = CACHE_EMPTY;
+    pthread_cond_broadcast(&shard->loaded);
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+void cache_release(struct cache_t *cache, struct cache_entry_t *entry) {
+    struct cache_shard_t *shard = cache_shard(cache, cache_hash(entry->key));
+
+    pthread_mutex_lock(&shard->mutex);
+    shard_unref(shard, entry);
+    pthread_mutex_unlock(&shard->mutex);
+}
+
+int cache_pin(struct cache_t *cache, unsigned long long key) {
+    unsigned long long h = cache_hash(key);
+    struct cache_shard_t *shard = cache_shard(cache, h);
+
+    pthread_mutex_lock(&shard->mutex);
+    struct cache_entry_t *entry = shard_find(shard, key, h);
+    if (entry == NULL) {
+        entry = shard_insert(shard, key, h);
+    }
+    if (entry != NULL) {
+        shard_ref(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+
+    return entry != NULL ? 0 : -1;
+}
+
+int cache_contains(struct cache_t *cache, unsigned long long key) {
+    unsigned long long h = cache_hash(key);
+    struct cache_shard_t *shard = cache_shard(cache, h);
+
+    pthread_mutex_lock(&shard->mutex);
+    struct cache_entry_t *entry = shard_find(shard, key, h);
+    int ready = entry != NULL && entry->state == CACHE_READY;
+    pthread_mutex_unlock(&shard->mutex);
+
+    return ready;
+}
+
+size_t cache_used(struct cache_t *cache) {
+    size_t used = 0;
+    for (size_t i = 0; i < cache->num_shards; ++i) {
+        struct cache_shard_t *shard = &cache->shards[i];
+        pthread_mutex_lock(&shard->mutex);
+        used += shard->used;
+        pthread_mutex_unlock(&shard->mutex);
+    }
+    return used;
+}
+
+void cache_unpin(struct cache_t *cache, unsigned long long key) {
+    unsigned long long h = cache_hash(key);
+    struct cache_shard_t *shard = cache_shard(cache, h);
+
+    pthread_mutex_lock(&shard->mutex);
+    struct cache_entry_t *entry = shard_find(shard, key, h);
+    if (entry != NULL) {
+        shard_unref(shard, entry);
+    }
+    pthread_mutex_unlock(&shard->mutex);
+}
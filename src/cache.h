@@ -0,0 +1,153 @@
+#pragma once
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+enum cache_state_t { CACHE_EMPTY, CACHE_LOADING, CACHE_READY };
+
+/**
+ * A cached buffer of decompressed data.
+ *
+ * The data of an acquired entry is immutable once it is ready, and can be read
+ * without holding any lock.
+ */
+struct cache_entry_t {
+    struct cache_entry_t *hash_next;
+    struct cache_entry_t *lru_prev;
+    struct cache_entry_t *lru_next;
+    unsigned long long key;
+    enum cache_state_t state;
+    // Number of outstanding cache_acquire and cache_pin calls.
+    size_t refs;
+    char *data;
+    size_t size;
+};
+
+struct cache_shard_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t loaded;
+    struct cache_entry_t **buckets;
+    size_t num_buckets;
+    size_t num_entries;
+    // Entries with no references, least recently used first.
+    struct cache_entry_t *lru_head;
+    struct cache_entry_t *lru_tail;
+    size_t used;
+    size_t budget;
+};
+
+/**
+ * A sharded cache of decompressed data with a total memory budget.
+ *
+ * Entries without references are evicted in LRU order once the budget of
+ * their shard is exceeded. Referenced entries are never evicted, so the budget
+ * can be exceeded temporarily by them.
+ */
+struct cache_t {
+    struct cache_shard_t *shards;
+    size_t num_shards;
+};
+
+/**
+ * Creates a cache.
+ *
+ * @param budget total memory budget in bytes.
+ * @param num_shards number of shards, at least 1.
+ *
+ * @return the cache, or NULL on error.
+ */
+extern struct cache_t *cache_create(size_t budget, size_t num_shards);
+
+/**
+ * Releases the cache and all of its entries, which must not be referenced.
+ *
+ * @param cache cache created by cache_create.
+ */
+extern void cache_free(struct cache_t *cache);
+
+/**
+ * Acquires a reference to the entry with the given key.
+ *
+ * If the entry is being loaded by another thread, waits for it. If the entry
+ * is not loaded yet, the caller becomes responsible for loading it, and must
+ * finish with either cache_complete or cache_abort before releasing it.
+ *
+ * @param cache cache created by cache_create.
+ * @param key key of the entry.
+ * @param load set to 1 if the caller must load the entry, 0 otherwise.
+ *
+ * @return the referenced entry, or NULL on error.
+ */
+extern struct cache_entry_t *cache_acquire(struct cache_t *cache,
+                                           unsigned long long key, int *load);
+
+/**
+ * Stores the loaded data of an entry, which the cache takes ownership of.
+ *
+ * @param cache cache created by cache_create.
+ * @param entry entry to be loaded by the caller.
+ * @param data data allocated by malloc(3).
+ * @param size size of the data in bytes.
+ */
+extern void cache_complete(struct cache_t *cache, struct cache_entry_t *entry,
+                           char *data, size_t size);
+
+/**
+ * Gives up loading an entry, so that another thread can try again.
+ *
+ * @param cache cache created by cache_create.
+ * @param entry entry to be loaded by the caller.
+ */
+extern void cache_abort(struct cache_t *cache, struct cache_entry_t *entry);
+
+/**
+ * Releases a reference acquired by cache_acquire.
+ *
+ * @param cache cache created by cache_create.
+ * @param entry the referenced entry.
+ */
+extern void cache_release(struct cache_t *cache, struct cache_entry_t *entry);
+
+/**
+ * Keeps the entry with the given key from being evicted until cache_unpin,
+ * whether it is loaded or not.
+ *
+ * @param cache cache created by cache_create.
+ * @param key key of the entry.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int cache_pin(struct cache_t *cache, unsigned long long key);
+
+/**
+ * Tells whether the entry with the given key is loaded, without referencing
+ * it. The answer may be outdated as soon as it is returned.
+ *
+ * @param cache cache created by cache_create.
+ * @param key key of the entry.
+ *
+ * @return 1 if loaded, 0 otherwise.
+ */
+extern int cache_contains(struct cache_t *cache, unsigned long long key);
+
+/**
+ * Returns how much of the budget is used by loaded entries. The answer may be
+ * outdated as soon as it is returned.
+ *
+ * @param cache cache created by cache_create.
+ *
+ * @return the size of the data of all loaded entries in bytes.
+ */
+extern size_t cache_used(struct cache_t *cache);
+
+/**
+ * Releases a reference acquired by cache_pin.
+ *
+ * @param cache cache created by cache_create.
+ * @param key key of the entry.
+ */
+extern void cache_unpin(struct cache_t *cache, unsigned long long key);
+
+#endif
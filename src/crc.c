@@ -0,0 +1,206 @@
+#include "crc.h"
+
+#include <pthread.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined __x86_64__ && (defined __GNUC__ || defined __clang__)
+#define CRC_PCLMUL
+#include <immintrin.h>
+#elif defined __aarch64__ && defined __ARM_FEATURE_CRC32
+#define CRC_ARMV8
+#include <arm_acle.h>
+#endif
+
+// Reversed polynomial of the CRC-32 of the zip format.
+#define CRC_POLY 0xedb88320U
+
+static pthread_once_t crc_once = PTHREAD_ONCE_INIT;
+// Tables for slicing by 8 bytes, of which the first one is the classic
+// byte-wise table.
+static uint32_t crc_table[8][256];
+static uint32_t (*crc_func)(uint32_t crc, const unsigned char *buf,
+                            size_t size);
+static const char *crc_name;
+
+// Works on the inverted checksum, like the other routines.
+static uint32_t crc_slice8(uint32_t crc, const unsigned char *buf,
+                           size_t size) {
+    while (size > 0 && ((uintptr_t)buf & 7) != 0) {
+        crc = crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        --size;
+    }
+    while (size >= 8) {
+        uint32_t lo;
+        uint32_t hi;
+        memcpy(&lo, buf, 4);
+        memcpy(&hi, buf + 4, 4);
+#if defined __BYTE_ORDER__ && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+        lo = __builtin_bswap32(lo);
+        hi = __builtin_bswap32(hi);
+#endif
+        lo ^= crc;
+        crc = crc_table[7][lo & 0xff] ^ crc_table[6][(lo >> 8) & 0xff] ^
+              crc_table[5][(lo >> 16) & 0xff] ^ crc_table[4][lo >> 24] ^
+              crc_table[3][hi & 0xff] ^ crc_table[2][(hi >> 8) & 0xff] ^
+              crc_table[1][(hi >> 16) & 0xff] ^ crc_table[0][hi >> 24];
+        buf += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        crc = crc_table[0][(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+        --size;
+    }
+    return crc;
+}
+
+#if defined CRC_PCLMUL
+
+// Folds 64 bytes at a time with carry-less multiplication, then reduces the
+// remainder to 32 bits, as in "Fast CRC Computation for Generic Polynomials
+// Using PCLMULQDQ Instruction" of Intel. Requires at least 64 bytes, and only
+// consumes multiples of 16.
+__attribute__((target("pclmul,sse4.1"))) static uint32_t
+crc_fold(uint32_t crc, const unsigned char *buf, size_t size) {
+    const __m128i k1k2 = _mm_set_epi64x(0x01c6e41596, 0x0154442bd4);
+    const __m128i k3k4 = _mm_set_epi64x(0x00ccaa009e, 0x01751997d0);
+    const __m128i k5k0 = _mm_set_epi64x(0, 0x0163cd6124);
+    const __m128i poly = _mm_set_epi64x(0x01f7011641, 0x01db710641);
+    const __m128i mask = _mm_setr_epi32(~0, 0, ~0, 0);
+
+    __m128i x1 = _mm_loadu_si128((const __m128i *)(buf + 0x00));
+    __m128i x2 = _mm_loadu_si128((const __m128i *)(buf + 0x10));
+    __m128i x3 = _mm_loadu_si128((const __m128i *)(buf + 0x20));
+    __m128i x4 = _mm_loadu_si128((const __m128i *)(buf + 0x30));
+    x1 = _mm_xor_si128(x1, _mm_cvtsi32_si128((int)crc));
+    buf += 64;
+    size -= 64;
+
+    while (size >= 64) {
+        __m128i x5 = _mm_clmulepi64_si128(x1, k1k2, 0x00);
+        __m128i x6 = _mm_clmulepi64_si128(x2, k1k2, 0x00);
+        __m128i x7 = _mm_clmulepi64_si128(x3, k1k2, 0x00);
+        __m128i x8 = _mm_clmulepi64_si128(x4, k1k2, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k1k2, 0x11);
+        x2 = _mm_clmulepi64_si128(x2, k1k2, 0x11);
+        x3 = _mm_clmulepi64_si128(x3, k1k2, 0x11);
+        x4 = _mm_clmulepi64_si128(x4, k1k2, 0x11);
+        x1 = _mm_xor_si128(_mm_xor_si128(x1, x5),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x00)));
+        x2 = _mm_xor_si128(_mm_xor_si128(x2, x6),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x10)));
+        x3 = _mm_xor_si128(_mm_xor_si128(x3, x7),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x20)));
+        x4 = _mm_xor_si128(_mm_xor_si128(x4, x8),
+                           _mm_loadu_si128((const __m128i *)(buf + 0x30)));
+        buf += 64;
+        size -= 64;
+    }
+
+    // Fold the four lanes into one, then the remaining blocks of 16 bytes.
+    __m128i x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x2), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x3), x5);
+    x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+    x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+    x1 = _mm_xor_si128(_mm_xor_si128(x1, x4), x5);
+    while (size >= 16) {
+        x5 = _mm_clmulepi64_si128(x1, k3k4, 0x00);
+        x1 = _mm_clmulepi64_si128(x1, k3k4, 0x11);
+        x1 = _mm_xor_si128(
+            _mm_xor_si128(x1, _mm_loadu_si128((const __m128i *)buf)), x5);
+        buf += 16;
+        size -= 16;
+    }
+
+    // Fold 128 bits to 64, then Barrett reduce to 32.
+    x2 = _mm_clmulepi64_si128(x1, k3k4, 0x10);
+    x1 = _mm_xor_si128(_mm_srli_si128(x1, 8), x2);
+    x2 = _mm_srli_si128(x1, 4);
+    x1 = _mm_and_si128(x1, mask);
+    x1 = _mm_clmulepi64_si128(x1, k5k0, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    x2 = _mm_and_si128(x1, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x10);
+    x2 = _mm_and_si128(x2, mask);
+    x2 = _mm_clmulepi64_si128(x2, poly, 0x00);
+    x1 = _mm_xor_si128(x1, x2);
+    return (uint32_t)_mm_extract_epi32(x1, 1);
+}
+
+static uint32_t crc_pclmul(uint32_t crc, const unsigned char *buf,
+                           size_t size) {
+    if (size >= 64) {
+        size_t n = size & ~(size_t)15;
+        crc = crc_fold(crc, buf, n);
+        buf += n;
+        size -= n;
+    }
+    return crc_slice8(crc, buf, size);
+}
+
+#elif defined CRC_ARMV8
+
+static uint32_t crc_armv8(uint32_t crc, const unsigned char *buf,
+                          size_t size) {
+    while (size > 0 && ((uintptr_t)buf & 7) != 0) {
+        crc = __crc32b(crc, *buf++);
+        --size;
+    }
+    while (size >= 8) {
+        uint64_t v;
+        memcpy(&v, buf, 8);
+        crc = __crc32d(crc, v);
+        buf += 8;
+        size -= 8;
+    }
+    while (size > 0) {
+        crc = __crc32b(crc, *buf++);
+        --size;
+    }
+    return crc;
+}
+
+#endif
+
+static void crc_init(void) {
+    for (uint32_t i = 0; i < 256; ++i) {
+        uint32_t c = i;
+        for (int k = 0; k < 8; ++k) {
+            c = c & 1 ? (c >> 1) ^ CRC_POLY : c >> 1;
+        }
+        crc_table[0][i] = c;
+    }
+    for (uint32_t i = 0; i < 256; ++i) {
+        for (int t = 1; t < 8; ++t) {
+            crc_table[t][i] = crc_table[0][crc_table[t - 1][i] & 0xff] ^
+                              (crc_table[t - 1][i] >> 8);
+        }
+    }
+
+    crc_func = crc_slice8;
+    crc_name = "slice-by-8";
+#if defined CRC_PCLMUL
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("pclmul") && __builtin_cpu_supports("sse4.1")) {
+        crc_func = crc_pclmul;
+        crc_name = "pclmul";
+    }
+#elif defined CRC_ARMV8
+    crc_func = crc_armv8;
+    crc_name = "armv8";
+#endif
+}
+
+const char *crc_engine(void) {
+    pthread_once(&crc_once, crc_init);
+    return crc_name;
+}
+
+unsigned int crc_update(unsigned int crc, const void *buf, size_t size) {
+    pthread_once(&crc_once, crc_init);
+    return ~crc_func(~(uint32_t)crc, (const unsigned char *)buf, size);
+}
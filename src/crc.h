@@ -0,0 +1,27 @@
+#pragma once
+#ifndef CRC_H
+#define CRC_H
+
+#include <stddef.h>
+
+/**
+ * Returns the name of the routine which computes CRC-32 checksums, chosen when
+ * first used from the features of the CPU.
+ *
+ * @return the name, such as "pclmul".
+ */
+extern const char *crc_engine(void);
+
+/**
+ * Updates the CRC-32 checksum of the zip format with more data, the same way
+ * as crc32 of zlib.
+ *
+ * @param crc checksum of the data so far, 0 for none.
+ * @param buf more data.
+ * @param size size of the data in bytes.
+ *
+ * @return the checksum including the data.
+ */
+extern unsigned int crc_update(unsigned int crc, const void *buf, size_t size);
+
+#endif
@@ -0,0 +1,187 @@
+#include "decode.h"
+
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "inflate.h"
+#include "log.h"
+
+#if defined ZIPFS_WITH_ZSTD
+#include <zstd.h>
+#define DECODE_ZSTD_NAME ", zstd " ZSTD_VERSION_STRING
+#else
+#define DECODE_ZSTD_NAME ""
+#endif
+
+#if defined ZIPFS_WITH_BZIP2
+#include <bzlib.h>
+#define DECODE_BZIP2_NAME ", bzip2"
+#else
+#define DECODE_BZIP2_NAME ""
+#endif
+
+#if defined ZIPFS_WITH_LZMA
+#include <lzma.h>
+#define DECODE_LZMA_NAME ", lzma " LZMA_VERSION_STRING
+#else
+#define DECODE_LZMA_NAME ""
+#endif
+
+#if defined ZIPFS_WITH_ZSTD
+
+// Decodes all frames of the data, skipping skippable frames such as the seek
+// table of the seekable format.
+static int decode_zstd(const void *in, size_t in_size, void *out,
+                       size_t out_size) {
+    size_t ret = ZSTD_decompress(out, out_size, in, in_size);
+    if (ZSTD_isError(ret)) {
+        eprintfln("Decode zstd data error: %s", ZSTD_getErrorName(ret));
+        return -1;
+    }
+    return ret == out_size ? 0 : -1;
+}
+
+#endif
+
+#if defined ZIPFS_WITH_BZIP2
+
+static int decode_bzip2(const void *in, size_t in_size, void *out,
+                        size_t out_size) {
+    bz_stream bs;
+    memset(&bs, 0, sizeof(bs));
+    if (BZ2_bzDecompressInit(&bs, 0, 0) != BZ_OK) {
+        eprintfln("Initialize bzip2 decoder error");
+        return -1;
+    }
+
+    // Sizes are fed in chunks, since bzip2 counts in unsigned int.
+    const char *next_in = (const char *)in;
+    char *next_out = (char *)out;
+    size_t in_left = in_size;
+    size_t out_left = out_size;
+    int ret = BZ_OK;
+    while (ret == BZ_OK) {
+        if (bs.avail_in == 0 && in_left > 0) {
+            bs.next_in = (char *)next_in;
+            bs.avail_in = in_left < UINT_MAX ? in_left : UINT_MAX;
+            next_in += bs.avail_in;
+            in_left -= bs.avail_in;
+        }
+        if (bs.avail_out == 0 && out_left > 0) {
+            bs.next_out = next_out;
+            bs.avail_out = out_left < UINT_MAX ? out_left : UINT_MAX;
+            next_out += bs.avail_out;
+            out_left -= bs.avail_out;
+        }
+        unsigned int avail_in = bs.avail_in;
+        unsigned int avail_out = bs.avail_out;
+        ret = BZ2_bzDecompress(&bs);
+        // Truncated data, or more of it than fits.
+        if (ret == BZ_OK && bs.avail_in == avail_in &&
+            bs.avail_out == avail_out) {
+            break;
+        }
+    }
+    unsigned long long total =
+        ((unsigned long long)bs.total_out_hi32 << 32) | bs.total_out_lo32;
+    BZ2_bzDecompressEnd(&bs);
+    return ret == BZ_STREAM_END && total == out_size ? 0 : -1;
+}
+
+#endif
+
+#if defined ZIPFS_WITH_LZMA
+
+// Size of the header in front of LZMA data in zip archives: the version of
+// the encoder, the size of the properties and the properties themselves.
+#define DECODE_LZMA_HEADER_SIZE 9
+
+static int decode_lzma(const void *in, size_t in_size, void *out,
+                       size_t out_size) {
+    const unsigned char *p = (const unsigned char *)in;
+    if (in_size < DECODE_LZMA_HEADER_SIZE || (p[2] | (p[3] << 8)) != 5) {
+        eprintfln("Invalid LZMA header");
+        return -1;
+    }
+
+    lzma_filter filters[2];
+    filters[0].id = LZMA_FILTER_LZMA1;
+    filters[0].options = NULL;
+    filters[1].id = LZMA_VLI_UNKNOWN;
+    filters[1].options = NULL;
+    if (lzma_properties_decode(&filters[0], NULL, p + 4, 5) != LZMA_OK) {
+        eprintfln("Invalid LZMA properties");
+        return -1;
+    }
+
+    lzma_stream ls = LZMA_STREAM_INIT;
+    lzma_ret ret = lzma_raw_decoder(&ls, filters);
+    free(filters[0].options);
+    if (ret != LZMA_OK) {
+        eprintfln("Initialize LZMA decoder error %d", ret);
+        return -1;
+    }
+
+    // The end of the data is either marked or implied by the size.
+    ls.next_in = p + DECODE_LZMA_HEADER_SIZE;
+    ls.avail_in = in_size - DECODE_LZMA_HEADER_SIZE;
+    ls.next_out = (uint8_t *)out;
+    ls.avail_out = out_size;
+    do {
+        ret = lzma_code(&ls, LZMA_FINISH);
+    } while (ret == LZMA_OK && ls.avail_out > 0);
+    unsigned long long total = ls.total_out;
+    lzma_end(&ls);
+    return (ret == LZMA_OK || ret == LZMA_STREAM_END) && total == out_size
+               ? 0
+               : -1;
+}
+
+#endif
+
+const char *decode_methods(void) {
+    return "deflate" DECODE_ZSTD_NAME DECODE_BZIP2_NAME DECODE_LZMA_NAME;
+}
+
+int decode_supported(int method) {
+    switch (method) {
+    case DECODE_METHOD_DEFLATE:
+#if defined ZIPFS_WITH_ZSTD
+    case DECODE_METHOD_ZSTD:
+#endif
+#if defined ZIPFS_WITH_BZIP2
+    case DECODE_METHOD_BZIP2:
+#endif
+#if defined ZIPFS_WITH_LZMA
+    case DECODE_METHOD_LZMA:
+#endif
+        return 1;
+    default:
+        return 0;
+    }
+}
+
+int decode_whole(int method, const void *in, size_t in_size, void *out,
+                 size_t out_size) {
+    switch (method) {
+    case DECODE_METHOD_DEFLATE:
+        return inflate_whole(in, in_size, out, out_size);
+#if defined ZIPFS_WITH_ZSTD
+    case DECODE_METHOD_ZSTD:
+        return decode_zstd(in, in_size, out, out_size);
+#endif
+#if defined ZIPFS_WITH_BZIP2
+    case DECODE_METHOD_BZIP2:
+        return decode_bzip2(in, in_size, out, out_size);
+#endif
+#if defined ZIPFS_WITH_LZMA
+    case DECODE_METHOD_LZMA:
+        return decode_lzma(in, in_size, out, out_size);
+#endif
+    default:
+        eprintfln("Compression method %d is not supported", method);
+        return -1;
+    }
+}
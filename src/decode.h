@@ -0,0 +1,49 @@
+#pragma once
+#ifndef DECODE_H
+#define DECODE_H
+
+#include <stddef.h>
+
+// Compression methods of the zip format, as returned by zip_entry_method.
+#define DECODE_METHOD_STORE 0
+#define DECODE_METHOD_DEFLATE 8
+#define DECODE_METHOD_BZIP2 12
+#define DECODE_METHOD_LZMA 14
+#define DECODE_METHOD_ZSTD 93
+
+/**
+ * Returns the compression methods which can be decoded, chosen at build time
+ * with ZIPFS_WITH_ZSTD, ZIPFS_WITH_BZIP2 and ZIPFS_WITH_LZMA on top of deflate.
+ *
+ * @return the names of the methods, such as "deflate, zstd 1.5.5".
+ */
+extern const char *decode_methods(void);
+
+/**
+ * Tells whether entries of a compression method can be decoded by
+ * decode_whole.
+ *
+ * @param method compression method of the entry.
+ *
+ * @return 1 if supported, 0 otherwise.
+ */
+extern int decode_supported(int method);
+
+/**
+ * Decodes the compressed data of an entry to a buffer in one go, with the
+ * inflate engine for deflate and the library of the method otherwise. The
+ * checksum is left to the caller.
+ *
+ * @param method compression method of the entry.
+ * @param in compressed data.
+ * @param in_size compressed size in bytes.
+ * @param out output buffer.
+ * @param out_size uncompressed size in bytes, which the data must decode to
+ *        exactly.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int decode_whole(int method, const void *in, size_t in_size, void *out,
+                        size_t out_size);
+
+#endif
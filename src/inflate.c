@@ -0,0 +1,106 @@
+#include "inflate.h"
+
+#include <limits.h>
+#include <stdio.h>
+
+#include "log.h"
+
+#if defined ZIPFS_INFLATE_LIBDEFLATE
+#include <libdeflate.h>
+#elif defined ZIPFS_INFLATE_ZLIB
+#include <zlib.h>
+#else
+#define MINIZ_HEADER_FILE_ONLY
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "miniz.h"
+#endif
+
+#if defined ZIPFS_INFLATE_LIBDEFLATE
+
+const char *inflate_engine(void) {
+    return "libdeflate " LIBDEFLATE_VERSION_STRING;
+}
+
+int inflate_whole(const void *in, size_t in_size, void *out,
+                  size_t out_size) {
+    // Decompressors are not thread-safe, and cheap compared with inflating a
+    // whole entry.
+    struct libdeflate_decompressor *d = libdeflate_alloc_decompressor();
+    if (d == NULL) {
+        eprintfln("Allocate decompressor error");
+        return -1;
+    }
+    size_t actual;
+    enum libdeflate_result ret =
+        libdeflate_deflate_decompress(d, in, in_size, out, out_size, &actual);
+    libdeflate_free_decompressor(d);
+    return ret == LIBDEFLATE_SUCCESS && actual == out_size ? 0 : -1;
+}
+
+#elif defined ZIPFS_INFLATE_ZLIB
+
+const char *inflate_engine(void) {
+#ifdef ZLIBNG_VERSION
+    return "zlib-ng " ZLIBNG_VERSION;
+#else
+    return "zlib " ZLIB_VERSION;
+#endif
+}
+
+int inflate_whole(const void *in, size_t in_size, void *out,
+                  size_t out_size) {
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = Z_NULL;
+    zs.avail_in = 0;
+    zs.next_out = Z_NULL;
+    zs.avail_out = 0;
+    // Negative window bits for raw deflate data, as stored in the archive.
+    if (inflateInit2(&zs, -MAX_WBITS) != Z_OK) {
+        eprintfln("Initialize inflater error");
+        return -1;
+    }
+
+    // Sizes are fed in chunks, since zlib counts in unsigned int.
+    const unsigned char *next_in = (const unsigned char *)in;
+    unsigned char *next_out = (unsigned char *)out;
+    size_t in_left = in_size;
+    size_t out_left = out_size;
+    int ret = Z_OK;
+    while (ret == Z_OK) {
+        if (zs.avail_in == 0 && in_left > 0) {
+            zs.next_in = (unsigned char *)next_in;
+            zs.avail_in = in_left < UINT_MAX ? in_left : UINT_MAX;
+            next_in += zs.avail_in;
+            in_left -= zs.avail_in;
+        }
+        if (zs.avail_out == 0) {
+            zs.next_out = next_out;
+            zs.avail_out = out_left < UINT_MAX ? out_left : UINT_MAX;
+            next_out += zs.avail_out;
+            out_left -= zs.avail_out;
+        }
+        ret = inflate(&zs, Z_NO_FLUSH);
+        if (ret == Z_BUF_ERROR && (zs.avail_in > 0 || in_left > 0) &&
+            (zs.avail_out > 0 || out_left > 0)) {
+            ret = Z_OK;
+        }
+    }
+    size_t total = (size_t)(next_out - (unsigned char *)out) - zs.avail_out;
+    inflateEnd(&zs);
+    return ret == Z_STREAM_END && total == out_size ? 0 : -1;
+}
+
+#else
+
+const char *inflate_engine(void) { return "miniz " MZ_VERSION; }
+
+int inflate_whole(const void *in, size_t in_size, void *out,
+                  size_t out_size) {
+    size_t ret = tinfl_decompress_mem_to_mem(out, out_size, in, in_size, 0);
+    return ret == out_size ? 0 : -1;
+}
+
+#endif
@@ -0,0 +1,30 @@
+#pragma once
+#ifndef INFLATE_H
+#define INFLATE_H
+
+#include <stddef.h>
+
+/**
+ * Returns the name of the engine which inflates whole entries, chosen at build
+ * time with ZIPFS_INFLATE_LIBDEFLATE or ZIPFS_INFLATE_ZLIB, miniz otherwise.
+ *
+ * @return the name, such as "libdeflate 1.18".
+ */
+extern const char *inflate_engine(void);
+
+/**
+ * Inflates raw deflate data to a buffer in one go. The checksum is left to the
+ * caller, which verifies it once over the whole entry.
+ *
+ * @param in compressed data.
+ * @param in_size compressed size in bytes.
+ * @param out output buffer.
+ * @param out_size uncompressed size in bytes, which the data must inflate to
+ *        exactly.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int inflate_whole(const void *in, size_t in_size, void *out,
+                         size_t out_size);
+
+#endif
@@ -0,0 +1,437 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "io.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "log.h"
+
+#if defined __linux__
+#include <sys/syscall.h>
+#endif
+
+#if defined __NR_io_uring_setup && defined __NR_io_uring_enter
+#define IO_WITH_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#endif
+
+// Offsets and sizes of reads with O_DIRECT are rounded to this, which covers
+// the logical block size of any device.
+#define IO_DIRECT_ALIGN 4096ULL
+#define IO_ALIGN_DOWN(x) ((x) & ~(IO_DIRECT_ALIGN - 1))
+
+#if defined IO_WITH_URING
+
+// Requests which may be in flight at once, rounded by the kernel.
+#define IO_RING_ENTRIES 256
+
+// A request waited for by the thread which submitted it.
+struct io_request_t {
+    int done;
+    int res;
+};
+
+// An io_uring, whose submission queue is filled by any thread holding the
+// mutex. One waiting thread at a time reaps completions for all of them.
+struct io_ring_t {
+    int fd;
+    unsigned entries;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+    void *sq_ptr;
+    size_t sq_size;
+    void *cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+
+    pthread_mutex_t mutex;
+    pthread_cond_t completed;
+    int reaping;
+    unsigned inflight;
+};
+
+static int io_uring_setup_(unsigned entries, struct io_uring_params *p) {
+    return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int io_uring_enter_(int fd, unsigned to_submit, unsigned min_complete,
+                           unsigned flags) {
+    return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+                        flags, NULL, 0);
+}
+
+static void io_ring_free(struct io_ring_t *ring) {
+    if (ring->sqes != NULL) {
+        munmap(ring->sqes, ring->sqes_size);
+    }
+    if (ring->cq_ptr != NULL && ring->cq_ptr != ring->sq_ptr) {
+        munmap(ring->cq_ptr, ring->cq_size);
+    }
+    if (ring->sq_ptr != NULL) {
+        munmap(ring->sq_ptr, ring->sq_size);
+    }
+    close(ring->fd);
+    pthread_mutex_destroy(&ring->mutex);
+    pthread_cond_destroy(&ring->completed);
+    free(ring);
+}
+
+static struct io_ring_t *io_ring_create(void) {
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    int fd = io_uring_setup_(IO_RING_ENTRIES, &p);
+    if (fd < 0) {
+        perror("io_uring_setup()");
+        return NULL;
+    }
+
+    struct io_ring_t *ring = (struct io_ring_t *)calloc(1, sizeof(*ring));
+    if (ring == NULL) {
+        perror("calloc()");
+        close(fd);
+        return NULL;
+    }
+    ring->fd = fd;
+    ring->entries = p.sq_entries;
+    pthread_mutex_init(&ring->mutex, NULL);
+    pthread_cond_init(&ring->completed, NULL);
+
+    ring->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    ring->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    int single = (p.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (single && ring->cq_size > ring->sq_size) {
+        ring->sq_size = ring->cq_size;
+    }
+    ring->sq_ptr = mmap(NULL, ring->sq_size, PROT_READ | PROT_WRITE,
+                        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (ring->sq_ptr == MAP_FAILED) {
+        ring->sq_ptr = NULL;
+        goto error;
+    }
+    if (single) {
+        ring->cq_ptr = ring->sq_ptr;
+    } else {
+        ring->cq_ptr = mmap(NULL, ring->cq_size, PROT_READ | PROT_WRITE,
+                            MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (ring->cq_ptr == MAP_FAILED) {
+            ring->cq_ptr = NULL;
+            goto error;
+        }
+    }
+    ring->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    ring->sqes = (struct io_uring_sqe *)mmap(
+        NULL, ring->sqes_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (ring->sqes == MAP_FAILED) {
+        ring->sqes = NULL;
+        goto error;
+    }
+
+    char *sq = (char *)ring->sq_ptr;
+    char *cq = (char *)ring->cq_ptr;
+    ring->sq_head = (unsigned *)(sq + p.sq_off.head);
+    ring->sq_tail = (unsigned *)(sq + p.sq_off.tail);
+    ring->sq_mask = (unsigned *)(sq + p.sq_off.ring_mask);
+    ring->sq_array = (unsigned *)(sq + p.sq_off.array);
+    ring->cq_head = (unsigned *)(cq + p.cq_off.head);
+    ring->cq_tail = (unsigned *)(cq + p.cq_off.tail);
+    ring->cq_mask = (unsigned *)(cq + p.cq_off.ring_mask);
+    ring->cqes = (struct io_uring_cqe *)(cq + p.cq_off.cqes);
+    return ring;
+
+error:
+    perror("mmap()");
+    io_ring_free(ring);
+    return NULL;
+}
+
+// Queues a request and submits it, waiting for room in the ring first. Called
+// with the mutex held.
+static int io_ring_submit(struct io_ring_t *ring, int op, int fd,
+                          unsigned long long offset, void *buf, size_t size,
+                          unsigned advice, struct io_request_t *request) {
+    while (ring->inflight >= ring->entries) {
+        pthread_cond_wait(&ring->completed, &ring->mutex);
+    }
+
+    unsigned tail = *ring->sq_tail;
+    unsigned i = tail & *ring->sq_mask;
+    struct io_uring_sqe *sqe = &ring->sqes[i];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = (unsigned char)op;
+    sqe->fd = fd;
+    sqe->off = offset;
+    sqe->addr = (unsigned long long)(uintptr_t)buf;
+    sqe->len = (unsigned)size;
+    sqe->fadvise_advice = advice;
+    sqe->user_data = (unsigned long long)(uintptr_t)request;
+    ring->sq_array[i] = i;
+    __atomic_store_n(ring->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+    // Submits whatever the kernel has not taken yet, which is only this entry
+    // unless an earlier submission stopped short.
+    int ret;
+    do {
+        unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        ret = io_uring_enter_(ring->fd, tail + 1 - head, 0, 0);
+    } while (ret < 0 && (errno == EINTR || errno == EAGAIN));
+    if (ret < 0 &&
+        __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE) == tail) {
+        // The kernel did not take the entry, which is taken back so that it
+        // does not go with the next submission.
+        int err = errno;
+        perror("io_uring_enter()");
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+        return -err;
+    }
+    ++ring->inflight;
+    return 0;
+}
+
+// Takes all completions, waking up the threads waiting for them. Called with
+// the mutex held.
+static void io_ring_reap(struct io_ring_t *ring) {
+    unsigned head = *ring->cq_head;
+    unsigned tail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+    for (; head != tail; ++head) {
+        struct io_uring_cqe *cqe = &ring->cqes[head & *ring->cq_mask];
+        struct io_request_t *request =
+            (struct io_request_t *)(uintptr_t)cqe->user_data;
+        // Advice is not waited for.
+        if (request != NULL) {
+            request->res = cqe->res;
+            request->done = 1;
+        }
+        --ring->inflight;
+    }
+    __atomic_store_n(ring->cq_head, head, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&ring->completed);
+}
+
+// Reads once through the ring, returning what the kernel did.
+static ssize_t io_ring_read(struct io_ring_t *ring, int fd,
+                            unsigned long long offset, void *buf,
+                            size_t size) {
+    struct io_request_t request = {0, 0};
+
+    pthread_mutex_lock(&ring->mutex);
+    int ret = io_ring_submit(ring, IORING_OP_READ, fd, offset, buf, size, 0,
+                             &request);
+    while (ret == 0 && !request.done) {
+        if (ring->reaping) {
+            pthread_cond_wait(&ring->completed, &ring->mutex);
+            continue;
+        }
+
+        // Reap on behalf of everyone until this request is done, submitting
+        // along whatever the kernel has not taken yet, so that the request
+        // waited for cannot be left behind.
+        ring->reaping = 1;
+        unsigned backlog = *ring->sq_tail -
+                           __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+        pthread_mutex_unlock(&ring->mutex);
+        int n = io_uring_enter_(ring->fd, backlog, 1, IORING_ENTER_GETEVENTS);
+        int err = errno;
+        pthread_mutex_lock(&ring->mutex);
+        ring->reaping = 0;
+        io_ring_reap(ring);
+        if (n < 0 && err != EINTR && !request.done) {
+            errno = err;
+            perror("io_uring_enter()");
+            ret = -err;
+        }
+    }
+    pthread_mutex_unlock(&ring->mutex);
+    return ret != 0 ? ret : request.res;
+}
+
+static void io_ring_advise(struct io_ring_t *ring, int fd,
+                           unsigned long long offset, unsigned long long size,
+                           int advice) {
+    pthread_mutex_lock(&ring->mutex);
+    // The ring is not filled up with advice.
+    if (ring->inflight < ring->entries / 2) {
+        io_ring_submit(ring, IORING_OP_FADVISE, fd, offset, NULL,
+                       size > UINT32_MAX ? UINT32_MAX : size, advice, NULL);
+    }
+    pthread_mutex_unlock(&ring->mutex);
+}
+
+#else
+
+struct io_ring_t {
+    int unused;
+};
+
+static struct io_ring_t *io_ring_create(void) {
+    eprintfln("io_uring is not supported on this system");
+    return NULL;
+}
+
+static void io_ring_free(struct io_ring_t *ring) { (void)ring; }
+
+static ssize_t io_ring_read(struct io_ring_t *ring, int fd,
+                            unsigned long long offset, void *buf,
+                            size_t size) {
+    (void)ring;
+    return pread(fd, buf, size, offset);
+}
+
+static void io_ring_advise(struct io_ring_t *ring, int fd,
+                           unsigned long long offset, unsigned long long size,
+                           int advice) {
+    (void)ring;
+    (void)fd;
+    (void)offset;
+    (void)size;
+    (void)advice;
+}
+
+#endif
+
+const char *io_engine(const struct io_t *io) {
+    if (io->ring != NULL) {
+        return io->direct_fd >= 0 ? "io_uring O_DIRECT" : "io_uring";
+    }
+    return io->direct_fd >= 0 ? "pread O_DIRECT" : "pread";
+}
+
+struct io_t *io_open(const char *path, int flags) {
+    struct io_t *io = (struct io_t *)calloc(1, sizeof(*io));
+    if (io == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    io->direct_fd = -1;
+
+    io->fd = open(path, O_RDONLY);
+    if (io->fd < 0) {
+        perror("open()");
+        free(io);
+        return NULL;
+    }
+    if (flags & IO_DIRECT) {
+#if defined O_DIRECT
+        io->direct_fd = open(path, O_RDONLY | O_DIRECT);
+#endif
+        if (io->direct_fd < 0) {
+            eprintfln("O_DIRECT is not supported for '%s', reading it "
+                      "buffered",
+                      path);
+        }
+    }
+    if (flags & IO_URING) {
+        io->ring = io_ring_create();
+        if (io->ring == NULL) {
+            eprintfln("Reading '%s' with pread instead of io_uring", path);
+        }
+    }
+    return io;
+}
+
+void io_close(struct io_t *io) {
+    if (io == NULL) {
+        return;
+    }
+    if (io->ring != NULL) {
+        io_ring_free(io->ring);
+    }
+    if (io->direct_fd >= 0) {
+        close(io->direct_fd);
+    }
+    close(io->fd);
+    free(io);
+}
+
+// Reads once, returning what the kernel did.
+static ssize_t io_read_once(struct io_t *io, int fd, unsigned long long offset,
+                            void *buf, size_t size) {
+    if (io->ring != NULL) {
+        ssize_t ret = io_ring_read(io->ring, fd, offset, buf, size);
+        // Kernels before 5.6 lack the read operation.
+        if (ret != -EINVAL && ret != -EOPNOTSUPP) {
+            return ret;
+        }
+    }
+    ssize_t ret = pread(fd, buf, size, offset);
+    return ret < 0 ? -errno : ret;
+}
+
+// Reads until size bytes or the end of the file, retrying interrupted reads.
+static ssize_t io_read_full(struct io_t *io, int fd, unsigned long long offset,
+                            char *buf, size_t size) {
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n =
+            io_read_once(io, fd, offset + done, buf + done, size - done);
+        if (n == -EINTR || n == -EAGAIN) {
+            continue;
+        }
+        if (n < 0) {
+            return n;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += n;
+    }
+    return (ssize_t)done;
+}
+
+ssize_t io_read(struct io_t *io, unsigned long long offset, void *buf,
+                size_t size) {
+    if (io->direct_fd < 0) {
+        return io_read_full(io, io->fd, offset, (char *)buf, size);
+    }
+
+    // Read the aligned blocks around the range into a bounce buffer.
+    unsigned long long start = IO_ALIGN_DOWN(offset);
+    unsigned long long end = IO_ALIGN_DOWN(offset + size + IO_DIRECT_ALIGN - 1);
+    void *bounce;
+    if (posix_memalign(&bounce, IO_DIRECT_ALIGN, end - start) != 0) {
+        return -ENOMEM;
+    }
+    ssize_t n = io_read_full(io, io->direct_fd, start, (char *)bounce,
+                             end - start);
+    if (n >= 0) {
+        size_t skip = offset - start;
+        n = (size_t)n > skip ? n - (ssize_t)skip : 0;
+        if ((size_t)n > size) {
+            n = (ssize_t)size;
+        }
+        memcpy(buf, (char *)bounce + skip, n);
+    }
+    free(bounce);
+    return n;
+}
+
+void io_advise(struct io_t *io, unsigned long long offset,
+               unsigned long long size, int advice) {
+    if (io->ring != NULL) {
+        io_ring_advise(io->ring, io->fd, offset, size, advice);
+        return;
+    }
+#if defined POSIX_FADV_WILLNEED
+    posix_fadvise(io->fd, offset, size, advice);
+#else
+    (void)offset;
+    (void)size;
+    (void)advice;
+#endif
+}
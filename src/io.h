@@ -0,0 +1,83 @@
+#pragma once
+#ifndef IO_H
+#define IO_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+// Flags of io_open.
+#define IO_URING 1
+#define IO_DIRECT 2
+
+/**
+ * A file read with positioned reads which may be issued by any number of
+ * threads at once, either with pread or submitted to an io_uring shared by
+ * all of them, so that the queue depth of the device grows with the number of
+ * readers.
+ */
+struct io_t {
+    int fd;
+    // Separate descriptor opened with O_DIRECT, or -1.
+    int direct_fd;
+    // The ring, or NULL for pread.
+    struct io_ring_t *ring;
+};
+
+/**
+ * Returns the name of the way a file is read.
+ *
+ * @param io file opened by io_open.
+ *
+ * @return "io_uring" or "pread", along with "O_DIRECT" if set.
+ */
+extern const char *io_engine(const struct io_t *io);
+
+/**
+ * Opens a file for reading. Falls back to pread if io_uring is not supported
+ * by the kernel, and to buffered reads if O_DIRECT is not supported by the
+ * file system.
+ *
+ * @param path path of the file.
+ * @param flags IO_URING to read through an io_uring, IO_DIRECT to bypass the
+ *        page cache.
+ *
+ * @return the file, or NULL on error.
+ */
+extern struct io_t *io_open(const char *path, int flags);
+
+/**
+ * Closes the file, which must not be read from anymore.
+ *
+ * @param io file opened by io_open.
+ */
+extern void io_close(struct io_t *io);
+
+/**
+ * Reads from the file, waiting for the data.
+ *
+ * @param io file opened by io_open.
+ * @param offset offset to read at.
+ * @param buf output buffer.
+ * @param size number of bytes to read.
+ *
+ * @return number of bytes read, less than size only at the end of the file,
+ *         or negative errno on error.
+ */
+extern ssize_t io_read(struct io_t *io, unsigned long long offset, void *buf,
+                       size_t size);
+
+/**
+ * Tells the kernel how a range of the file is going to be read, without
+ * waiting for anything. Ranges about to be read are read ahead into the page
+ * cache in the background, which does not help with O_DIRECT.
+ *
+ * @param io file opened by io_open.
+ * @param offset offset of the range.
+ * @param size size of the range.
+ * @param advice POSIX_FADV_WILLNEED or POSIX_FADV_SEQUENTIAL.
+ */
+extern void io_advise(struct io_t *io, unsigned long long offset,
+                      unsigned long long size, int advice);
+
+#endif
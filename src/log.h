@@ -0,0 +1,31 @@
+#pragma once
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdio.h>
+
+#define VAL(x) #x
+#define STR(x) VAL(x)
+
+#define DEBUG_PRINT_PREFIX "[DEBUG " __FILE__ ":" STR(__LINE__) "] "
+
+#define eprintf(...) fprintf(stderr, __VA_ARGS__)
+#define eprintfln(...)                                                         \
+    do {                                                                       \
+        eprintf(__VA_ARGS__);                                                  \
+        eprintf("\n");                                                         \
+    } while (0)
+
+#if defined DEBUG
+#define debug_eprintf(...) eprintf(DEBUG_PRINT_PREFIX __VA_ARGS__)
+#else
+#define debug_eprintf(...)
+#endif
+
+#if defined DEBUG
+#define debug_eprintfln(...) eprintfln(DEBUG_PRINT_PREFIX __VA_ARGS__)
+#else
+#define debug_eprintfln(...)
+#endif
+
+#endif
@@ -0,0 +1,98 @@
+#include "parallel.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+// Inflates a range, once it is not pending anymore.
+static void parallel_run(void *opaque, int index, unsigned long long first,
+                         unsigned long long last) {
+    struct parallel_t *parallel = (struct parallel_t *)opaque;
+
+    pthread_mutex_lock(&parallel->mutex);
+    for (size_t i = 0; i < parallel->num_pending; ++i) {
+        if (parallel->pending[i].index == index &&
+            parallel->pending[i].first == first) {
+            parallel->pending[i] = parallel->pending[--parallel->num_pending];
+            break;
+        }
+    }
+    pthread_mutex_unlock(&parallel->mutex);
+
+    if (parallel->load(parallel->opaque, index, first, last) != 0) {
+        eprintfln("Inflate blocks %llu to %llu of entry with index %d "
+                  "ahead error",
+                  first, last, index);
+    }
+}
+
+struct parallel_t *parallel_create(struct pool_t *pool, size_t max_pending,
+                                   parallel_load_func load, void *opaque) {
+    struct parallel_t *parallel =
+        (struct parallel_t *)calloc(1, sizeof(*parallel));
+    if (parallel == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    parallel->pending = (struct parallel_task_t *)malloc(
+        max_pending * sizeof(struct parallel_task_t));
+    if (parallel->pending == NULL) {
+        perror("malloc()");
+        free(parallel);
+        return NULL;
+    }
+
+    pthread_mutex_init(&parallel->mutex, NULL);
+    parallel->pool = pool;
+    parallel->load = load;
+    parallel->opaque = opaque;
+    parallel->max_pending = max_pending;
+    return parallel;
+}
+
+void parallel_free(struct parallel_t *parallel) {
+    if (parallel == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&parallel->mutex);
+    free(parallel->pending);
+    free(parallel);
+}
+
+int parallel_queue(struct parallel_t *parallel, enum pool_priority_t priority,
+                   int index, unsigned long long first,
+                   unsigned long long last) {
+    pthread_mutex_lock(&parallel->mutex);
+
+    // Files open on the same entry plan the same ranges.
+    for (size_t i = 0; i < parallel->num_pending; ++i) {
+        const struct parallel_task_t *task = &parallel->pending[i];
+        if (task->index == index && task->first == first) {
+            pthread_mutex_unlock(&parallel->mutex);
+            return 0;
+        }
+    }
+    if (parallel->num_pending == parallel->max_pending) {
+        pthread_mutex_unlock(&parallel->mutex);
+        return -1;
+    }
+
+    struct parallel_task_t *task = &parallel->pending[parallel->num_pending];
+    task->index = index;
+    task->first = first;
+    task->last = last;
+    ++parallel->num_pending;
+
+    // Under the mutex, so that the range can be taken back on error.
+    int ret = pool_submit(parallel->pool, priority, parallel_run, parallel,
+                          index, first, last);
+    if (ret != 0) {
+        --parallel->num_pending;
+    }
+
+    pthread_mutex_unlock(&parallel->mutex);
+    return ret;
+}
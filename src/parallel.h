@@ -0,0 +1,85 @@
+#pragma once
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "pool.h"
+
+/**
+ * Inflates a range of blocks of a streamed entry into the cache.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+typedef int (*parallel_load_func)(void *opaque, int index,
+                                  unsigned long long first,
+                                  unsigned long long last);
+
+// A range of blocks from first up to but excluding last.
+struct parallel_task_t {
+    int index;
+    unsigned long long first;
+    unsigned long long last;
+};
+
+/**
+ * Inflates disjoint ranges of the same large entries at once on the workers
+ * of a pool, each resuming at a seek point of its own, so that the blocks are
+ * cached before the reader of the entry gets to them.
+ */
+struct parallel_t {
+    pthread_mutex_t mutex;
+    struct pool_t *pool;
+
+    parallel_load_func load;
+    void *opaque;
+
+    // Ranges submitted to the pool and not taken by a worker yet, in no
+    // particular order. Ranges which do not fit are left to the reader.
+    struct parallel_task_t *pending;
+    size_t num_pending;
+    size_t max_pending;
+};
+
+/**
+ * Creates a parallel inflater.
+ *
+ * @param pool pool the ranges are inflated on.
+ * @param max_pending maximal number of ranges waiting for a worker, at least
+ *        1.
+ * @param load function inflating a range.
+ * @param opaque argument passed to load.
+ *
+ * @return the inflater, or NULL on error.
+ */
+extern struct parallel_t *parallel_create(struct pool_t *pool,
+                                          size_t max_pending,
+                                          parallel_load_func load,
+                                          void *opaque);
+
+/**
+ * Releases the inflater, once the pool has been freed.
+ *
+ * @param parallel inflater created by parallel_create.
+ */
+extern void parallel_free(struct parallel_t *parallel);
+
+/**
+ * Queues a range of blocks of an entry, unless it is queued already.
+ *
+ * @param parallel inflater created by parallel_create.
+ * @param priority POOL_DEMAND for the range the reader gets to next,
+ *        POOL_SPECULATIVE for ranges further ahead.
+ * @param index index of the entry.
+ * @param first first block of the range.
+ * @param last block following the range.
+ *
+ * @return the return code - 0 on success, negative number (< 0) if too many
+ *         ranges are waiting.
+ */
+extern int parallel_queue(struct parallel_t *parallel,
+                          enum pool_priority_t priority, int index,
+                          unsigned long long first, unsigned long long last);
+
+#endif
@@ -0,0 +1,317 @@
+#ifndef _GNU_SOURCE
+#define _GNU_SOURCE
+#endif
+
+#include "pool.h"
+
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+// Tasks a worker may have spawned and not run yet, a power of 2.
+#define POOL_DEQUE_CAP 1024
+
+// Worker running on the current thread, if any.
+static __thread struct pool_worker_t *pool_self;
+
+static int pool_deque_push(struct pool_deque_t *deque,
+                           struct pool_task_t *task) {
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+    long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    if (b - t >= POOL_DEQUE_CAP) {
+        return -1;
+    }
+    __atomic_store_n(&deque->tasks[b & (POOL_DEQUE_CAP - 1)], task,
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    return 0;
+}
+
+static struct pool_task_t *pool_deque_pop(struct pool_deque_t *deque) {
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    __atomic_store_n(&deque->bottom, b, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long t = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+    if (t > b) {
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+        return NULL;
+    }
+
+    struct pool_task_t *task = __atomic_load_n(
+        &deque->tasks[b & (POOL_DEQUE_CAP - 1)], __ATOMIC_RELAXED);
+    if (t == b) {
+        // The last task, which a thief may take first.
+        if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = NULL;
+        }
+        __atomic_store_n(&deque->bottom, b + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+static struct pool_task_t *pool_deque_steal(struct pool_deque_t *deque) {
+    long t = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    long b = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if (t >= b) {
+        return NULL;
+    }
+
+    struct pool_task_t *task = __atomic_load_n(
+        &deque->tasks[t & (POOL_DEQUE_CAP - 1)], __ATOMIC_RELAXED);
+    if (!__atomic_compare_exchange_n(&deque->top, &t, t + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return NULL;
+    }
+    return task;
+}
+
+// Takes a submitted task of a priority. Called with the mutex held.
+static struct pool_task_t *pool_dequeue(struct pool_t *pool,
+                                        enum pool_priority_t priority) {
+    struct pool_task_t *task = pool->heads[priority];
+    if (task == NULL) {
+        return NULL;
+    }
+    pool->heads[priority] = task->next;
+    if (pool->heads[priority] == NULL) {
+        pool->tails[priority] = NULL;
+    }
+    if (priority == POOL_DEMAND) {
+        __atomic_store_n(&pool->num_demand, pool->num_demand - 1,
+                         __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+// Takes the next task of a worker: submitted demand and speculative tasks,
+// then its own spawned ones, then the ones of others, then background tasks.
+// Waits for one unless stopped.
+static struct pool_task_t *pool_next(struct pool_worker_t *self) {
+    struct pool_t *pool = self->pool;
+
+    for (;;) {
+        pthread_mutex_lock(&pool->mutex);
+        if (pool->stop) {
+            pthread_mutex_unlock(&pool->mutex);
+            return NULL;
+        }
+        struct pool_task_t *task = pool_dequeue(pool, POOL_DEMAND);
+        if (task == NULL) {
+            task = pool_dequeue(pool, POOL_SPECULATIVE);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+
+        // Deques of workers not started yet are empty.
+        if (task == NULL) {
+            task = pool_deque_pop(&self->deque);
+        }
+        for (size_t i = 1; task == NULL && i < pool->num_workers; ++i) {
+            size_t victim = (self->id + i) % pool->num_workers;
+            task = pool_deque_steal(&pool->workers[victim].deque);
+        }
+        if (task == NULL) {
+            pthread_mutex_lock(&pool->mutex);
+            task = pool_dequeue(pool, POOL_BACKGROUND);
+            pthread_mutex_unlock(&pool->mutex);
+        }
+        if (task != NULL) {
+            __atomic_fetch_sub(&pool->num_tasks, 1, __ATOMIC_RELAXED);
+            return task;
+        }
+
+        // A steal may have lost a race, so sleep only if nothing is left.
+        pthread_mutex_lock(&pool->mutex);
+        while (!pool->stop &&
+               __atomic_load_n(&pool->num_tasks, __ATOMIC_RELAXED) == 0) {
+            pthread_cond_wait(&pool->queued, &pool->mutex);
+        }
+        pthread_mutex_unlock(&pool->mutex);
+    }
+}
+
+static void *pool_worker(void *arg) {
+    struct pool_worker_t *self = (struct pool_worker_t *)arg;
+    pool_self = self;
+
+#if defined __linux__
+    if (self->cpu >= 0 && self->cpu < CPU_SETSIZE) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(self->cpu, &set);
+        if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0) {
+            eprintfln("Pin worker %zu to CPU %d error", self->id, self->cpu);
+        }
+    }
+#endif
+
+    struct pool_task_t *task;
+    while ((task = pool_next(self)) != NULL) {
+        task->run(task->opaque, task->index, task->first, task->last);
+        free(task);
+    }
+    return NULL;
+}
+
+struct pool_t *pool_create(size_t num_workers, const int *cpus,
+                           size_t num_cpus) {
+    struct pool_t *pool = (struct pool_t *)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    pool->workers = (struct pool_worker_t *)calloc(
+        num_workers, sizeof(struct pool_worker_t));
+    if (pool->workers == NULL) {
+        perror("calloc()");
+        free(pool);
+        return NULL;
+    }
+    pool->num_workers = num_workers;
+    pthread_mutex_init(&pool->mutex, NULL);
+    pthread_cond_init(&pool->queued, NULL);
+
+    for (size_t i = 0; i < num_workers; ++i) {
+        struct pool_worker_t *worker = &pool->workers[i];
+        worker->pool = pool;
+        worker->id = i;
+        worker->cpu = cpus != NULL && num_cpus > 0 ? cpus[i % num_cpus] : -1;
+        worker->deque.tasks = (struct pool_task_t **)calloc(
+            POOL_DEQUE_CAP, sizeof(struct pool_task_t *));
+        if (worker->deque.tasks == NULL) {
+            perror("calloc()");
+            pool_free(pool);
+            return NULL;
+        }
+    }
+    return pool;
+}
+
+int pool_start(struct pool_t *pool) {
+    for (; pool->num_started < pool->num_workers; ++pool->num_started) {
+        struct pool_worker_t *worker = &pool->workers[pool->num_started];
+        if (pthread_create(&worker->thread, NULL, pool_worker, worker) != 0) {
+            perror("pthread_create()");
+            break;
+        }
+    }
+
+    debug_eprintfln("Worker pool with %zu workers started",
+                    pool->num_started);
+    return pool->num_started > 0 ? 0 : -1;
+}
+
+void pool_free(struct pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    pool->stop = 1;
+    pthread_cond_broadcast(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+    for (size_t i = 0; i < pool->num_started; ++i) {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (size_t i = 0; i < POOL_NUM_PRIORITIES; ++i) {
+        struct pool_task_t *task;
+        while ((task = pool_dequeue(pool, (enum pool_priority_t)i)) != NULL) {
+            free(task);
+        }
+    }
+    for (size_t i = 0; i < pool->num_workers; ++i) {
+        struct pool_deque_t *deque = &pool->workers[i].deque;
+        if (deque->tasks == NULL) {
+            continue;
+        }
+        for (long j = deque->top; j < deque->bottom; ++j) {
+            free(deque->tasks[j & (POOL_DEQUE_CAP - 1)]);
+        }
+        free(deque->tasks);
+    }
+    pthread_mutex_destroy(&pool->mutex);
+    pthread_cond_destroy(&pool->queued);
+    free(pool->workers);
+    free(pool);
+}
+
+static struct pool_task_t *pool_task_create(pool_run_func run, void *opaque,
+                                            int index,
+                                            unsigned long long first,
+                                            unsigned long long last) {
+    struct pool_task_t *task =
+        (struct pool_task_t *)malloc(sizeof(struct pool_task_t));
+    if (task == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+    task->next = NULL;
+    task->run = run;
+    task->opaque = opaque;
+    task->index = index;
+    task->first = first;
+    task->last = last;
+    return task;
+}
+
+int pool_submit(struct pool_t *pool, enum pool_priority_t priority,
+                pool_run_func run, void *opaque, int index,
+                unsigned long long first, unsigned long long last) {
+    struct pool_task_t *task =
+        pool_task_create(run, opaque, index, first, last);
+    if (task == NULL) {
+        return -1;
+    }
+
+    pthread_mutex_lock(&pool->mutex);
+    if (pool->tails[priority] != NULL) {
+        pool->tails[priority]->next = task;
+    } else {
+        pool->heads[priority] = task;
+    }
+    pool->tails[priority] = task;
+    __atomic_fetch_add(&pool->num_tasks, 1, __ATOMIC_RELAXED);
+    if (priority == POOL_DEMAND) {
+        __atomic_store_n(&pool->num_demand, pool->num_demand + 1,
+                         __ATOMIC_RELAXED);
+    }
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+int pool_spawn(struct pool_t *pool, pool_run_func run, void *opaque,
+               int index, unsigned long long first, unsigned long long last) {
+    struct pool_worker_t *self = pool_self;
+    if (self == NULL || self->pool != pool) {
+        return pool_submit(pool, POOL_BACKGROUND, run, opaque, index, first,
+                           last);
+    }
+
+    struct pool_task_t *task =
+        pool_task_create(run, opaque, index, first, last);
+    if (task == NULL) {
+        return -1;
+    }
+    if (pool_deque_push(&self->deque, task) != 0) {
+        free(task);
+        return pool_submit(pool, POOL_BACKGROUND, run, opaque, index, first,
+                           last);
+    }
+
+    // Wakes up an idle worker to steal it.
+    __atomic_fetch_add(&pool->num_tasks, 1, __ATOMIC_RELAXED);
+    pthread_mutex_lock(&pool->mutex);
+    pthread_cond_signal(&pool->queued);
+    pthread_mutex_unlock(&pool->mutex);
+    return 0;
+}
+
+int pool_should_yield(struct pool_t *pool) {
+    return __atomic_load_n(&pool->num_demand, __ATOMIC_RELAXED) > 0;
+}
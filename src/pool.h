@@ -0,0 +1,159 @@
+#pragma once
+#ifndef POOL_H
+#define POOL_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+// CPUs workers may be pinned to are below this.
+#define POOL_MAX_CPUS 1024
+
+// Priorities of tasks, highest first.
+enum pool_priority_t {
+    // Work a reader is about to wait for.
+    POOL_DEMAND,
+    // Work which may or may not be needed, such as prefetching.
+    POOL_SPECULATIVE,
+    // Work with no reader in sight, such as warming up.
+    POOL_BACKGROUND,
+    POOL_NUM_PRIORITIES
+};
+
+/**
+ * Runs a task, on an entry or a range of them, or on a range of an entry.
+ */
+typedef void (*pool_run_func)(void *opaque, int index,
+                              unsigned long long first,
+                              unsigned long long last);
+
+struct pool_task_t {
+    struct pool_task_t *next;
+    pool_run_func run;
+    void *opaque;
+    int index;
+    unsigned long long first;
+    unsigned long long last;
+};
+
+// Chase-Lev deque of the tasks spawned by a worker, which the worker pushes
+// and pops at the bottom, and other workers steal from at the top.
+struct pool_deque_t {
+    long top;
+    long bottom;
+    struct pool_task_t **tasks;
+};
+
+struct pool_worker_t {
+    struct pool_t *pool;
+    pthread_t thread;
+    size_t id;
+    // CPU the worker is pinned to, or -1.
+    int cpu;
+    struct pool_deque_t deque;
+};
+
+/**
+ * A pool of workers which all decompression off the threads serving requests
+ * runs on. Submitted tasks are taken first in first out, by priority, and
+ * tasks spawned by a task are pushed onto the deque of its worker, from
+ * which idle workers steal. Spawned tasks run before background tasks, but
+ * after demand and speculative ones.
+ *
+ * Workers may be pinned to CPUs, apart from the ones the FUSE loop runs on.
+ * Memory is placed on the NUMA node of the thread touching it first, so
+ * whatever pinned workers fill, such as cached entries and blocks, is local
+ * to them.
+ */
+struct pool_t {
+    pthread_mutex_t mutex;
+    pthread_cond_t queued;
+    struct pool_worker_t *workers;
+    size_t num_workers;
+    size_t num_started;
+    int stop;
+
+    // Submitted tasks of each priority, oldest first.
+    struct pool_task_t *heads[POOL_NUM_PRIORITIES];
+    struct pool_task_t *tails[POOL_NUM_PRIORITIES];
+    // Submitted and spawned tasks not taken yet, and submitted demand tasks.
+    size_t num_tasks;
+    size_t num_demand;
+};
+
+/**
+ * Creates a pool without starting its workers.
+ *
+ * @param num_workers number of workers, at least 1.
+ * @param cpus CPUs to pin the workers to in turn, or NULL, ignored where
+ *        threads cannot be pinned.
+ * @param num_cpus number of CPUs in cpus.
+ *
+ * @return the pool, or NULL on error.
+ */
+extern struct pool_t *pool_create(size_t num_workers, const int *cpus,
+                                  size_t num_cpus);
+
+/**
+ * Starts the workers, which must happen after the process has forked into
+ * the background.
+ *
+ * @param pool pool created by pool_create.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int pool_start(struct pool_t *pool);
+
+/**
+ * Stops the workers, waiting for the tasks being run, and releases the pool
+ * along with the tasks which did not run.
+ *
+ * @param pool pool created by pool_create.
+ */
+extern void pool_free(struct pool_t *pool);
+
+/**
+ * Submits a task.
+ *
+ * @param pool pool created by pool_create.
+ * @param priority priority of the task.
+ * @param run function running the task.
+ * @param opaque argument passed to run.
+ * @param index argument passed to run.
+ * @param first argument passed to run.
+ * @param last argument passed to run.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int pool_submit(struct pool_t *pool, enum pool_priority_t priority,
+                       pool_run_func run, void *opaque, int index,
+                       unsigned long long first, unsigned long long last);
+
+/**
+ * Spawns a task from a task, such as the half of a range to be stolen by an
+ * idle worker. Submits it with background priority if not called by a worker
+ * or if its deque is full.
+ *
+ * @param pool pool created by pool_create.
+ * @param run function running the task.
+ * @param opaque argument passed to run.
+ * @param index argument passed to run.
+ * @param first argument passed to run.
+ * @param last argument passed to run.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int pool_spawn(struct pool_t *pool, pool_run_func run, void *opaque,
+                      int index, unsigned long long first,
+                      unsigned long long last);
+
+/**
+ * Tells whether demand tasks are waiting, in which case a long task should
+ * spawn what is left of it and return.
+ *
+ * @param pool pool created by pool_create.
+ *
+ * @return 1 if they are, 0 otherwise.
+ */
+extern int pool_should_yield(struct pool_t *pool);
+
+#endif
@@ -0,0 +1,146 @@
+#include "prefetch.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+#define PREFETCH_MIN_QUEUE 16
+
+// Loads the oldest queued entry, if any.
+static void prefetch_run(void *opaque, int task_index,
+                         unsigned long long first,
+                         unsigned long long last) {
+    struct prefetch_t *prefetch = (struct prefetch_t *)opaque;
+
+    pthread_mutex_lock(&prefetch->mutex);
+    if (prefetch->queue_len == 0) {
+        pthread_mutex_unlock(&prefetch->mutex);
+        return;
+    }
+    int index = prefetch->queue[prefetch->queue_head];
+    prefetch->queue_head = (prefetch->queue_head + 1) % prefetch->queue_cap;
+    --prefetch->queue_len;
+    pthread_mutex_unlock(&prefetch->mutex);
+
+    long long size = prefetch->load(prefetch->opaque, index);
+
+    pthread_mutex_lock(&prefetch->mutex);
+    if (size > 0) {
+        prefetch->loaded_bytes += size;
+        ++prefetch->loaded_entries;
+        debug_eprintfln("Entry with index %d prefetched", index);
+    }
+    if (size >= 0 && index > prefetch->loaded) {
+        prefetch->loaded = index;
+    }
+    pthread_mutex_unlock(&prefetch->mutex);
+}
+
+struct prefetch_t *prefetch_create(struct pool_t *pool, size_t max_depth,
+                                   size_t budget, prefetch_load_func load,
+                                   void *opaque) {
+    struct prefetch_t *prefetch =
+        (struct prefetch_t *)calloc(1, sizeof(*prefetch));
+    if (prefetch == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    prefetch->queue_cap = max_depth * 2 > PREFETCH_MIN_QUEUE
+                              ? max_depth * 2
+                              : PREFETCH_MIN_QUEUE;
+    prefetch->queue = (int *)malloc(prefetch->queue_cap * sizeof(int));
+    if (prefetch->queue == NULL) {
+        perror("malloc()");
+        free(prefetch);
+        return NULL;
+    }
+
+    pthread_mutex_init(&prefetch->mutex, NULL);
+    prefetch->pool = pool;
+    prefetch->load = load;
+    prefetch->opaque = opaque;
+    prefetch->last = -1;
+    prefetch->next = -1;
+    prefetch->loaded = -1;
+    prefetch->depth = 1;
+    prefetch->max_depth = max_depth;
+    prefetch->budget = budget;
+    return prefetch;
+}
+
+void prefetch_free(struct prefetch_t *prefetch) {
+    if (prefetch == NULL) {
+        return;
+    }
+
+    pthread_mutex_destroy(&prefetch->mutex);
+    free(prefetch->queue);
+    free(prefetch);
+}
+
+// Limits the depth to what the budget can hold, given the sizes seen so far.
+static size_t prefetch_max_depth(const struct prefetch_t *prefetch) {
+    if (prefetch->loaded_entries == 0 || prefetch->loaded_bytes == 0) {
+        return prefetch->max_depth;
+    }
+    unsigned long long avg =
+        prefetch->loaded_bytes / prefetch->loaded_entries + 1;
+    unsigned long long n = prefetch->budget / avg;
+    if (n < 1) {
+        n = 1;
+    }
+    return n < prefetch->max_depth ? n : prefetch->max_depth;
+}
+
+void prefetch_access(struct prefetch_t *prefetch, int index, int hit) {
+    pthread_mutex_lock(&prefetch->mutex);
+
+    // Entries in between may be skipped, for example directories.
+    int sequential = prefetch->last >= 0 && index > prefetch->last &&
+                     index <= prefetch->last + (int)prefetch->depth + 1;
+    if (!sequential) {
+        prefetch->depth = 1;
+        prefetch->next = index;
+        prefetch->queue_len = 0;
+    } else if (hit) {
+        ++prefetch->hits;
+        prefetch->depth *= 2;
+    } else if (index <= prefetch->next && index <= prefetch->loaded) {
+        // Loaded ahead but evicted before it was needed.
+        ++prefetch->evicted;
+        if (prefetch->depth > 1) {
+            prefetch->depth /= 2;
+        }
+    }
+
+    size_t max_depth = prefetch_max_depth(prefetch);
+    if (prefetch->depth > max_depth) {
+        prefetch->depth = max_depth;
+    }
+    prefetch->last = index;
+
+    size_t num_queued = 0;
+    if (sequential) {
+        int end = index + (int)prefetch->depth;
+        int i = prefetch->next > index ? prefetch->next + 1 : index + 1;
+        for (; i <= end && prefetch->queue_len < prefetch->queue_cap; ++i) {
+            size_t tail = (prefetch->queue_head + prefetch->queue_len) %
+                          prefetch->queue_cap;
+            prefetch->queue[tail] = i;
+            ++prefetch->queue_len;
+            prefetch->next = i;
+            ++num_queued;
+        }
+    }
+
+    pthread_mutex_unlock(&prefetch->mutex);
+
+    for (size_t i = 0; i < num_queued; ++i) {
+        if (pool_submit(prefetch->pool, POOL_SPECULATIVE, prefetch_run,
+                        prefetch, 0, 0, 0) != 0) {
+            break;
+        }
+    }
+}
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "pool.h"
+
+/**
+ * Loads an entry ahead of time.
+ *
+ * @return the number of bytes loaded, 0 if the entry was skipped or already
+ *         loaded, or a negative number (< 0) on error.
+ */
+typedef long long (*prefetch_load_func)(void *opaque, int index);
+
+/**
+ * Loads the entries following the ones opened in sequence on the workers of a
+ * pool, with speculative priority, in the order of their indexes.
+ *
+ * The number of entries loaded ahead starts at 1 and doubles whenever an
+ * opened entry turns out to be loaded already, up to a maximum. It halves when
+ * an entry was loaded but evicted again before it was opened, and is also
+ * bounded by how many entries of the average size fit into the budget.
+ */
+struct prefetch_t {
+    pthread_mutex_t mutex;
+    struct pool_t *pool;
+
+    prefetch_load_func load;
+    void *opaque;
+
+    // Ring buffer of entry indexes to load, each taken by a task of the pool.
+    // Tasks finding it empty after a restart do nothing.
+    int *queue;
+    size_t queue_cap;
+    size_t queue_head;
+    size_t queue_len;
+
+    // Last opened entry, or -1 if none.
+    int last;
+    // Last entry queued for the current sequence.
+    int next;
+    // Greatest entry loaded by the workers so far.
+    int loaded;
+    size_t depth;
+    size_t max_depth;
+    size_t budget;
+    unsigned long long loaded_bytes;
+    unsigned long long loaded_entries;
+    // Entries opened in sequence which were loaded already, and which were
+    // loaded ahead but evicted again before they were opened.
+    unsigned long long hits;
+    unsigned long long evicted;
+};
+
+/**
+ * Creates a prefetcher.
+ *
+ * @param pool pool the entries are loaded on.
+ * @param max_depth maximal number of entries to load ahead, at least 1.
+ * @param budget memory budget of entries loaded ahead in bytes.
+ * @param load function loading an entry.
+ * @param opaque argument passed to load.
+ *
+ * @return the prefetcher, or NULL on error.
+ */
+extern struct prefetch_t *prefetch_create(struct pool_t *pool,
+                                          size_t max_depth, size_t budget,
+                                          prefetch_load_func load,
+                                          void *opaque);
+
+/**
+ * Releases the prefetcher, once the pool has been freed.
+ *
+ * @param prefetch prefetcher created by prefetch_create.
+ */
+extern void prefetch_free(struct prefetch_t *prefetch);
+
+/**
+ * Tells the prefetcher that an entry has been opened.
+ *
+ * @param prefetch prefetcher created by prefetch_create.
+ * @param index index of the entry.
+ * @param hit whether the entry was loaded already.
+ */
+extern void prefetch_access(struct prefetch_t *prefetch, int index, int hit);
+
+#endif
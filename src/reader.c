@@ -0,0 +1,88 @@
+#include "reader.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "stats.h"
+
+// Threads keep using the same reader when possible, spread round robin.
+static __thread size_t reader_hint = SIZE_MAX;
+static size_t reader_next;
+
+struct reader_pool_t *reader_pool_create(struct zip_t *zip,
+                                         const char *zipname,
+                                         size_t num_readers) {
+    struct reader_pool_t *pool =
+        (struct reader_pool_t *)calloc(1, sizeof(*pool));
+    if (pool == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    pool->readers =
+        (struct reader_t *)calloc(num_readers, sizeof(*pool->readers));
+    if (pool->readers == NULL) {
+        perror("calloc()");
+        free(pool);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < num_readers; ++i) {
+        struct reader_t *reader = &pool->readers[i];
+        reader->zip = i == 0 ? zip : zip_dup(zip, zipname);
+        if (reader->zip == NULL) {
+            eprintfln("Duplicate zip handler for reader %zu error", i);
+            reader_pool_free(pool);
+            return NULL;
+        }
+        pthread_mutex_init(&reader->mutex, NULL);
+        ++pool->num_readers;
+    }
+
+    debug_eprintfln("Pool with %zu readers created", pool->num_readers);
+    return pool;
+}
+
+void reader_pool_free(struct reader_pool_t *pool) {
+    if (pool == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < pool->num_readers; ++i) {
+        struct reader_t *reader = &pool->readers[i];
+        if (i != 0) {
+            zip_close(reader->zip);
+        }
+        pthread_mutex_destroy(&reader->mutex);
+    }
+    free(pool->readers);
+    free(pool);
+}
+
+struct reader_t *reader_acquire(struct reader_pool_t *pool) {
+    size_t n = pool->num_readers;
+
+    if (reader_hint == SIZE_MAX) {
+        reader_hint = __atomic_fetch_add(&reader_next, 1, __ATOMIC_RELAXED);
+    }
+    size_t start = reader_hint % n;
+    for (size_t i = 0; i < n; ++i) {
+        struct reader_t *reader = &pool->readers[(start + i) % n];
+        if (pthread_mutex_trylock(&reader->mutex) == 0) {
+            return reader;
+        }
+    }
+
+    unsigned long long wait_start = stats_now();
+    struct reader_t *reader = &pool->readers[start];
+    pthread_mutex_lock(&reader->mutex);
+    stats_add(STATS_READER_WAITS, 1);
+    stats_add(STATS_READER_WAIT_NS, stats_now() - wait_start);
+    return reader;
+}
+
+void reader_release(struct reader_t *reader) {
+    pthread_mutex_unlock(&reader->mutex);
+}
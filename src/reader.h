@@ -0,0 +1,65 @@
+#pragma once
+#ifndef READER_H
+#define READER_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#include "zip.h"
+
+/**
+ * A zip archive handler which must only be used while it is acquired.
+ */
+struct reader_t {
+    pthread_mutex_t mutex;
+    struct zip_t *zip;
+};
+
+/**
+ * A fixed set of readers over the same archive, which share its central
+ * directory but decompress independently of each other.
+ */
+struct reader_pool_t {
+    struct reader_t *readers;
+    size_t num_readers;
+};
+
+/**
+ * Creates a pool of readers.
+ *
+ * The first reader uses the given handler, the others are duplicated from it.
+ *
+ * @param zip zip archive handler opened in 'r' mode, owned by the caller.
+ * @param zipname zip archive file name.
+ * @param num_readers number of readers, at least 1.
+ *
+ * @return the pool, or NULL on error.
+ */
+extern struct reader_pool_t *reader_pool_create(struct zip_t *zip,
+                                                const char *zipname,
+                                                size_t num_readers);
+
+/**
+ * Releases the pool, closing all the duplicated handlers.
+ *
+ * @param pool pool created by reader_pool_create.
+ */
+extern void reader_pool_free(struct reader_pool_t *pool);
+
+/**
+ * Acquires a reader, blocking if all of them are in use.
+ *
+ * @param pool pool created by reader_pool_create.
+ *
+ * @return the acquired reader.
+ */
+extern struct reader_t *reader_acquire(struct reader_pool_t *pool);
+
+/**
+ * Releases a reader acquired by reader_acquire.
+ *
+ * @param reader the acquired reader.
+ */
+extern void reader_release(struct reader_t *reader);
+
+#endif
@@ -0,0 +1,787 @@
+#include "remote.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "stats.h"
+
+int remote_is_url(const char *name) {
+    return strncmp(name, "http://", 7) == 0 ||
+           strncmp(name, "https://", 8) == 0 || strncmp(name, "s3://", 5) == 0;
+}
+
+#if defined ZIPFS_WITH_CURL
+
+#include <curl/curl.h>
+
+// Chunks are cached in units of this size, and a request fetches up to so many
+// adjacent chunks.
+#define REMOTE_CHUNK_SIZE (1 << 20)
+#define REMOTE_MAX_CHUNKS 64
+// Missing chunks following a read are fetched along with it, for the next
+// reads of sequential readers.
+#define REMOTE_READAHEAD_CHUNKS 3
+#define REMOTE_MAX_HANDLES 16
+#define REMOTE_RETRIES 3
+
+static pthread_once_t remote_once = PTHREAD_ONCE_INIT;
+
+static void remote_init(void) { curl_global_init(CURL_GLOBAL_DEFAULT); }
+
+const char *remote_engine(void) { return "libcurl " LIBCURL_VERSION; }
+
+// Response of a request, written into a buffer of the expected size.
+struct remote_buf_t {
+    char *data;
+    size_t size;
+    size_t pos;
+};
+
+// Headers of the response to the first request.
+struct remote_stat_t {
+    unsigned long long size;
+    int has_size;
+    char etag[128];
+};
+
+static size_t remote_write(char *ptr, size_t size, size_t nmemb,
+                           void *userdata) {
+    struct remote_buf_t *buf = (struct remote_buf_t *)userdata;
+    size_t n = size * nmemb;
+    // Servers ignoring the range send more, which fails the request.
+    if (n > buf->size - buf->pos) {
+        return 0;
+    }
+    memcpy(buf->data + buf->pos, ptr, n);
+    buf->pos += n;
+    return n;
+}
+
+static size_t remote_header(char *ptr, size_t size, size_t nmemb,
+                            void *userdata) {
+    struct remote_stat_t *stat = (struct remote_stat_t *)userdata;
+    size_t n = size * nmemb;
+    if (n > 14 && strncasecmp(ptr, "content-range:", 14) == 0) {
+        const char *total = memchr(ptr, '/', n);
+        if (total != NULL && total[1] != '*') {
+            stat->size = strtoull(total + 1, NULL, 10);
+            stat->has_size = 1;
+        }
+    } else if (n > 5 && strncasecmp(ptr, "etag:", 5) == 0) {
+        size_t len = n - 5;
+        const char *value = ptr + 5;
+        while (len > 0 && (*value == ' ' || *value == '\t')) {
+            ++value;
+            --len;
+        }
+        while (len > 0 && (value[len - 1] == '\r' || value[len - 1] == '\n')) {
+            --len;
+        }
+        // A truncated tag would never match, so a tag too long is left out.
+        if (len < sizeof(stat->etag)) {
+            memcpy(stat->etag, value, len);
+            stat->etag[len] = '\0';
+        }
+    }
+    return n;
+}
+
+static CURL *remote_handle_acquire(struct remote_t *remote) {
+    CURL *handle = NULL;
+    pthread_mutex_lock(&remote->mutex);
+    if (remote->num_handles > 0) {
+        handle = remote->handles[--remote->num_handles];
+    }
+    pthread_mutex_unlock(&remote->mutex);
+
+    if (handle == NULL) {
+        handle = curl_easy_init();
+    } else {
+        // Keeps the connection.
+        curl_easy_reset(handle);
+    }
+    if (handle == NULL) {
+        return NULL;
+    }
+
+    curl_easy_setopt(handle, CURLOPT_URL, remote->url);
+    curl_easy_setopt(handle, CURLOPT_NOSIGNAL, 1L);
+    curl_easy_setopt(handle, CURLOPT_FOLLOWLOCATION, 1L);
+    curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, remote_write);
+    if (remote->sigv4 != NULL) {
+        curl_easy_setopt(handle, CURLOPT_USERPWD, remote->userpwd);
+        curl_easy_setopt(handle, CURLOPT_AWS_SIGV4, remote->sigv4);
+    }
+    if (remote->headers != NULL) {
+        curl_easy_setopt(handle, CURLOPT_HTTPHEADER,
+                         (struct curl_slist *)remote->headers);
+    }
+    return handle;
+}
+
+static void remote_handle_release(struct remote_t *remote, CURL *handle) {
+    pthread_mutex_lock(&remote->mutex);
+    if (remote->num_handles < REMOTE_MAX_HANDLES) {
+        remote->handles[remote->num_handles++] = handle;
+        handle = NULL;
+    }
+    pthread_mutex_unlock(&remote->mutex);
+    if (handle != NULL) {
+        curl_easy_cleanup(handle);
+    }
+}
+
+// Fetches a range of the file into a buffer of its size, retrying on errors
+// which may be transient. The size of the file is only known for stat NULL.
+static int remote_fetch(struct remote_t *remote, unsigned long long offset,
+                        char *data, size_t size, struct remote_stat_t *stat) {
+    char range[64];
+    snprintf(range, sizeof(range), "%llu-%llu", offset, offset + size - 1);
+
+    for (int attempt = 0; attempt < REMOTE_RETRIES; ++attempt) {
+        CURL *handle = remote_handle_acquire(remote);
+        if (handle == NULL) {
+            return -ENOMEM;
+        }
+        struct remote_buf_t buf = {data, size, 0};
+        curl_easy_setopt(handle, CURLOPT_RANGE, range);
+        curl_easy_setopt(handle, CURLOPT_WRITEDATA, &buf);
+        if (stat != NULL) {
+            curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, remote_header);
+            curl_easy_setopt(handle, CURLOPT_HEADERDATA, stat);
+            curl_easy_setopt(handle, CURLOPT_FILETIME, 1L);
+        }
+        CURLcode res = curl_easy_perform(handle);
+        long code = 0;
+        curl_easy_getinfo(handle, CURLINFO_RESPONSE_CODE, &code);
+        if (stat != NULL) {
+            curl_off_t mtime = -1;
+            curl_easy_getinfo(handle, CURLINFO_FILETIME_T, &mtime);
+            remote->mtime = mtime >= 0 ? (time_t)mtime : time(NULL);
+        }
+        remote_handle_release(remote, handle);
+        stats_add(STATS_REMOTE_REQUESTS, 1);
+
+        if (res == CURLE_OK && code == 206 && buf.pos == size) {
+            stats_add(STATS_REMOTE_BYTES, size);
+            return 0;
+        }
+        if (code == 412) {
+            eprintfln("'%s' has changed since it was opened", remote->url);
+            return -EIO;
+        }
+        eprintfln("Fetch bytes %s of '%s' error: %s, status %ld", range,
+                  remote->url, curl_easy_strerror(res), code);
+        if (code >= 400 && code < 500 && code != 408 && code != 429) {
+            break;
+        }
+    }
+    return -EIO;
+}
+
+// Makes every later request fail with status 412 if the file is replaced,
+// rather than mix up chunks of two versions of it. Weak tags never match with
+// If-Match, so the time of the file stands in for them.
+static int remote_precondition(struct remote_t *remote,
+                               const struct remote_stat_t *stat) {
+    char header[sizeof(stat->etag) + 32];
+    if (stat->etag[0] != '\0' && strncmp(stat->etag, "W/", 2) != 0) {
+        snprintf(header, sizeof(header), "If-Match: %s", stat->etag);
+    } else {
+        struct tm tm;
+        gmtime_r(&remote->mtime, &tm);
+        strftime(header, sizeof(header),
+                 "If-Unmodified-Since: %a, %d %b %Y %H:%M:%S GMT", &tm);
+    }
+
+    struct curl_slist *headers =
+        curl_slist_append((struct curl_slist *)remote->headers, header);
+    if (headers == NULL) {
+        eprintfln("Append header '%s' error", header);
+        return -1;
+    }
+    remote->headers = headers;
+    return 0;
+}
+
+static size_t remote_chunk_size(const struct remote_t *remote,
+                                unsigned long long index) {
+    unsigned long long offset = index * REMOTE_CHUNK_SIZE;
+    return remote->size - offset < REMOTE_CHUNK_SIZE
+               ? (size_t)(remote->size - offset)
+               : REMOTE_CHUNK_SIZE;
+}
+
+static void remote_chunk_path(const struct remote_t *remote,
+                              unsigned long long index, char *path) {
+    snprintf(path, PATH_MAX, "%s/%s.%llu", remote->cache_dir, remote->key,
+             index);
+}
+
+static struct remote_chunk_t **remote_bucket(struct remote_t *remote,
+                                             unsigned long long index) {
+    return &remote->buckets[index & (remote->num_buckets - 1)];
+}
+
+static struct remote_chunk_t *remote_chunk_find(struct remote_t *remote,
+                                                unsigned long long index) {
+    struct remote_chunk_t *chunk = *remote_bucket(remote, index);
+    while (chunk != NULL && chunk->index != index) {
+        chunk = chunk->hash_next;
+    }
+    return chunk;
+}
+
+static struct remote_chunk_t *remote_chunk_insert(struct remote_t *remote,
+                                                  unsigned long long index) {
+    struct remote_chunk_t *chunk =
+        (struct remote_chunk_t *)calloc(1, sizeof(*chunk));
+    if (chunk == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    struct remote_chunk_t **bucket = remote_bucket(remote, index);
+    chunk->index = index;
+    chunk->state = REMOTE_CHUNK_LOADING;
+    chunk->hash_next = *bucket;
+    *bucket = chunk;
+    return chunk;
+}
+
+static void remote_chunk_remove(struct remote_t *remote,
+                                struct remote_chunk_t *chunk) {
+    struct remote_chunk_t **link = remote_bucket(remote, chunk->index);
+    while (*link != chunk) {
+        link = &(*link)->hash_next;
+    }
+    *link = chunk->hash_next;
+    free(chunk);
+}
+
+static void remote_lru_unlink(struct remote_t *remote,
+                              struct remote_chunk_t *chunk) {
+    if (chunk->lru_prev != NULL) {
+        chunk->lru_prev->lru_next = chunk->lru_next;
+    } else {
+        remote->lru_head = chunk->lru_next;
+    }
+    if (chunk->lru_next != NULL) {
+        chunk->lru_next->lru_prev = chunk->lru_prev;
+    } else {
+        remote->lru_tail = chunk->lru_prev;
+    }
+    chunk->lru_prev = NULL;
+    chunk->lru_next = NULL;
+}
+
+static void remote_lru_push(struct remote_t *remote,
+                            struct remote_chunk_t *chunk) {
+    chunk->lru_prev = remote->lru_tail;
+    chunk->lru_next = NULL;
+    if (remote->lru_tail != NULL) {
+        remote->lru_tail->lru_next = chunk;
+    } else {
+        remote->lru_head = chunk;
+    }
+    remote->lru_tail = chunk;
+}
+
+// Deletes the files of the least recently used chunks without readers until
+// the cache is within its budget. Called with the mutex held.
+static void remote_evict(struct remote_t *remote) {
+    char path[PATH_MAX];
+    while (remote->used > remote->budget && remote->lru_head != NULL) {
+        struct remote_chunk_t *chunk = remote->lru_head;
+        remote_lru_unlink(remote, chunk);
+        remote->used -= chunk->size;
+        remote_chunk_path(remote, chunk->index, path);
+        unlink(path);
+        remote_chunk_remove(remote, chunk);
+    }
+}
+
+// Claims the chunks from first on which are missing, up to last and stopping
+// at the first one which is not, returning how many were. Called with the
+// mutex held.
+static size_t remote_claim(struct remote_t *remote, unsigned long long first,
+                           unsigned long long last) {
+    size_t n = 0;
+    for (unsigned long long index = first;
+         index <= last && n < REMOTE_MAX_CHUNKS; ++index, ++n) {
+        if (remote_chunk_find(remote, index) != NULL ||
+            remote_chunk_insert(remote, index) == NULL) {
+            break;
+        }
+    }
+    return n;
+}
+
+static int remote_chunk_write(struct remote_t *remote,
+                              unsigned long long index, const char *data,
+                              size_t size) {
+    char path[PATH_MAX];
+    remote_chunk_path(remote, index, path);
+    int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t pos = 0;
+    while (pos < size) {
+        ssize_t n = write(fd, data + pos, size - pos);
+        if (n <= 0) {
+            break;
+        }
+        pos += n;
+    }
+    close(fd);
+    if (pos != size) {
+        unlink(path);
+        return -1;
+    }
+    return 0;
+}
+
+static int remote_chunk_read(struct remote_t *remote, unsigned long long index,
+                             size_t offset, char *buf, size_t size) {
+    char path[PATH_MAX];
+    remote_chunk_path(remote, index, path);
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        return -1;
+    }
+    size_t pos = 0;
+    while (pos < size) {
+        ssize_t n = pread(fd, buf + pos, size - pos, offset + pos);
+        if (n <= 0) {
+            break;
+        }
+        pos += n;
+    }
+    close(fd);
+    return pos == size ? 0 : -1;
+}
+
+// Fetches n claimed chunks from first on and caches them, copying a slice of
+// the first one to buf if not NULL.
+static int remote_load(struct remote_t *remote, unsigned long long first,
+                       size_t n, size_t offset, char *buf, size_t size) {
+    unsigned long long start = first * REMOTE_CHUNK_SIZE;
+    size_t total = remote->size - start < (unsigned long long)n *
+                                              REMOTE_CHUNK_SIZE
+                       ? (size_t)(remote->size - start)
+                       : n * REMOTE_CHUNK_SIZE;
+    char *data = (char *)malloc(total);
+    int ret = data != NULL ? remote_fetch(remote, start, data, total, NULL)
+                           : -ENOMEM;
+    if (data == NULL) {
+        perror("malloc()");
+    }
+    if (ret == 0 && buf != NULL) {
+        memcpy(buf, data + offset, size);
+    }
+
+    int written[REMOTE_MAX_CHUNKS];
+    for (size_t i = 0; i < n; ++i) {
+        written[i] =
+            ret == 0 &&
+            remote_chunk_write(remote, first + i,
+                               data + i * REMOTE_CHUNK_SIZE,
+                               remote_chunk_size(remote, first + i)) == 0;
+    }
+    free(data);
+
+    pthread_mutex_lock(&remote->mutex);
+    for (size_t i = 0; i < n; ++i) {
+        struct remote_chunk_t *chunk = remote_chunk_find(remote, first + i);
+        if (!written[i]) {
+            remote_chunk_remove(remote, chunk);
+            continue;
+        }
+        chunk->state = REMOTE_CHUNK_CACHED;
+        chunk->size = remote_chunk_size(remote, first + i);
+        remote->used += chunk->size;
+        remote_lru_push(remote, chunk);
+    }
+    remote_evict(remote);
+    pthread_cond_broadcast(&remote->fetched);
+    pthread_mutex_unlock(&remote->mutex);
+    return ret;
+}
+
+// Reads a slice of the chunk at an index, fetching it along with the missing
+// chunks following it up to last if it is missing.
+static int remote_read_chunk(struct remote_t *remote, unsigned long long index,
+                             unsigned long long last, size_t offset,
+                             char *buf, size_t size) {
+    pthread_mutex_lock(&remote->mutex);
+    struct remote_chunk_t *chunk;
+    while ((chunk = remote_chunk_find(remote, index)) != NULL) {
+        if (chunk->state == REMOTE_CHUNK_LOADING) {
+            pthread_cond_wait(&remote->fetched, &remote->mutex);
+            continue;
+        }
+
+        if (chunk->refs++ == 0) {
+            remote_lru_unlink(remote, chunk);
+        }
+        pthread_mutex_unlock(&remote->mutex);
+        int ret = remote_chunk_read(remote, index, offset, buf, size);
+        pthread_mutex_lock(&remote->mutex);
+        if (ret == 0) {
+            if (--chunk->refs == 0) {
+                remote_lru_push(remote, chunk);
+            }
+            pthread_mutex_unlock(&remote->mutex);
+            return 0;
+        }
+
+        // The file is gone, so the chunk is fetched once more, or just the
+        // slice while others still read the chunk.
+        if (--chunk->refs > 0) {
+            pthread_mutex_unlock(&remote->mutex);
+            return remote_fetch(remote, index * REMOTE_CHUNK_SIZE + offset,
+                                buf, size, NULL);
+        }
+        remote->used -= chunk->size;
+        remote_chunk_remove(remote, chunk);
+    }
+
+    size_t n = remote_claim(remote, index, last);
+    pthread_mutex_unlock(&remote->mutex);
+    if (n == 0) {
+        return -ENOMEM;
+    }
+    return remote_load(remote, index, n, offset, buf, size);
+}
+
+// Rewrites an s3:// URL to the HTTPS URL of the object, setting up signing if
+// there are credentials.
+static char *remote_resolve(struct remote_t *remote, const char *url) {
+    if (strncmp(url, "s3://", 5) != 0) {
+        char *resolved = strdup(url);
+        if (resolved == NULL) {
+            perror("strdup()");
+        }
+        return resolved;
+    }
+
+    const char *bucket = url + 5;
+    const char *key = strchr(bucket, '/');
+    if (key == NULL || key == bucket) {
+        eprintfln("Invalid S3 URL '%s'", url);
+        return NULL;
+    }
+    int bucket_len = (int)(key - bucket);
+    const char *region = getenv("AWS_REGION");
+    if (region == NULL) {
+        region = getenv("AWS_DEFAULT_REGION");
+    }
+    if (region == NULL) {
+        region = "us-east-1";
+    }
+    const char *endpoint = getenv("AWS_ENDPOINT_URL");
+
+    size_t len = strlen(url) + strlen(region) + 64 +
+                 (endpoint != NULL ? strlen(endpoint) : 0);
+    char *resolved = (char *)malloc(len);
+    if (resolved == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+    if (endpoint != NULL) {
+        // Path style, as most S3-compatible servers expect.
+        int endpoint_len = (int)strlen(endpoint);
+        while (endpoint_len > 0 && endpoint[endpoint_len - 1] == '/') {
+            --endpoint_len;
+        }
+        snprintf(resolved, len, "%.*s/%.*s%s", endpoint_len, endpoint,
+                 bucket_len, bucket, key);
+    } else {
+        snprintf(resolved, len, "https://%.*s.s3.%s.amazonaws.com%s",
+                 bucket_len, bucket, region, key);
+    }
+
+    const char *id = getenv("AWS_ACCESS_KEY_ID");
+    const char *secret = getenv("AWS_SECRET_ACCESS_KEY");
+    const char *token = getenv("AWS_SESSION_TOKEN");
+    if (id == NULL || secret == NULL) {
+        return resolved;
+    }
+    remote->userpwd = (char *)malloc(strlen(id) + strlen(secret) + 2);
+    remote->sigv4 = (char *)malloc(strlen(region) + 16);
+    if (remote->userpwd == NULL || remote->sigv4 == NULL) {
+        perror("malloc()");
+        free(resolved);
+        return NULL;
+    }
+    sprintf(remote->userpwd, "%s:%s", id, secret);
+    sprintf(remote->sigv4, "aws:amz:%s:s3", region);
+    if (token != NULL) {
+        char *header = (char *)malloc(strlen(token) + 32);
+        if (header == NULL) {
+            perror("malloc()");
+            free(resolved);
+            return NULL;
+        }
+        sprintf(header, "x-amz-security-token: %s", token);
+        remote->headers = curl_slist_append(NULL, header);
+        free(header);
+    }
+    return resolved;
+}
+
+// Registers the chunk files of the file left by earlier mounts, deleting the
+// ones which are incomplete.
+static void remote_scan(struct remote_t *remote) {
+    DIR *dir = opendir(remote->cache_dir);
+    if (dir == NULL) {
+        return;
+    }
+
+    size_t key_len = strlen(remote->key);
+    char path[PATH_MAX];
+    struct dirent *de;
+    while ((de = readdir(dir)) != NULL) {
+        if (strncmp(de->d_name, remote->key, key_len) != 0 ||
+            de->d_name[key_len] != '.') {
+            continue;
+        }
+        char *end;
+        unsigned long long index = strtoull(de->d_name + key_len + 1, &end, 10);
+        if (*end != '\0') {
+            continue;
+        }
+
+        struct stat st;
+        remote_chunk_path(remote, index, path);
+        if (stat(path, &st) != 0) {
+            continue;
+        }
+        if (index * REMOTE_CHUNK_SIZE >= remote->size ||
+            (size_t)st.st_size != remote_chunk_size(remote, index) ||
+            remote_chunk_find(remote, index) != NULL) {
+            unlink(path);
+            continue;
+        }
+        struct remote_chunk_t *chunk = remote_chunk_insert(remote, index);
+        if (chunk == NULL) {
+            break;
+        }
+        chunk->state = REMOTE_CHUNK_CACHED;
+        chunk->size = st.st_size;
+        remote->used += chunk->size;
+        remote_lru_push(remote, chunk);
+    }
+    closedir(dir);
+
+    debug_eprintfln("%zu bytes of '%s' cached", remote->used, remote->url);
+    remote_evict(remote);
+}
+
+struct remote_t *remote_open(const char *url, const char *cache_dir,
+                             size_t budget) {
+    pthread_once(&remote_once, remote_init);
+
+    struct remote_t *remote = (struct remote_t *)calloc(1, sizeof(*remote));
+    if (remote == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    pthread_mutex_init(&remote->mutex, NULL);
+    pthread_cond_init(&remote->fetched, NULL);
+    remote->budget = budget;
+    remote->num_buckets = 64;
+    while (remote->num_buckets < budget / REMOTE_CHUNK_SIZE) {
+        remote->num_buckets *= 2;
+    }
+
+    remote->url = remote_resolve(remote, url);
+    remote->cache_dir = strdup(cache_dir);
+    remote->buckets = (struct remote_chunk_t **)calloc(
+        remote->num_buckets, sizeof(struct remote_chunk_t *));
+    remote->handles = (void **)calloc(REMOTE_MAX_HANDLES, sizeof(void *));
+    if (remote->url == NULL || remote->cache_dir == NULL ||
+        remote->buckets == NULL || remote->handles == NULL) {
+        goto error;
+    }
+    if (mkdir(cache_dir, 0700) != 0 && errno != EEXIST) {
+        perror("mkdir()");
+        eprintfln("Create cache directory '%s' error", cache_dir);
+        goto error;
+    }
+
+    // A range request of the first byte tells the size, and whether ranges
+    // are supported at all.
+    struct remote_stat_t stat;
+    memset(&stat, 0, sizeof(stat));
+    char first;
+    if (remote_fetch(remote, 0, &first, 1, &stat) != 0 || !stat.has_size) {
+        eprintfln("Request size of '%s' error", remote->url);
+        goto error;
+    }
+    remote->size = stat.size;
+    if (remote_precondition(remote, &stat) != 0) {
+        goto error;
+    }
+
+    // Chunks of another version of the file are never mixed up with these.
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    char validator[64];
+    snprintf(validator, sizeof(validator), "\n%llu\n%lld\n", remote->size,
+             stat.etag[0] != '\0' ? 0LL : (long long)remote->mtime);
+    const char *parts[] = {remote->url, validator, stat.etag};
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); ++i) {
+        for (const char *c = parts[i]; *c != '\0'; ++c) {
+            h = (h ^ (unsigned char)*c) * 0x100000001b3ULL;
+        }
+    }
+    snprintf(remote->key, sizeof(remote->key), "%016llx", h);
+
+    remote_scan(remote);
+    debug_eprintfln("Remote file '%s' of %llu bytes opened", remote->url,
+                    remote->size);
+    return remote;
+
+error:
+    remote_free(remote);
+    return NULL;
+}
+
+void remote_free(struct remote_t *remote) {
+    if (remote == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; remote->buckets != NULL && i < remote->num_buckets;
+         ++i) {
+        struct remote_chunk_t *chunk = remote->buckets[i];
+        while (chunk != NULL) {
+            struct remote_chunk_t *next = chunk->hash_next;
+            free(chunk);
+            chunk = next;
+        }
+    }
+    for (size_t i = 0; i < remote->num_handles; ++i) {
+        curl_easy_cleanup(remote->handles[i]);
+    }
+    curl_slist_free_all((struct curl_slist *)remote->headers);
+    pthread_mutex_destroy(&remote->mutex);
+    pthread_cond_destroy(&remote->fetched);
+    free(remote->buckets);
+    free(remote->handles);
+    free(remote->userpwd);
+    free(remote->sigv4);
+    free(remote->cache_dir);
+    free(remote->url);
+    free(remote);
+}
+
+ssize_t remote_read(struct remote_t *remote, unsigned long long offset,
+                    void *buf, size_t size) {
+    if (offset >= remote->size) {
+        return 0;
+    }
+    if (size > remote->size - offset) {
+        size = (size_t)(remote->size - offset);
+    }
+    if (size == 0) {
+        return 0;
+    }
+
+    unsigned long long last =
+        (offset + size - 1) / REMOTE_CHUNK_SIZE + REMOTE_READAHEAD_CHUNKS;
+    if (last > (remote->size - 1) / REMOTE_CHUNK_SIZE) {
+        last = (remote->size - 1) / REMOTE_CHUNK_SIZE;
+    }
+    size_t done = 0;
+    while (done < size) {
+        unsigned long long pos = offset + done;
+        unsigned long long index = pos / REMOTE_CHUNK_SIZE;
+        size_t chunk_offset = (size_t)(pos % REMOTE_CHUNK_SIZE);
+        size_t n = REMOTE_CHUNK_SIZE - chunk_offset < size - done
+                       ? REMOTE_CHUNK_SIZE - chunk_offset
+                       : size - done;
+        int ret = remote_read_chunk(remote, index, last, chunk_offset,
+                                    (char *)buf + done, n);
+        if (ret != 0) {
+            return ret;
+        }
+        done += n;
+    }
+    return (ssize_t)size;
+}
+
+int remote_prefetch(struct remote_t *remote, unsigned long long offset,
+                    unsigned long long size) {
+    if (offset >= remote->size || size == 0) {
+        return 0;
+    }
+    if (size > remote->size - offset) {
+        size = remote->size - offset;
+    }
+
+    unsigned long long last = (offset + size - 1) / REMOTE_CHUNK_SIZE;
+    unsigned long long index = offset / REMOTE_CHUNK_SIZE;
+    while (index <= last) {
+        // Chunks being fetched by others are not waited for.
+        pthread_mutex_lock(&remote->mutex);
+        size_t n = remote_chunk_find(remote, index) == NULL
+                       ? remote_claim(remote, index, last)
+                       : 0;
+        pthread_mutex_unlock(&remote->mutex);
+        if (n == 0) {
+            ++index;
+            continue;
+        }
+        int ret = remote_load(remote, index, n, 0, NULL, 0);
+        if (ret != 0) {
+            return ret;
+        }
+        index += n;
+    }
+    return 0;
+}
+
+#else
+
+const char *remote_engine(void) { return "none"; }
+
+struct remote_t *remote_open(const char *url, const char *cache_dir,
+                             size_t budget) {
+    (void)cache_dir;
+    (void)budget;
+    eprintfln("Open '%s' error: built without remote support, see REMOTE in "
+              "the Makefile",
+              url);
+    return NULL;
+}
+
+void remote_free(struct remote_t *remote) { (void)remote; }
+
+ssize_t remote_read(struct remote_t *remote, unsigned long long offset,
+                    void *buf, size_t size) {
+    (void)remote;
+    (void)offset;
+    (void)buf;
+    (void)size;
+    return -EIO;
+}
+
+int remote_prefetch(struct remote_t *remote, unsigned long long offset,
+                    unsigned long long size) {
+    (void)remote;
+    (void)offset;
+    (void)size;
+    return -EIO;
+}
+
+#endif
@@ -0,0 +1,130 @@
+#pragma once
+#ifndef REMOTE_H
+#define REMOTE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <sys/types.h>
+#include <time.h>
+
+enum remote_chunk_state_t { REMOTE_CHUNK_LOADING, REMOTE_CHUNK_CACHED };
+
+/**
+ * A chunk of the remote file, cached in a file of its own or being fetched.
+ */
+struct remote_chunk_t {
+    struct remote_chunk_t *hash_next;
+    struct remote_chunk_t *lru_prev;
+    struct remote_chunk_t *lru_next;
+    unsigned long long index;
+    enum remote_chunk_state_t state;
+    // Number of readers of the cached file.
+    size_t refs;
+    size_t size;
+};
+
+/**
+ * A file on an HTTP(S) or S3 server, read with range requests in chunks which
+ * are cached on local disk within a budget.
+ *
+ * Chunks missing from the cache are fetched once, however many threads read
+ * them at the same time, and adjacent missing chunks of a read with a single
+ * request.
+ */
+struct remote_t {
+    char *url;
+    unsigned long long size;
+    time_t mtime;
+    // Directory of the chunk files, named after a key of the URL, the size
+    // and the validator of the file, so that they are reused across mounts
+    // for as long as the file does not change.
+    char *cache_dir;
+    char key[17];
+    pthread_mutex_t mutex;
+    pthread_cond_t fetched;
+    struct remote_chunk_t **buckets;
+    size_t num_buckets;
+    // Cached chunks without readers, least recently used first.
+    struct remote_chunk_t *lru_head;
+    struct remote_chunk_t *lru_tail;
+    size_t used;
+    size_t budget;
+    // Idle connections, reused by later requests.
+    void **handles;
+    size_t num_handles;
+    // Credentials, signing and extra headers of s3:// requests, set up from
+    // the environment, and the precondition of every request after the first
+    // on the version of the file it found.
+    char *userpwd;
+    char *sigv4;
+    void *headers;
+};
+
+/**
+ * Returns the name of the library which makes requests, chosen at build time
+ * with ZIPFS_WITH_CURL.
+ *
+ * @return the name, such as "libcurl 8.5.0", or "none".
+ */
+extern const char *remote_engine(void);
+
+/**
+ * Tells whether a file name is a URL to be opened with remote_open.
+ *
+ * @param name the file name.
+ *
+ * @return 1 for http://, https:// and s3:// URLs, 0 otherwise.
+ */
+extern int remote_is_url(const char *name);
+
+/**
+ * Opens a remote file, requesting its size and validator.
+ *
+ * An s3:// URL is requested from AWS_ENDPOINT_URL if set, or else from the
+ * virtual host of the bucket in AWS_REGION, and signed with
+ * AWS_ACCESS_KEY_ID, AWS_SECRET_ACCESS_KEY and AWS_SESSION_TOKEN if set.
+ *
+ * @param url the URL.
+ * @param cache_dir directory of the chunk cache, created if missing.
+ * @param budget budget of the chunk cache in bytes.
+ *
+ * @return the remote file, or NULL on error.
+ */
+extern struct remote_t *remote_open(const char *url, const char *cache_dir,
+                                    size_t budget);
+
+/**
+ * Releases the remote file, keeping its cached chunks on disk.
+ *
+ * @param remote remote file opened by remote_open.
+ */
+extern void remote_free(struct remote_t *remote);
+
+/**
+ * Reads from the remote file, fetching the chunks missing from the cache.
+ *
+ * @param remote remote file opened by remote_open.
+ * @param offset offset to read at.
+ * @param buf output buffer.
+ * @param size number of bytes to read.
+ *
+ * @return number of bytes read, less than size only at the end of the file,
+ *         or negative errno on error.
+ */
+extern ssize_t remote_read(struct remote_t *remote, unsigned long long offset,
+                           void *buf, size_t size);
+
+/**
+ * Fetches the chunks of a range of the remote file missing from the cache, so
+ * that reading it later is local.
+ *
+ * @param remote remote file opened by remote_open.
+ * @param offset offset of the range.
+ * @param size size of the range.
+ *
+ * @return the return code - 0 on success, negative errno on error.
+ */
+extern int remote_prefetch(struct remote_t *remote, unsigned long long offset,
+                           unsigned long long size);
+
+#endif
@@ -0,0 +1,149 @@
+#include "seek.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+// Identifies the data of an entry in the sidecar file, so that indexes of a
+// modified archive are not used.
+struct seek_record_t {
+    unsigned long long index;
+    unsigned long long header_offset;
+    unsigned long long comp_size;
+    unsigned long long uncomp_size;
+    unsigned long long crc32;
+};
+
+static void seek_record_init(struct seek_record_t *record,
+                             const struct zip_entry_table_t *entries,
+                             size_t index) {
+    memset(record, 0, sizeof(*record));
+    record->index = index;
+    record->header_offset = entries->header_offsets[index];
+    record->comp_size = entries->comp_sizes[index];
+    record->uncomp_size = entries->uncomp_sizes[index];
+    record->crc32 = entries->crc32s[index];
+}
+
+struct seek_table_t *seek_table_create(size_t num_entries,
+                                       unsigned long long spacing) {
+    struct seek_table_t *table =
+        (struct seek_table_t *)calloc(1, sizeof(*table));
+    if (table == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    table->indexes = (struct stream_index_t **)calloc(
+        num_entries > 0 ? num_entries : 1, sizeof(*table->indexes));
+    if (table->indexes == NULL) {
+        perror("calloc()");
+        free(table);
+        return NULL;
+    }
+
+    pthread_mutex_init(&table->mutex, NULL);
+    table->num_entries = num_entries;
+    table->spacing = spacing;
+    return table;
+}
+
+void seek_table_free(struct seek_table_t *table) {
+    if (table == NULL) {
+        return;
+    }
+
+    for (size_t i = 0; i < table->num_entries; ++i) {
+        stream_index_free(table->indexes[i]);
+    }
+    free(table->indexes);
+    pthread_mutex_destroy(&table->mutex);
+    free(table);
+}
+
+struct stream_index_t *seek_table_get(struct seek_table_t *table, int index) {
+    if (index < 0 || (size_t)index >= table->num_entries) {
+        return NULL;
+    }
+
+    pthread_mutex_lock(&table->mutex);
+    if (table->indexes[index] == NULL) {
+        table->indexes[index] = stream_index_create(table->spacing);
+    }
+    struct stream_index_t *stream_index = table->indexes[index];
+    pthread_mutex_unlock(&table->mutex);
+    return stream_index;
+}
+
+int seek_table_modified(struct seek_table_t *table) {
+    int modified = 0;
+    pthread_mutex_lock(&table->mutex);
+    for (size_t i = 0; !modified && i < table->num_entries; ++i) {
+        modified = table->indexes[i] != NULL &&
+                   stream_index_modified(table->indexes[i]);
+    }
+    pthread_mutex_unlock(&table->mutex);
+    return modified;
+}
+
+int seek_table_read(struct seek_table_t *table,
+                    const struct zip_entry_table_t *entries, FILE *file) {
+    unsigned long long num_records;
+    if (fread(&num_records, sizeof(num_records), 1, file) != 1) {
+        return -1;
+    }
+
+    for (unsigned long long i = 0; i < num_records; ++i) {
+        struct seek_record_t record;
+        if (fread(&record, sizeof(record), 1, file) != 1) {
+            return -1;
+        }
+        struct stream_index_t *stream_index = stream_index_load(file);
+        if (stream_index == NULL) {
+            return -1;
+        }
+
+        struct seek_record_t expected;
+        memset(&expected, 0, sizeof(expected));
+        if (record.index < table->num_entries &&
+            record.index < entries->num_entries) {
+            seek_record_init(&expected, entries, record.index);
+        }
+        if (memcmp(&record, &expected, sizeof(record)) != 0 ||
+            table->indexes[record.index] != NULL) {
+            debug_eprintfln("Index of entry %llu is stale", record.index);
+            stream_index_free(stream_index);
+            continue;
+        }
+        table->indexes[record.index] = stream_index;
+    }
+    return 0;
+}
+
+int seek_table_write(struct seek_table_t *table,
+                     const struct zip_entry_table_t *entries, FILE *file) {
+    pthread_mutex_lock(&table->mutex);
+
+    unsigned long long num_records = 0;
+    for (size_t i = 0; i < table->num_entries; ++i) {
+        num_records += table->indexes[i] != NULL;
+    }
+
+    int ret = fwrite(&num_records, sizeof(num_records), 1, file) == 1 ? 0 : -1;
+    for (size_t i = 0; ret == 0 && i < table->num_entries; ++i) {
+        if (table->indexes[i] == NULL) {
+            continue;
+        }
+        struct seek_record_t record;
+        seek_record_init(&record, entries, i);
+        if (fwrite(&record, sizeof(record), 1, file) != 1 ||
+            stream_index_save(table->indexes[i], file) != 0) {
+            ret = -1;
+        }
+    }
+
+    pthread_mutex_unlock(&table->mutex);
+    return ret;
+}
@@ -0,0 +1,90 @@
+#pragma once
+#ifndef SEEK_H
+#define SEEK_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#include "stream.h"
+#include "zip.h"
+
+/**
+ * The seek indexes of all entries of an archive, created on first use, which
+ * can be persisted to a sidecar file.
+ */
+struct seek_table_t {
+    pthread_mutex_t mutex;
+    struct stream_index_t **indexes;
+    size_t num_entries;
+    unsigned long long spacing;
+};
+
+/**
+ * Creates a table without any index.
+ *
+ * @param num_entries number of entries of the archive.
+ * @param spacing spacing of the points of new indexes.
+ *
+ * @return the table, or NULL on error.
+ */
+extern struct seek_table_t *seek_table_create(size_t num_entries,
+                                              unsigned long long spacing);
+
+/**
+ * Releases the table and all of its indexes.
+ *
+ * @param table table created by seek_table_create.
+ */
+extern void seek_table_free(struct seek_table_t *table);
+
+/**
+ * Returns the index of an entry, creating an empty one if there is none.
+ *
+ * @param table table created by seek_table_create.
+ * @param index entry index.
+ *
+ * @return the index, or NULL on error.
+ */
+extern struct stream_index_t *seek_table_get(struct seek_table_t *table,
+                                             int index);
+
+/**
+ * Tells whether any index has changed since it was created or read.
+ *
+ * @param table table created by seek_table_create.
+ *
+ * @return 1 if changed, 0 otherwise.
+ */
+extern int seek_table_modified(struct seek_table_t *table);
+
+/**
+ * Reads the indexes written by seek_table_write at the current position of a
+ * sidecar file.
+ *
+ * Indexes of entries which do not match the archive anymore are dropped.
+ *
+ * @param table table created by seek_table_create.
+ * @param entries entry table of the archive.
+ * @param file file opened for reading.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int seek_table_read(struct seek_table_t *table,
+                           const struct zip_entry_table_t *entries,
+                           FILE *file);
+
+/**
+ * Writes all indexes at the current position of a sidecar file.
+ *
+ * @param table table created by seek_table_create.
+ * @param entries entry table of the archive.
+ * @param file file opened for writing.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int seek_table_write(struct seek_table_t *table,
+                            const struct zip_entry_table_t *entries,
+                            FILE *file);
+
+#endif
@@ -0,0 +1,320 @@
+#include "seekable.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#if defined ZIPFS_WITH_ZSTD
+#include <zstd.h>
+
+#define SEEKABLE_SKIPPABLE_MAGIC 0x184d2a5eU
+#define SEEKABLE_SKIPPABLE_HEADER_SIZE 8
+#define SEEKABLE_MAGIC 0x8f92eab1U
+#define SEEKABLE_FOOTER_SIZE 9
+// Seek tables with checksums have 12 bytes per frame instead of 8.
+#define SEEKABLE_CHECKSUM_FLAG 0x80
+#define SEEKABLE_RESERVED_BITS 0x7c
+// Frames larger than this are not worth decoding to serve a block, so such
+// entries are rather decoded as a whole.
+#define SEEKABLE_MAX_FRAME_SIZE (256 * 1024 * 1024)
+
+struct seekable_t {
+    pthread_mutex_t mutex;
+    ZSTD_DCtx *dctx;
+    unsigned long long data_offset;
+    // Compressed data mapped in memory, which is used instead of in_buf.
+    const unsigned char *comp_data;
+    size_t num_frames;
+    // Offsets of the frames in the compressed and the decompressed data, with
+    // the sizes of both after the last frame.
+    unsigned long long *comp_offsets;
+    unsigned long long *uncomp_offsets;
+    // Compressed data of the frame being decoded.
+    unsigned char *in_buf;
+    size_t in_cap;
+    // Decompressed data of the frame decoded last, which is num_frames for
+    // none.
+    unsigned char *frame;
+    size_t frame_cap;
+    size_t last_frame;
+};
+
+static unsigned int seekable_le32(const unsigned char *p) {
+    return (unsigned int)p[0] | (unsigned int)p[1] << 8 |
+           (unsigned int)p[2] << 16 | (unsigned int)p[3] << 24;
+}
+
+// Grows a buffer to at least size bytes.
+static int seekable_reserve(unsigned char **buf, size_t *cap, size_t size) {
+    if (*cap >= size) {
+        return 0;
+    }
+    unsigned char *p = (unsigned char *)realloc(*buf, size);
+    if (p == NULL) {
+        perror("realloc()");
+        return -1;
+    }
+    *buf = p;
+    *cap = size;
+    return 0;
+}
+
+// Fills in the frame offsets from the entries of the seek table, checking
+// that they cover the data exactly.
+static int seekable_parse(struct seekable_t *seekable,
+                          const unsigned char *table, size_t entry_size,
+                          unsigned long long comp_size,
+                          unsigned long long uncomp_size) {
+    size_t n = seekable->num_frames;
+    seekable->comp_offsets =
+        (unsigned long long *)malloc((n + 1) * sizeof(unsigned long long));
+    seekable->uncomp_offsets =
+        (unsigned long long *)malloc((n + 1) * sizeof(unsigned long long));
+    if (seekable->comp_offsets == NULL || seekable->uncomp_offsets == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+
+    unsigned long long comp = 0;
+    unsigned long long uncomp = 0;
+    for (size_t i = 0; i < n; ++i) {
+        const unsigned char *entry = table + i * entry_size;
+        unsigned int frame_size = seekable_le32(entry + 4);
+        if (frame_size > SEEKABLE_MAX_FRAME_SIZE) {
+            debug_eprintfln("Frame %zu of %u bytes is too large", i,
+                            frame_size);
+            return -1;
+        }
+        seekable->comp_offsets[i] = comp;
+        seekable->uncomp_offsets[i] = uncomp;
+        comp += seekable_le32(entry);
+        uncomp += frame_size;
+    }
+    seekable->comp_offsets[n] = comp;
+    seekable->uncomp_offsets[n] = uncomp;
+    if (comp != comp_size || uncomp != uncomp_size) {
+        debug_eprintfln("Seek table does not match the entry");
+        return -1;
+    }
+    return 0;
+}
+
+struct seekable_t *seekable_open(stream_read_func read, void *opaque,
+                                 unsigned long long data_offset,
+                                 unsigned long long comp_size,
+                                 unsigned long long uncomp_size) {
+    unsigned char footer[SEEKABLE_FOOTER_SIZE];
+    if (comp_size < SEEKABLE_SKIPPABLE_HEADER_SIZE + SEEKABLE_FOOTER_SIZE ||
+        read(opaque, data_offset + comp_size - SEEKABLE_FOOTER_SIZE, footer,
+             SEEKABLE_FOOTER_SIZE) != SEEKABLE_FOOTER_SIZE) {
+        return NULL;
+    }
+    if (seekable_le32(footer + 5) != SEEKABLE_MAGIC ||
+        (footer[4] & SEEKABLE_RESERVED_BITS) != 0) {
+        debug_eprintfln("Entry has no seek table");
+        return NULL;
+    }
+
+    unsigned long long num_frames = seekable_le32(footer);
+    size_t entry_size = footer[4] & SEEKABLE_CHECKSUM_FLAG ? 12 : 8;
+    unsigned long long table_size = SEEKABLE_SKIPPABLE_HEADER_SIZE +
+                                    num_frames * entry_size +
+                                    SEEKABLE_FOOTER_SIZE;
+    if (table_size > comp_size) {
+        debug_eprintfln("Seek table is larger than the entry");
+        return NULL;
+    }
+
+    struct seekable_t *seekable =
+        (struct seekable_t *)calloc(1, sizeof(*seekable));
+    unsigned char *table = (unsigned char *)malloc(table_size);
+    if (seekable == NULL || table == NULL) {
+        perror("calloc()");
+        free(seekable);
+        free(table);
+        return NULL;
+    }
+    pthread_mutex_init(&seekable->mutex, NULL);
+    seekable->data_offset = data_offset;
+    seekable->num_frames = num_frames;
+    seekable->last_frame = num_frames;
+
+    if (read(opaque, data_offset + comp_size - table_size, table,
+             table_size) != table_size ||
+        seekable_le32(table) != SEEKABLE_SKIPPABLE_MAGIC ||
+        seekable_le32(table + 4) !=
+            table_size - SEEKABLE_SKIPPABLE_HEADER_SIZE) {
+        debug_eprintfln("Invalid seek table");
+        goto error;
+    }
+    if (seekable_parse(seekable, table + SEEKABLE_SKIPPABLE_HEADER_SIZE,
+                       entry_size, comp_size - table_size, uncomp_size) != 0) {
+        goto error;
+    }
+
+    seekable->dctx = ZSTD_createDCtx();
+    if (seekable->dctx == NULL) {
+        eprintfln("Create zstd context error");
+        goto error;
+    }
+    free(table);
+    debug_eprintfln("Seek table with %zu frame(s) read", seekable->num_frames);
+    return seekable;
+
+error:
+    free(table);
+    seekable_free(seekable);
+    return NULL;
+}
+
+void seekable_map(struct seekable_t *seekable, const void *comp_data) {
+    seekable->comp_data = (const unsigned char *)comp_data;
+}
+
+void seekable_free(struct seekable_t *seekable) {
+    if (seekable == NULL) {
+        return;
+    }
+    ZSTD_freeDCtx(seekable->dctx);
+    pthread_mutex_destroy(&seekable->mutex);
+    free(seekable->comp_offsets);
+    free(seekable->uncomp_offsets);
+    free(seekable->in_buf);
+    free(seekable->frame);
+    free(seekable);
+}
+
+// Returns the frame holding the decompressed byte at offset.
+static size_t seekable_find(const struct seekable_t *seekable,
+                            unsigned long long offset) {
+    size_t lo = 0;
+    size_t hi = seekable->num_frames;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (seekable->uncomp_offsets[mid] <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - 1;
+}
+
+// Decodes a frame into the frame buffer, unless it is there already.
+static int seekable_decode(struct seekable_t *seekable, stream_read_func read,
+                           void *opaque, size_t f) {
+    if (f == seekable->last_frame) {
+        return 0;
+    }
+
+    size_t comp_size =
+        seekable->comp_offsets[f + 1] - seekable->comp_offsets[f];
+    size_t uncomp_size =
+        seekable->uncomp_offsets[f + 1] - seekable->uncomp_offsets[f];
+    // Whatever was decoded before is overwritten from here on.
+    seekable->last_frame = seekable->num_frames;
+    if (seekable_reserve(&seekable->frame, &seekable->frame_cap,
+                         uncomp_size) != 0) {
+        return -ENOMEM;
+    }
+
+    const unsigned char *comp;
+    if (seekable->comp_data != NULL) {
+        comp = seekable->comp_data + seekable->comp_offsets[f];
+    } else {
+        if (seekable_reserve(&seekable->in_buf, &seekable->in_cap,
+                             comp_size) != 0) {
+            return -ENOMEM;
+        }
+        unsigned long long offset =
+            seekable->data_offset + seekable->comp_offsets[f];
+        if (read(opaque, offset, seekable->in_buf, comp_size) != comp_size) {
+            eprintfln("Read compressed data at offset %llu error", offset);
+            return -EIO;
+        }
+        comp = seekable->in_buf;
+    }
+
+    size_t ret = ZSTD_decompressDCtx(seekable->dctx, seekable->frame,
+                                     uncomp_size, comp, comp_size);
+    if (ZSTD_isError(ret) || ret != uncomp_size) {
+        eprintfln("Decode frame %zu error: %s", f,
+                  ZSTD_isError(ret) ? ZSTD_getErrorName(ret) : "size");
+        return -EIO;
+    }
+    seekable->last_frame = f;
+    debug_eprintfln("Frame %zu decoded", f);
+    return 0;
+}
+
+ssize_t seekable_read(struct seekable_t *seekable, stream_read_func read,
+                      void *opaque, char *buf, size_t size,
+                      unsigned long long offset) {
+    unsigned long long end = seekable->uncomp_offsets[seekable->num_frames];
+    if (offset >= end) {
+        return 0;
+    }
+    if (size > end - offset) {
+        size = end - offset;
+    }
+
+    pthread_mutex_lock(&seekable->mutex);
+    size_t pos = 0;
+    while (pos < size) {
+        size_t f = seekable_find(seekable, offset + pos);
+        int ret = seekable_decode(seekable, read, opaque, f);
+        if (ret != 0) {
+            pthread_mutex_unlock(&seekable->mutex);
+            return ret;
+        }
+        size_t begin = offset + pos - seekable->uncomp_offsets[f];
+        size_t len = seekable->uncomp_offsets[f + 1] - offset - pos;
+        if (len > size - pos) {
+            len = size - pos;
+        }
+        memcpy(buf + pos, seekable->frame + begin, len);
+        pos += len;
+    }
+    pthread_mutex_unlock(&seekable->mutex);
+    return size;
+}
+
+#else
+
+struct seekable_t *seekable_open(stream_read_func read, void *opaque,
+                                 unsigned long long data_offset,
+                                 unsigned long long comp_size,
+                                 unsigned long long uncomp_size) {
+    (void)read;
+    (void)opaque;
+    (void)data_offset;
+    (void)comp_size;
+    (void)uncomp_size;
+    return NULL;
+}
+
+void seekable_map(struct seekable_t *seekable, const void *comp_data) {
+    (void)seekable;
+    (void)comp_data;
+}
+
+void seekable_free(struct seekable_t *seekable) { (void)seekable; }
+
+ssize_t seekable_read(struct seekable_t *seekable, stream_read_func read,
+                      void *opaque, char *buf, size_t size,
+                      unsigned long long offset) {
+    (void)seekable;
+    (void)read;
+    (void)opaque;
+    (void)buf;
+    (void)size;
+    (void)offset;
+    return -EIO;
+}
+
+#endif
@@ -0,0 +1,73 @@
+#pragma once
+#ifndef SEEKABLE_H
+#define SEEKABLE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#include "stream.h"
+
+/**
+ * @struct seekable_t
+ *
+ * Random access to a zstd entry in the seekable format, which is a sequence of
+ * independent frames followed by a seek table in a skippable frame.
+ */
+struct seekable_t;
+
+/**
+ * Reads the seek table at the end of the compressed data of an entry.
+ *
+ * @param read function reading the compressed data.
+ * @param opaque argument passed to read.
+ * @param data_offset offset of the compressed data in the archive.
+ * @param comp_size compressed size in bytes.
+ * @param uncomp_size uncompressed size in bytes, which the frames must add up
+ *        to.
+ *
+ * @return the seekable entry, or NULL on error, if zstd is not built in or if
+ *         the entry has no valid seek table.
+ */
+extern struct seekable_t *seekable_open(stream_read_func read, void *opaque,
+                                        unsigned long long data_offset,
+                                        unsigned long long comp_size,
+                                        unsigned long long uncomp_size);
+
+/**
+ * Makes the entry decode its frames straight from the compressed data mapped
+ * in memory, instead of reading them.
+ *
+ * @param seekable entry opened by seekable_open.
+ * @param comp_data compressed data of the entry, which must stay mapped until
+ *        the entry is released.
+ */
+extern void seekable_map(struct seekable_t *seekable, const void *comp_data);
+
+/**
+ * Releases the entry.
+ *
+ * @param seekable entry opened by seekable_open.
+ */
+extern void seekable_free(struct seekable_t *seekable);
+
+/**
+ * Reads decompressed data of the entry, decoding only the frames which
+ * overlap the requested range. The frame decoded last is kept, so that reads
+ * within the same frame decode it once. Concurrent calls on the same entry are
+ * serialized.
+ *
+ * @param seekable entry opened by seekable_open.
+ * @param read function reading the compressed data.
+ * @param opaque argument passed to read.
+ * @param buf output buffer.
+ * @param size number of bytes to read.
+ * @param offset offset in the decompressed data.
+ *
+ * @return the number of bytes read, which is only less than size at the end of
+ *         the entry, or a negative errno on error.
+ */
+extern ssize_t seekable_read(struct seekable_t *seekable, stream_read_func read,
+                             void *opaque, char *buf, size_t size,
+                             unsigned long long offset);
+
+#endif
@@ -0,0 +1,353 @@
+#include "sidecar.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "seek.h"
+#include "tree.h"
+#include "zip.h"
+
+#define SIDECAR_MAGIC "ZIPFSIX1"
+#define SIDECAR_MAGIC_LEN 8
+#define SIDECAR_VERSION 2
+#define SIDECAR_ALIGN 8
+
+// Start of a sidecar file, followed by the entry table, the tree and the seek
+// indexes.
+struct sidecar_header_t {
+    char magic[SIDECAR_MAGIC_LEN];
+    unsigned long long version;
+    // Nodes, stat structures and timestamps are mapped as they are, so they
+    // must have the same layout as in the build which wrote them.
+    unsigned long long node_size;
+    unsigned long long time_size;
+    struct sidecar_key_t key;
+    // Offset of the seek indexes, which are read rather than mapped.
+    unsigned long long seeks_offset;
+};
+
+// Layout of the entry table, followed by its names and arrays.
+struct sidecar_entries_t {
+    unsigned long long num_entries;
+    unsigned long long names_size;
+};
+
+void sidecar_key_init(struct sidecar_key_t *key, struct zip_t *zip,
+                      const struct stat *st) {
+    memset(key, 0, sizeof(*key));
+    key->archive_size = st->st_size;
+#ifdef __APPLE__
+    key->mtime_sec = st->st_mtimespec.tv_sec;
+    key->mtime_nsec = st->st_mtimespec.tv_nsec;
+#else
+    key->mtime_sec = st->st_mtim.tv_sec;
+    key->mtime_nsec = st->st_mtim.tv_nsec;
+#endif
+    key->num_entries = zip_total_entries(zip);
+    key->central_dir_crc32 = zip_central_dir_crc32(zip);
+}
+
+const void *sidecar_take(struct sidecar_reader_t *reader, size_t size) {
+    if (size > reader->size - reader->pos) {
+        return NULL;
+    }
+    const void *data = reader->data + reader->pos;
+    size_t padding = (SIDECAR_ALIGN - size % SIDECAR_ALIGN) % SIDECAR_ALIGN;
+    reader->pos += size;
+    reader->pos += padding < reader->size - reader->pos
+                       ? padding
+                       : reader->size - reader->pos;
+    return data;
+}
+
+int sidecar_write(FILE *file, const void *data, size_t size) {
+    static const char zeros[SIDECAR_ALIGN];
+    if (size > 0 && fwrite(data, size, 1, file) != 1) {
+        return -1;
+    }
+    off_t pos = ftello(file);
+    if (pos < 0) {
+        return -1;
+    }
+    size_t padding = (SIDECAR_ALIGN - pos % SIDECAR_ALIGN) % SIDECAR_ALIGN;
+    if (padding > 0 && fwrite(zeros, padding, 1, file) != 1) {
+        return -1;
+    }
+    return 0;
+}
+
+static int sidecar_write_entries(FILE *file,
+                                 const struct zip_entry_table_t *entries) {
+    size_t n = entries->num_entries;
+    struct sidecar_entries_t header;
+    memset(&header, 0, sizeof(header));
+    header.num_entries = n;
+    header.names_size = entries->names_size;
+
+    if (sidecar_write(file, &header, sizeof(header)) != 0 ||
+        sidecar_write(file, entries->names, entries->names_size) != 0 ||
+        sidecar_write(file, entries->name_offsets,
+                      n * sizeof(*entries->name_offsets)) != 0 ||
+        sidecar_write(file, entries->name_lens,
+                      n * sizeof(*entries->name_lens)) != 0 ||
+        sidecar_write(file, entries->uncomp_sizes,
+                      n * sizeof(*entries->uncomp_sizes)) != 0 ||
+        sidecar_write(file, entries->comp_sizes,
+                      n * sizeof(*entries->comp_sizes)) != 0 ||
+        sidecar_write(file, entries->header_offsets,
+                      n * sizeof(*entries->header_offsets)) != 0 ||
+        sidecar_write(file, entries->crc32s,
+                      n * sizeof(*entries->crc32s)) != 0 ||
+        sidecar_write(file, entries->methods,
+                      n * sizeof(*entries->methods)) != 0 ||
+        sidecar_write(file, entries->mtimes,
+                      n * sizeof(*entries->mtimes)) != 0 ||
+        sidecar_write(file, entries->isdirs,
+                      n * sizeof(*entries->isdirs)) != 0) {
+        return -1;
+    }
+    return 0;
+}
+
+static struct zip_entry_table_t *
+sidecar_map_entries(struct sidecar_reader_t *reader,
+                    unsigned long long num_entries) {
+    const struct sidecar_entries_t *header =
+        (const struct sidecar_entries_t *)sidecar_take(reader,
+                                                       sizeof(*header));
+    if (header == NULL || header->num_entries != num_entries ||
+        header->names_size == 0) {
+        return NULL;
+    }
+
+    struct zip_entry_table_t *entries =
+        (struct zip_entry_table_t *)calloc(1, sizeof(*entries));
+    if (entries == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    size_t n = header->num_entries;
+    entries->mapped = 1;
+    entries->num_entries = n;
+    entries->names_size = header->names_size;
+
+    // The table is only ever read, so casting away const is safe.
+    entries->names = (char *)sidecar_take(reader, entries->names_size);
+    entries->name_offsets =
+        (size_t *)sidecar_take(reader, n * sizeof(*entries->name_offsets));
+    entries->name_lens = (unsigned short *)sidecar_take(
+        reader, n * sizeof(*entries->name_lens));
+    entries->uncomp_sizes = (unsigned long long *)sidecar_take(
+        reader, n * sizeof(*entries->uncomp_sizes));
+    entries->comp_sizes = (unsigned long long *)sidecar_take(
+        reader, n * sizeof(*entries->comp_sizes));
+    entries->header_offsets = (unsigned long long *)sidecar_take(
+        reader, n * sizeof(*entries->header_offsets));
+    entries->crc32s = (unsigned int *)sidecar_take(
+        reader, n * sizeof(*entries->crc32s));
+    entries->methods = (unsigned short *)sidecar_take(
+        reader, n * sizeof(*entries->methods));
+    entries->mtimes =
+        (time_t *)sidecar_take(reader, n * sizeof(*entries->mtimes));
+    entries->isdirs = (unsigned char *)sidecar_take(
+        reader, n * sizeof(*entries->isdirs));
+    if (entries->names == NULL || entries->name_offsets == NULL ||
+        entries->name_lens == NULL || entries->uncomp_sizes == NULL ||
+        entries->comp_sizes == NULL || entries->header_offsets == NULL ||
+        entries->crc32s == NULL || entries->methods == NULL ||
+        entries->mtimes == NULL || entries->isdirs == NULL ||
+        entries->names[entries->names_size - 1] != '\0') {
+        zip_entry_table_free(entries);
+        return NULL;
+    }
+    return entries;
+}
+
+struct sidecar_t *sidecar_load(const char *path,
+                               const struct sidecar_key_t *key,
+                               struct seek_table_t *seeks,
+                               struct zip_entry_table_t **entries,
+                               struct tree_t **tree) {
+    FILE *file = fopen(path, "rb");
+    if (file == NULL) {
+        debug_eprintfln("No sidecar file '%s'", path);
+        return NULL;
+    }
+
+    struct sidecar_t *sidecar = NULL;
+    struct zip_entry_table_t *table = NULL;
+    struct tree_t *table_tree = NULL;
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0) {
+        perror("fstat()");
+        goto error;
+    }
+    if ((size_t)st.st_size < sizeof(struct sidecar_header_t)) {
+        eprintfln("Sidecar file '%s' is invalid", path);
+        goto error;
+    }
+
+    sidecar = (struct sidecar_t *)calloc(1, sizeof(*sidecar));
+    if (sidecar == NULL) {
+        perror("calloc()");
+        goto error;
+    }
+    sidecar->size = st.st_size;
+    sidecar->data = mmap(NULL, sidecar->size, PROT_READ, MAP_PRIVATE,
+                         fileno(file), 0);
+    if (sidecar->data == MAP_FAILED) {
+        perror("mmap()");
+        sidecar->data = NULL;
+        goto error;
+    }
+
+    struct sidecar_reader_t reader = {(const char *)sidecar->data,
+                                      sidecar->size, 0};
+    const struct sidecar_header_t *header =
+        (const struct sidecar_header_t *)sidecar_take(&reader,
+                                                      sizeof(*header));
+    if (memcmp(header->magic, SIDECAR_MAGIC, SIDECAR_MAGIC_LEN) != 0 ||
+        header->version != SIDECAR_VERSION ||
+        header->node_size != sizeof(struct tree_node_t) ||
+        header->time_size != sizeof(time_t)) {
+        eprintfln("Sidecar file '%s' was written by an incompatible build, "
+                  "ignored",
+                  path);
+        goto error;
+    }
+    if (memcmp(&header->key, key, sizeof(*key)) != 0) {
+        debug_eprintfln("Sidecar file '%s' is stale", path);
+        goto error;
+    }
+
+    table = sidecar_map_entries(&reader, key->num_entries);
+    if (table == NULL) {
+        eprintfln("Sidecar file '%s' is invalid", path);
+        goto error;
+    }
+    table_tree = tree_map(&reader, table);
+    if (table_tree == NULL) {
+        eprintfln("Sidecar file '%s' is invalid", path);
+        goto error;
+    }
+
+    // Only entries which were streamed have seek indexes, so reading them is
+    // cheap enough.
+    if (header->seeks_offset == 0 ||
+        fseeko(file, header->seeks_offset, SEEK_SET) != 0 ||
+        seek_table_read(seeks, table, file) != 0) {
+        eprintfln("Sidecar file '%s' is invalid", path);
+        goto error;
+    }
+
+    *entries = table;
+    *tree = table_tree;
+    debug_eprintfln("Sidecar file '%s' mapped", path);
+    fclose(file);
+    return sidecar;
+
+error:
+    tree_free(table_tree);
+    zip_entry_table_free(table);
+    sidecar_free(sidecar);
+    fclose(file);
+    return NULL;
+}
+
+int sidecar_save(const char *path, const struct sidecar_key_t *key,
+                 const struct zip_entry_table_t *entries,
+                 const struct tree_t *tree, struct seek_table_t *seeks) {
+    // A unique temporary file next to the sidecar file, so that mounts saving
+    // the same one at once do not write over each other before renaming.
+    size_t len = strlen(path);
+    char *tmp_path = (char *)malloc(len + sizeof(".XXXXXX"));
+    if (tmp_path == NULL) {
+        perror("malloc()");
+        return -1;
+    }
+    memcpy(tmp_path, path, len);
+    memcpy(tmp_path + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    int ret = -1;
+    int fd = mkstemp(tmp_path);
+    if (fd < 0) {
+        perror("mkstemp()");
+        eprintfln("Write sidecar file '%s' error", path);
+        goto cleanup;
+    }
+    // mkstemp creates the file readable by its owner only, so it is given the
+    // mode fopen would have. The umask can only be read by setting it.
+    mode_t mask = umask(0);
+    umask(mask);
+    if (fchmod(fd, 0666 & ~mask) != 0) {
+        perror("fchmod()");
+    }
+    FILE *file = fdopen(fd, "wb");
+    if (file == NULL) {
+        perror("fdopen()");
+        eprintfln("Write sidecar file '%s' error", path);
+        close(fd);
+        unlink(tmp_path);
+        goto cleanup;
+    }
+
+    struct sidecar_header_t header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SIDECAR_MAGIC, SIDECAR_MAGIC_LEN);
+    header.version = SIDECAR_VERSION;
+    header.node_size = sizeof(struct tree_node_t);
+    header.time_size = sizeof(time_t);
+    header.key = *key;
+    if (sidecar_write(file, &header, sizeof(header)) != 0 ||
+        sidecar_write_entries(file, entries) != 0 ||
+        tree_save(tree, file) != 0) {
+        goto close;
+    }
+
+    // The header is written again once the seek indexes are placed.
+    off_t seeks_offset = ftello(file);
+    if (seeks_offset < 0 || seek_table_write(seeks, entries, file) != 0) {
+        goto close;
+    }
+    header.seeks_offset = seeks_offset;
+    if (fseeko(file, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, file) != 1) {
+        goto close;
+    }
+    ret = 0;
+
+close:
+    if (fclose(file) != 0) {
+        ret = -1;
+    }
+    if (ret == 0 && rename(tmp_path, path) != 0) {
+        perror("rename()");
+        ret = -1;
+    }
+    if (ret != 0) {
+        eprintfln("Write sidecar file '%s' error", path);
+        unlink(tmp_path);
+    } else {
+        debug_eprintfln("Sidecar file '%s' written", path);
+    }
+
+cleanup:
+    free(tmp_path);
+    return ret;
+}
+
+void sidecar_free(struct sidecar_t *sidecar) {
+    if (sidecar == NULL) {
+        return;
+    }
+
+    if (sidecar->data != NULL) {
+        munmap(sidecar->data, sidecar->size);
+    }
+    free(sidecar);
+}
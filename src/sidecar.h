@@ -0,0 +1,121 @@
+#pragma once
+#ifndef SIDECAR_H
+#define SIDECAR_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/stat.h>
+
+struct seek_table_t;
+struct tree_t;
+struct zip_entry_table_t;
+struct zip_t;
+
+/**
+ * Identifies the archive a sidecar file was written for. Any change to the
+ * archive makes the sidecar file stale.
+ */
+struct sidecar_key_t {
+    unsigned long long archive_size;
+    long long mtime_sec;
+    long long mtime_nsec;
+    unsigned long long num_entries;
+    unsigned long long central_dir_crc32;
+};
+
+/**
+ * Reads consecutive sections of a sidecar file mapped into memory.
+ */
+struct sidecar_reader_t {
+    const char *data;
+    size_t size;
+    size_t pos;
+};
+
+/**
+ * A sidecar file mapped into memory, which the entry table and the tree
+ * loaded from it point into.
+ */
+struct sidecar_t {
+    void *data;
+    size_t size;
+};
+
+/**
+ * Fills in the key of an archive.
+ *
+ * @param key key to fill in.
+ * @param zip zip archive handler opened in 'r' mode.
+ * @param st attributes of the archive file.
+ */
+extern void sidecar_key_init(struct sidecar_key_t *key, struct zip_t *zip,
+                             const struct stat *st);
+
+/**
+ * Takes the next section of a mapped sidecar file. Sections are aligned to 8
+ * bytes, as written by sidecar_write.
+ *
+ * @param reader the reader.
+ * @param size size of the section in bytes.
+ *
+ * @return the section, or NULL if the file is truncated.
+ */
+extern const void *sidecar_take(struct sidecar_reader_t *reader, size_t size);
+
+/**
+ * Writes a section at the current position of a sidecar file, padded to a
+ * multiple of 8 bytes.
+ *
+ * @param file file opened for writing.
+ * @param data data of the section.
+ * @param size size of the section in bytes.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int sidecar_write(FILE *file, const void *data, size_t size);
+
+/**
+ * Maps a sidecar file, and sets up the entry table and the tree over it
+ * without any per-entry parsing. Seek indexes saved in the file are loaded
+ * into the seek table as well.
+ *
+ * @param path path of the sidecar file.
+ * @param key key of the archive.
+ * @param seeks seek table to load indexes into.
+ * @param entries receives the entry table.
+ * @param tree receives the tree.
+ *
+ * @return the mapping, which must be released after the entry table and the
+ *         tree, or NULL if the file is missing, stale or invalid.
+ */
+extern struct sidecar_t *sidecar_load(const char *path,
+                                      const struct sidecar_key_t *key,
+                                      struct seek_table_t *seeks,
+                                      struct zip_entry_table_t **entries,
+                                      struct tree_t **tree);
+
+/**
+ * Writes the entry table, the tree and the seek indexes to a sidecar file.
+ *
+ * The file is replaced atomically.
+ *
+ * @param path path of the sidecar file.
+ * @param key key of the archive.
+ * @param entries entry table of the archive.
+ * @param tree tree built from the entry table.
+ * @param seeks seek table of the archive.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int sidecar_save(const char *path, const struct sidecar_key_t *key,
+                        const struct zip_entry_table_t *entries,
+                        const struct tree_t *tree, struct seek_table_t *seeks);
+
+/**
+ * Unmaps a sidecar file.
+ *
+ * @param sidecar mapping returned by sidecar_load.
+ */
+extern void sidecar_free(struct sidecar_t *sidecar);
+
+#endif
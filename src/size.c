@@ -0,0 +1,37 @@
+#include "size.h"
+
+#include <errno.h>
+#include <stdlib.h>
+
+int size_parse(const char *str, size_t *size) {
+    char *end;
+    errno = 0;
+    unsigned long long n = strtoull(str, &end, 10);
+    if (errno != 0 || end == str) {
+        return -1;
+    }
+
+    switch (*end) {
+    case 'G':
+    case 'g':
+        n *= 1024;
+        // fall through
+    case 'M':
+    case 'm':
+        n *= 1024;
+        // fall through
+    case 'K':
+    case 'k':
+        n *= 1024;
+        ++end;
+        break;
+    default:
+        break;
+    }
+    if (*end != '\0') {
+        return -1;
+    }
+
+    *size = (size_t)n;
+    return 0;
+}
@@ -0,0 +1,18 @@
+#pragma once
+#ifndef SIZE_H
+#define SIZE_H
+
+#include <stddef.h>
+
+/**
+ * Parses a size in bytes with an optional binary K, M or G suffix, such as
+ * "64M" for 64 MiB, as given to the options of zipfs and zipfs-pack.
+ *
+ * @param str the size.
+ * @param size where the size in bytes is stored, left alone on error.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int size_parse(const char *str, size_t *size);
+
+#endif
@@ -0,0 +1,122 @@
+#include "slab.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+// Ranges of entries are halved down to so many, so that idle workers steal
+// the other halves.
+#define SLAB_GRAIN 64
+
+// Fills in the entries from first up to but excluding last.
+static void slab_run(void *opaque, int task_index, unsigned long long first,
+                     unsigned long long last) {
+    struct slab_t *slab = (struct slab_t *)opaque;
+
+    while (last - first > SLAB_GRAIN) {
+        unsigned long long mid = first + (last - first) / 2;
+        if (pool_spawn(slab->pool, slab_run, slab, 0, mid, last) != 0) {
+            break;
+        }
+        last = mid;
+    }
+
+    for (unsigned long long i = first; i < last; ++i) {
+        // Leaves the rest for after the reads waiting for a worker.
+        if (i > first && pool_should_yield(slab->pool) &&
+            pool_spawn(slab->pool, slab_run, slab, 0, i, last) == 0) {
+            return;
+        }
+        if (slab->offsets[i] == SIZE_MAX) {
+            continue;
+        }
+
+        if (slab->fill(slab->opaque, (int)i, slab->data + slab->offsets[i],
+                       slab->sizes[i]) != 0) {
+            eprintfln("Preload entry with index %llu error", i);
+            continue;
+        }
+        __atomic_store_n(&slab->ready[i], 1, __ATOMIC_RELEASE);
+        __atomic_fetch_add(&slab->num_filled, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&slab->filled_bytes, slab->sizes[i],
+                           __ATOMIC_RELAXED);
+    }
+}
+
+struct slab_t *slab_create(struct pool_t *pool, size_t num_entries,
+                           slab_size_func size, slab_fill_func fill,
+                           void *opaque) {
+    struct slab_t *slab = (struct slab_t *)calloc(1, sizeof(*slab));
+    if (slab == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    slab->pool = pool;
+    slab->num_entries = num_entries;
+    slab->fill = fill;
+    slab->opaque = opaque;
+
+    slab->offsets = (size_t *)malloc(num_entries * sizeof(size_t));
+    slab->sizes = (size_t *)calloc(num_entries, sizeof(size_t));
+    slab->ready = (unsigned char *)calloc(num_entries, 1);
+    if (slab->offsets == NULL || slab->sizes == NULL || slab->ready == NULL) {
+        perror("malloc()");
+        slab_free(slab);
+        return NULL;
+    }
+
+    for (size_t i = 0; i < num_entries; ++i) {
+        long long entry_size = size(opaque, (int)i);
+        if (entry_size < 0) {
+            slab->offsets[i] = SIZE_MAX;
+            continue;
+        }
+        slab->offsets[i] = slab->size;
+        slab->sizes[i] = (size_t)entry_size;
+        slab->size += (size_t)entry_size;
+    }
+
+    // Always allocate something, so that empty entries are packed as well.
+    slab->data = (char *)malloc(slab->size > 0 ? slab->size : 1);
+    if (slab->data == NULL) {
+        perror("malloc()");
+        eprintfln("Allocate %zu bytes for preloading error", slab->size);
+        slab_free(slab);
+        return NULL;
+    }
+    debug_eprintfln("Slab of %zu bytes created", slab->size);
+    return slab;
+}
+
+int slab_start(struct slab_t *slab) {
+    return pool_submit(slab->pool, POOL_BACKGROUND, slab_run, slab, 0, 0,
+                       slab->num_entries);
+}
+
+void slab_free(struct slab_t *slab) {
+    if (slab == NULL) {
+        return;
+    }
+
+    free(slab->data);
+    free(slab->offsets);
+    free(slab->sizes);
+    free(slab->ready);
+    free(slab);
+}
+
+int slab_contains(const struct slab_t *slab, int index) {
+    return slab->offsets[index] != SIZE_MAX;
+}
+
+const char *slab_get(const struct slab_t *slab, int index, size_t *size) {
+    if (slab->offsets[index] == SIZE_MAX ||
+        !__atomic_load_n(&slab->ready[index], __ATOMIC_ACQUIRE)) {
+        return NULL;
+    }
+    *size = slab->sizes[index];
+    return slab->data + slab->offsets[index];
+}
@@ -0,0 +1,102 @@
+#pragma once
+#ifndef SLAB_H
+#define SLAB_H
+
+#include <stddef.h>
+
+#include "pool.h"
+
+/**
+ * Tells how many bytes an entry takes in the slab.
+ *
+ * @return the size, or negative number (< 0) if the entry is not packed.
+ */
+typedef long long (*slab_size_func)(void *opaque, int index);
+
+/**
+ * Extracts an entry into its place in the slab, of exactly its size.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+typedef int (*slab_fill_func)(void *opaque, int index, char *data,
+                              size_t size);
+
+/**
+ * Small entries packed back to back into one allocation, in the order of the
+ * entry table, and filled in once with background priority by the workers of
+ * a pool, which split the entries between them. Filled entries are read
+ * without locking, and never go away until the slab is released.
+ */
+struct slab_t {
+    char *data;
+    size_t size;
+    // Offset of each entry in data and its size, with an offset of SIZE_MAX
+    // for entries which are not packed.
+    size_t *offsets;
+    size_t *sizes;
+    // Set once an entry is filled in, with release semantics.
+    unsigned char *ready;
+    size_t num_entries;
+
+    slab_fill_func fill;
+    void *opaque;
+
+    struct pool_t *pool;
+    size_t num_filled;
+    size_t filled_bytes;
+};
+
+/**
+ * Lays out the entries in a slab and allocates it, without filling it in.
+ *
+ * @param pool pool the entries are filled in on.
+ * @param num_entries number of entries in the entry table.
+ * @param size function telling the size of each entry.
+ * @param fill function extracting an entry.
+ * @param opaque argument passed to size and fill.
+ *
+ * @return the slab, or NULL on error.
+ */
+extern struct slab_t *slab_create(struct pool_t *pool, size_t num_entries,
+                                  slab_size_func size, slab_fill_func fill,
+                                  void *opaque);
+
+/**
+ * Submits the filling in of every entry to the pool.
+ *
+ * @param slab slab created by slab_create.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int slab_start(struct slab_t *slab);
+
+/**
+ * Releases the slab, once the pool has been freed.
+ *
+ * @param slab slab created by slab_create.
+ */
+extern void slab_free(struct slab_t *slab);
+
+/**
+ * Tells whether an entry is packed, whether filled in yet or not.
+ *
+ * @param slab slab created by slab_create.
+ * @param index index of the entry.
+ *
+ * @return 1 if it is, 0 otherwise.
+ */
+extern int slab_contains(const struct slab_t *slab, int index);
+
+/**
+ * Returns the data of an entry if it is filled in.
+ *
+ * @param slab slab created by slab_create.
+ * @param index index of the entry.
+ * @param size output size of the entry.
+ *
+ * @return the data, or NULL if the entry is not packed or not filled in yet.
+ */
+extern const char *slab_get(const struct slab_t *slab, int index,
+                            size_t *size);
+
+#endif
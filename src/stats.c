@@ -0,0 +1,218 @@
+#include "stats.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <time.h>
+
+// Bucket i holds latencies of up to 2^i microseconds, and the last one all
+// the others.
+#define STATS_NUM_BUCKETS 24
+
+// Statistics of a single thread, which only that thread writes to, so that
+// counting takes neither locks nor contended cache lines.
+struct stats_thread_t {
+    struct stats_thread_t *prev;
+    struct stats_thread_t *next;
+    unsigned long long counters[STATS_NUM_COUNTERS];
+    unsigned long long op_ns[STATS_NUM_OPS];
+    unsigned long long op_buckets[STATS_NUM_OPS][STATS_NUM_BUCKETS];
+};
+
+static pthread_mutex_t stats_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t stats_once = PTHREAD_ONCE_INIT;
+static pthread_key_t stats_key;
+// Threads which have counted anything, and the sums of the ones which exited.
+static struct stats_thread_t *stats_threads;
+static struct stats_thread_t stats_retired;
+static __thread struct stats_thread_t *stats_local;
+
+static const char *const stats_op_names[STATS_NUM_OPS] = {
+    "lookup",  "getattr", "open",    "read",
+    "release", "opendir", "readdir", "readdirplus"};
+
+static const struct stats_metric_t {
+    enum stats_counter_t counter;
+    const char *name;
+    const char *labels;
+    const char *help;
+    // Factor from the unit counted to the one exposed.
+    double scale;
+} stats_metrics[] = {
+    {STATS_ENTRY_HITS, "zipfs_cache_hits_total", "{kind=\"entry\"}",
+     "Entries and blocks found in the cache.", 1},
+    {STATS_BLOCK_HITS, "zipfs_cache_hits_total", "{kind=\"block\"}", NULL, 1},
+    {STATS_ENTRY_MISSES, "zipfs_cache_misses_total", "{kind=\"entry\"}",
+     "Entries and blocks decoded into the cache.", 1},
+    {STATS_BLOCK_MISSES, "zipfs_cache_misses_total", "{kind=\"block\"}", NULL,
+     1},
+    {STATS_BYTES_DECODED, "zipfs_decoded_bytes_total", "",
+     "Bytes of decompressed data produced.", 1},
+    {STATS_DECODE_NS, "zipfs_decode_seconds_total", "",
+     "Time spent decompressing.", 1e-9},
+    {STATS_BYTES_SERVED, "zipfs_served_bytes_total", "",
+     "Bytes replied to reads.", 1},
+    {STATS_READER_WAITS, "zipfs_reader_waits_total", "",
+     "Acquisitions of an archive reader which had to wait for one.", 1},
+    {STATS_READER_WAIT_NS, "zipfs_reader_wait_seconds_total", "",
+     "Time spent waiting for an archive reader.", 1e-9},
+    {STATS_PRELOAD_HITS, "zipfs_preload_hits_total", "",
+     "Opens of entries served from the preload slab.", 1},
+    {STATS_REMOTE_REQUESTS, "zipfs_remote_requests_total", "",
+     "Range requests made for remote archives.", 1},
+    {STATS_REMOTE_BYTES, "zipfs_remote_fetched_bytes_total", "",
+     "Bytes fetched by range requests.", 1},
+};
+
+// Adds the statistics of one thread to another.
+static void stats_merge(struct stats_thread_t *sum,
+                        const struct stats_thread_t *stats) {
+    for (size_t i = 0; i < STATS_NUM_COUNTERS; ++i) {
+        sum->counters[i] += __atomic_load_n(&stats->counters[i],
+                                            __ATOMIC_RELAXED);
+    }
+    for (size_t i = 0; i < STATS_NUM_OPS; ++i) {
+        sum->op_ns[i] += __atomic_load_n(&stats->op_ns[i], __ATOMIC_RELAXED);
+        for (size_t j = 0; j < STATS_NUM_BUCKETS; ++j) {
+            sum->op_buckets[i][j] +=
+                __atomic_load_n(&stats->op_buckets[i][j], __ATOMIC_RELAXED);
+        }
+    }
+}
+
+// Keeps the counts of an exiting thread, whose statistics go away with it.
+static void stats_retire(void *arg) {
+    struct stats_thread_t *stats = (struct stats_thread_t *)arg;
+
+    pthread_mutex_lock(&stats_mutex);
+    stats_merge(&stats_retired, stats);
+    if (stats->prev != NULL) {
+        stats->prev->next = stats->next;
+    } else {
+        stats_threads = stats->next;
+    }
+    if (stats->next != NULL) {
+        stats->next->prev = stats->prev;
+    }
+    pthread_mutex_unlock(&stats_mutex);
+    free(stats);
+}
+
+static void stats_init(void) { pthread_key_create(&stats_key, stats_retire); }
+
+// Returns the statistics of the calling thread, or NULL if they cannot be
+// allocated, in which case nothing is counted.
+static struct stats_thread_t *stats_thread(void) {
+    if (stats_local != NULL) {
+        return stats_local;
+    }
+
+    pthread_once(&stats_once, stats_init);
+    struct stats_thread_t *stats =
+        (struct stats_thread_t *)calloc(1, sizeof(*stats));
+    if (stats == NULL) {
+        return NULL;
+    }
+    pthread_mutex_lock(&stats_mutex);
+    stats->next = stats_threads;
+    if (stats_threads != NULL) {
+        stats_threads->prev = stats;
+    }
+    stats_threads = stats;
+    pthread_mutex_unlock(&stats_mutex);
+    pthread_setspecific(stats_key, stats);
+    stats_local = stats;
+    return stats;
+}
+
+// Only the owning thread writes, so a plain increment is enough as long as
+// readers see whole values.
+static void stats_inc(unsigned long long *value, unsigned long long n) {
+    __atomic_store_n(value, *value + n, __ATOMIC_RELAXED);
+}
+
+unsigned long long stats_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (unsigned long long)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+void stats_add(enum stats_counter_t counter, unsigned long long n) {
+    struct stats_thread_t *stats = stats_thread();
+    if (stats != NULL) {
+        stats_inc(&stats->counters[counter], n);
+    }
+}
+
+void stats_op(enum stats_op_t op, unsigned long long start) {
+    struct stats_thread_t *stats = stats_thread();
+    if (stats == NULL) {
+        return;
+    }
+
+    unsigned long long ns = stats_now() - start;
+    unsigned long long us = (ns + 999) / 1000;
+    size_t bucket = 0;
+    while (bucket + 1 < STATS_NUM_BUCKETS && (1ULL << bucket) < us) {
+        ++bucket;
+    }
+    stats_inc(&stats->op_ns[op], ns);
+    stats_inc(&stats->op_buckets[op][bucket], 1);
+}
+
+void stats_write(FILE *file) {
+    // Too large for the stack of a request.
+    struct stats_thread_t *sum =
+        (struct stats_thread_t *)calloc(1, sizeof(*sum));
+    if (sum == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&stats_mutex);
+    stats_merge(sum, &stats_retired);
+    for (struct stats_thread_t *stats = stats_threads; stats != NULL;
+         stats = stats->next) {
+        stats_merge(sum, stats);
+    }
+    pthread_mutex_unlock(&stats_mutex);
+
+    fprintf(file, "# HELP zipfs_request_duration_seconds Latency of requests "
+                  "of the kernel.\n"
+                  "# TYPE zipfs_request_duration_seconds histogram\n");
+    for (size_t i = 0; i < STATS_NUM_OPS; ++i) {
+        unsigned long long count = 0;
+        for (size_t j = 0; j < STATS_NUM_BUCKETS; ++j) {
+            count += sum->op_buckets[i][j];
+            if (j + 1 < STATS_NUM_BUCKETS) {
+                fprintf(file,
+                        "zipfs_request_duration_seconds_bucket{op=\"%s\","
+                        "le=\"%g\"} %llu\n",
+                        stats_op_names[i], (double)(1ULL << j) / 1e6, count);
+            } else {
+                fprintf(file,
+                        "zipfs_request_duration_seconds_bucket{op=\"%s\","
+                        "le=\"+Inf\"} %llu\n",
+                        stats_op_names[i], count);
+            }
+        }
+        fprintf(file, "zipfs_request_duration_seconds_sum{op=\"%s\"} %.9f\n",
+                stats_op_names[i], sum->op_ns[i] / 1e9);
+        fprintf(file, "zipfs_request_duration_seconds_count{op=\"%s\"} %llu\n",
+                stats_op_names[i], count);
+    }
+
+    for (size_t i = 0; i < sizeof(stats_metrics) / sizeof(stats_metrics[0]);
+         ++i) {
+        const struct stats_metric_t *metric = &stats_metrics[i];
+        if (metric->help != NULL) {
+            fprintf(file, "# HELP %s %s\n# TYPE %s counter\n", metric->name,
+                    metric->help, metric->name);
+        }
+        unsigned long long value = sum->counters[metric->counter];
+        if (metric->scale == 1) {
+            fprintf(file, "%s%s %llu\n", metric->name, metric->labels, value);
+        } else {
+            fprintf(file, "%s%s %.9f\n", metric->name, metric->labels,
+                    value * metric->scale);
+        }
+    }
+    free(sum);
+}
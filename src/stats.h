@@ -0,0 +1,74 @@
+#pragma once
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdio.h>
+
+// Requests whose latency is recorded.
+enum stats_op_t {
+    STATS_OP_LOOKUP,
+    STATS_OP_GETATTR,
+    STATS_OP_OPEN,
+    STATS_OP_READ,
+    STATS_OP_RELEASE,
+    STATS_OP_OPENDIR,
+    STATS_OP_READDIR,
+    STATS_OP_READDIRPLUS,
+    STATS_NUM_OPS
+};
+
+enum stats_counter_t {
+    // Whole entries found in the cache when opened, or loaded into it.
+    STATS_ENTRY_HITS,
+    STATS_ENTRY_MISSES,
+    // Blocks of streamed entries found in the cache when read, or decoded.
+    STATS_BLOCK_HITS,
+    STATS_BLOCK_MISSES,
+    // Decompressed bytes produced, and the nanoseconds spent producing them.
+    STATS_BYTES_DECODED,
+    STATS_DECODE_NS,
+    // Bytes replied to reads.
+    STATS_BYTES_SERVED,
+    // Acquisitions of a reader which had to wait for one, and for how long.
+    STATS_READER_WAITS,
+    STATS_READER_WAIT_NS,
+    // Opens of entries preloaded into the slab.
+    STATS_PRELOAD_HITS,
+    // Range requests made for remote archives, and the bytes they fetched.
+    STATS_REMOTE_REQUESTS,
+    STATS_REMOTE_BYTES,
+    STATS_NUM_COUNTERS
+};
+
+/**
+ * Returns the current time of a monotonic clock.
+ *
+ * @return the time in nanoseconds.
+ */
+extern unsigned long long stats_now(void);
+
+/**
+ * Adds to a counter of the calling thread.
+ *
+ * @param counter the counter.
+ * @param n the amount to add.
+ */
+extern void stats_add(enum stats_counter_t counter, unsigned long long n);
+
+/**
+ * Records the latency of a request handled by the calling thread.
+ *
+ * @param op the request.
+ * @param start time the request started at, as returned by stats_now.
+ */
+extern void stats_op(enum stats_op_t op, unsigned long long start);
+
+/**
+ * Writes the sums of the counters and latency histograms of all threads in
+ * the Prometheus text format.
+ *
+ * @param file file opened for writing.
+ */
+extern void stats_write(FILE *file);
+
+#endif
@@ -0,0 +1,606 @@
+#include "stream.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "crc.h"
+#include "log.h"
+
+#define MINIZ_HEADER_FILE_ONLY
+#define MINIZ_NO_ZLIB_COMPATIBLE_NAMES
+#include "miniz.h"
+
+#define STREAM_IN_BUF_SIZE (64 * 1024)
+#define STREAM_INDEX_MIN_POINTS 16
+
+// Everything needed to resume inflating at out_pos, which is the full state of
+// the inflater and the dictionary preceding out_pos.
+struct stream_point_t {
+    unsigned long long out_pos;
+    unsigned long long in_pos;
+    mz_uint32 out_crc32;
+    // Set if out_crc32 is the checksum of the data before out_pos, which
+    // streams skipping verification do not compute.
+    mz_uint32 crc_known;
+    mz_uint32 window_len;
+    tinfl_decompressor inflator;
+    mz_uint8 window[TINFL_LZ_DICT_SIZE];
+};
+
+// Size of a point up to the end of its window, which is all there is of points
+// saved or added without a full window.
+#define STREAM_POINT_SIZE(window_len)                                          \
+    (offsetof(struct stream_point_t, window) + (window_len))
+
+struct stream_index_t {
+    pthread_mutex_t mutex;
+    unsigned long long spacing;
+    // Points are sorted by out_pos, and immutable once added.
+    struct stream_point_t **points;
+    size_t num_points;
+    size_t cap_points;
+    int complete;
+    int modified;
+};
+
+struct stream_t {
+    pthread_mutex_t mutex;
+    tinfl_decompressor inflator;
+    tinfl_status status;
+    unsigned long long data_offset;
+    unsigned long long comp_size;
+    unsigned long long uncomp_size;
+    mz_uint32 crc32;
+    // Set unless verification is skipped altogether.
+    int verify;
+    // Compressed data mapped in memory, which is used instead of in_buf.
+    const mz_uint8 *comp_data;
+    // Number of compressed bytes read into in_buf so far.
+    unsigned long long comp_read;
+    mz_uint8 in_buf[STREAM_IN_BUF_SIZE];
+    const mz_uint8 *in;
+    size_t in_ofs;
+    size_t in_avail;
+    // Ring buffer holding the last window_size decompressed bytes, which
+    // doubles as the dictionary of the inflater.
+    mz_uint8 *window;
+    size_t window_size;
+    // Number of decompressed bytes so far.
+    unsigned long long out_pos;
+    mz_uint32 out_crc32;
+    // Set while out_crc32 covers all the data before out_pos, which is not
+    // the case after resuming at a point without a checksum.
+    int crc_known;
+    // Offset of the oldest decompressed byte in the window, which is only
+    // non-zero after resuming at a point.
+    unsigned long long window_base;
+    struct stream_index_t *index;
+    // Offset from which the next point may be added to the index.
+    unsigned long long next_point;
+};
+
+struct stream_index_t *stream_index_create(unsigned long long spacing) {
+    struct stream_index_t *index =
+        (struct stream_index_t *)calloc(1, sizeof(*index));
+    if (index == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    pthread_mutex_init(&index->mutex, NULL);
+    // Points closer than the dictionary size are not worth their memory.
+    index->spacing =
+        spacing > TINFL_LZ_DICT_SIZE ? spacing : TINFL_LZ_DICT_SIZE;
+    return index;
+}
+
+void stream_index_free(struct stream_index_t *index) {
+    if (index == NULL) {
+        return;
+    }
+    for (size_t i = 0; i < index->num_points; ++i) {
+        free(index->points[i]);
+    }
+    free(index->points);
+    pthread_mutex_destroy(&index->mutex);
+    free(index);
+}
+
+static int index_append(struct stream_index_t *index,
+                        struct stream_point_t *point) {
+    if (index->num_points == index->cap_points) {
+        size_t cap = index->cap_points ? index->cap_points * 2
+                                       : STREAM_INDEX_MIN_POINTS;
+        struct stream_point_t **points = (struct stream_point_t **)realloc(
+            index->points, cap * sizeof(*points));
+        if (points == NULL) {
+            perror("realloc()");
+            return -1;
+        }
+        index->points = points;
+        index->cap_points = cap;
+    }
+    index->points[index->num_points++] = point;
+    return 0;
+}
+
+int stream_index_add(struct stream_index_t *index, unsigned long long out_pos,
+                     unsigned long long in_pos, unsigned int out_crc32) {
+    struct stream_point_t *point =
+        (struct stream_point_t *)calloc(1, STREAM_POINT_SIZE(0));
+    if (point == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+    point->out_pos = out_pos;
+    point->in_pos = in_pos;
+    point->out_crc32 = out_crc32;
+    point->crc_known = 1;
+    tinfl_init(&point->inflator);
+
+    pthread_mutex_lock(&index->mutex);
+    size_t i = index->num_points;
+    while (i > 0 && index->points[i - 1]->out_pos > out_pos) {
+        --i;
+    }
+    int ret = -1;
+    if ((i > 0 && index->points[i - 1]->out_pos == out_pos) ||
+        index_append(index, point) != 0) {
+        free(point);
+        goto unlock;
+    }
+    memmove(&index->points[i + 1], &index->points[i],
+            (index->num_points - 1 - i) * sizeof(*index->points));
+    index->points[i] = point;
+    index->modified = 1;
+    ret = 0;
+
+unlock:
+    pthread_mutex_unlock(&index->mutex);
+    return ret;
+}
+
+// Returns the last point at or before offset, or NULL if there is none.
+static const struct stream_point_t *index_find(struct stream_index_t *index,
+                                               unsigned long long offset) {
+    pthread_mutex_lock(&index->mutex);
+    size_t lo = 0;
+    size_t hi = index->num_points;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->points[mid]->out_pos <= offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    const struct stream_point_t *point = lo > 0 ? index->points[lo - 1] : NULL;
+    pthread_mutex_unlock(&index->mutex);
+    return point;
+}
+
+int stream_index_complete(struct stream_index_t *index) {
+    pthread_mutex_lock(&index->mutex);
+    int complete = index->complete;
+    pthread_mutex_unlock(&index->mutex);
+    return complete;
+}
+
+unsigned long long stream_index_next(struct stream_index_t *index,
+                                     unsigned long long offset) {
+    pthread_mutex_lock(&index->mutex);
+    size_t lo = 0;
+    size_t hi = index->num_points;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->points[mid]->out_pos < offset) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    unsigned long long next =
+        lo < index->num_points ? index->points[lo]->out_pos : ULLONG_MAX;
+    pthread_mutex_unlock(&index->mutex);
+    return next;
+}
+
+int stream_index_modified(struct stream_index_t *index) {
+    pthread_mutex_lock(&index->mutex);
+    int modified = index->modified;
+    pthread_mutex_unlock(&index->mutex);
+    return modified;
+}
+
+int stream_index_save(struct stream_index_t *index, FILE *file) {
+    pthread_mutex_lock(&index->mutex);
+
+    mz_uint64 header[4] = {sizeof(struct stream_point_t), index->spacing,
+                           index->complete, index->num_points};
+    int ret = fwrite(header, sizeof(header), 1, file) == 1 ? 0 : -1;
+    // Only the part of the window in use is written.
+    for (size_t i = 0; ret == 0 && i < index->num_points; ++i) {
+        const struct stream_point_t *point = index->points[i];
+        if (fwrite(point, STREAM_POINT_SIZE(point->window_len), 1, file) !=
+            1) {
+            ret = -1;
+        }
+    }
+    if (ret == 0) {
+        index->modified = 0;
+    }
+
+    pthread_mutex_unlock(&index->mutex);
+    return ret;
+}
+
+struct stream_index_t *stream_index_load(FILE *file) {
+    mz_uint64 header[4];
+    if (fread(header, sizeof(header), 1, file) != 1) {
+        return NULL;
+    }
+    // The points hold the raw state of the inflater, which is only meaningful
+    // to the same build.
+    if (header[0] != sizeof(struct stream_point_t)) {
+        eprintfln("Index was saved by an incompatible build");
+        return NULL;
+    }
+
+    struct stream_index_t *index = stream_index_create(header[1]);
+    if (index == NULL) {
+        return NULL;
+    }
+    index->complete = header[2] != 0;
+
+    for (mz_uint64 i = 0; i < header[3]; ++i) {
+        struct stream_point_t *point =
+            (struct stream_point_t *)malloc(sizeof(*point));
+        if (point == NULL) {
+            perror("malloc()");
+            goto error;
+        }
+        if (fread(point, STREAM_POINT_SIZE(0), 1, file) != 1 ||
+            point->window_len > TINFL_LZ_DICT_SIZE ||
+            point->window_len > point->out_pos ||
+            fread(point->window, 1, point->window_len, file) !=
+                point->window_len) {
+            free(point);
+            goto error;
+        }
+        // Points without a full window keep only what they use of it.
+        if (point->window_len < TINFL_LZ_DICT_SIZE) {
+            struct stream_point_t *shrunk = (struct stream_point_t *)realloc(
+                point, STREAM_POINT_SIZE(point->window_len));
+            if (shrunk != NULL) {
+                point = shrunk;
+            }
+        }
+        if ((index->num_points > 0 &&
+             point->out_pos <= index->points[index->num_points - 1]->out_pos) ||
+            index_append(index, point) != 0) {
+            free(point);
+            goto error;
+        }
+    }
+    return index;
+
+error:
+    stream_index_free(index);
+    return NULL;
+}
+
+static void stream_reset(struct stream_t *stream) {
+    tinfl_init(&stream->inflator);
+    stream->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    stream->comp_read = 0;
+    stream->in_ofs = 0;
+    stream->in_avail = 0;
+    stream->out_pos = 0;
+    stream->out_crc32 = 0;
+    stream->crc_known = stream->verify;
+    stream->window_base = 0;
+    stream->next_point = 0;
+}
+
+struct stream_t *stream_create(size_t window_size,
+                               unsigned long long data_offset,
+                               unsigned long long comp_size,
+                               unsigned long long uncomp_size,
+                               unsigned int crc32,
+                               struct stream_index_t *index) {
+    // The inflater requires a power of two when it wraps around.
+    size_t size = TINFL_LZ_DICT_SIZE;
+    while (size < window_size) {
+        size *= 2;
+    }
+
+    struct stream_t *stream = (struct stream_t *)malloc(sizeof(*stream));
+    if (stream == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+    stream->window = (mz_uint8 *)malloc(size);
+    if (stream->window == NULL) {
+        perror("malloc()");
+        free(stream);
+        return NULL;
+    }
+
+    pthread_mutex_init(&stream->mutex, NULL);
+    stream->window_size = size;
+    stream->data_offset = data_offset;
+    stream->comp_size = comp_size;
+    stream->uncomp_size = uncomp_size;
+    stream->crc32 = crc32;
+    stream->verify = 1;
+    stream->comp_data = NULL;
+    stream->index = index;
+    stream_reset(stream);
+    return stream;
+}
+
+void stream_map(struct stream_t *stream, const void *comp_data) {
+    stream->comp_data = (const mz_uint8 *)comp_data;
+}
+
+void stream_no_verify(struct stream_t *stream) {
+    stream->verify = 0;
+    stream->crc_known = 0;
+}
+
+void stream_free(struct stream_t *stream) {
+    if (stream == NULL) {
+        return;
+    }
+    pthread_mutex_destroy(&stream->mutex);
+    free(stream->window);
+    free(stream);
+}
+
+// Copies decompressed data which must still be in the window.
+static void stream_copy(const struct stream_t *stream, char *buf,
+                        unsigned long long offset, size_t size) {
+    size_t pos = offset & (stream->window_size - 1);
+    size_t n = stream->window_size - pos;
+    if (n > size) {
+        n = size;
+    }
+    memcpy(buf, stream->window + pos, n);
+    memcpy(buf + n, stream->window, size - n);
+}
+
+// Continues inflating from a point of the index.
+static void stream_restore(struct stream_t *stream,
+                           const struct stream_point_t *point) {
+    size_t mask = stream->window_size - 1;
+
+    stream->inflator = point->inflator;
+    // The only position kept by the inflater is within the window, which is
+    // where the next output goes.
+    stream->inflator.m_dist_from_out_buf_start = point->out_pos & mask;
+    stream->status = TINFL_STATUS_NEEDS_MORE_INPUT;
+    stream->comp_read = point->in_pos;
+    stream->in_ofs = 0;
+    stream->in_avail = 0;
+    stream->out_pos = point->out_pos;
+    stream->out_crc32 = point->out_crc32;
+    stream->crc_known = stream->verify && point->crc_known;
+    stream->window_base = point->out_pos - point->window_len;
+    stream->next_point = point->out_pos;
+
+    for (size_t i = 0; i < point->window_len; ++i) {
+        stream->window[(stream->window_base + i) & mask] = point->window[i];
+    }
+}
+
+// Adds a point at the current offset, unless it is too close to the last one.
+static void stream_checkpoint(struct stream_t *stream) {
+    struct stream_index_t *index = stream->index;
+
+    pthread_mutex_lock(&index->mutex);
+    unsigned long long next =
+        index->num_points > 0
+            ? index->points[index->num_points - 1]->out_pos + index->spacing
+            : index->spacing;
+    if (stream->out_pos < next) {
+        stream->next_point = next;
+        goto unlock;
+    }
+
+    mz_uint32 window_len = stream->out_pos < TINFL_LZ_DICT_SIZE
+                               ? (mz_uint32)stream->out_pos
+                               : TINFL_LZ_DICT_SIZE;
+    struct stream_point_t *point =
+        (struct stream_point_t *)malloc(STREAM_POINT_SIZE(window_len));
+    if (point == NULL) {
+        perror("malloc()");
+        goto unlock;
+    }
+    point->out_pos = stream->out_pos;
+    point->in_pos = stream->comp_read - stream->in_avail;
+    point->out_crc32 = stream->out_crc32;
+    point->crc_known = stream->crc_known;
+    point->window_len = window_len;
+    point->inflator = stream->inflator;
+    stream_copy(stream, (char *)point->window,
+                stream->out_pos - point->window_len, point->window_len);
+
+    if (index_append(index, point) != 0) {
+        free(point);
+        goto unlock;
+    }
+    index->modified = 1;
+    stream->next_point = stream->out_pos + index->spacing;
+    debug_eprintfln("Point at offset %llu added", stream->out_pos);
+
+unlock:
+    pthread_mutex_unlock(&index->mutex);
+}
+
+// Decompresses the next chunk into the window, which is contiguous and at most
+// the rest of the ring buffer.
+static int stream_inflate(struct stream_t *stream, stream_read_func read,
+                          void *opaque) {
+    if (stream->in_avail == 0 && stream->comp_read < stream->comp_size) {
+        size_t n = STREAM_IN_BUF_SIZE;
+        if (n > stream->comp_size - stream->comp_read) {
+            n = stream->comp_size - stream->comp_read;
+        }
+        if (stream->comp_data != NULL) {
+            stream->in = stream->comp_data + stream->comp_read;
+        } else {
+            if (read(opaque, stream->data_offset + stream->comp_read,
+                     stream->in_buf, n) != n) {
+                eprintfln("Read compressed data at offset %llu error",
+                          stream->data_offset + stream->comp_read);
+                return -EIO;
+            }
+            stream->in = stream->in_buf;
+        }
+        stream->comp_read += n;
+        stream->in_ofs = 0;
+        stream->in_avail = n;
+    }
+
+    size_t pos = stream->out_pos & (stream->window_size - 1);
+    size_t in_size = stream->in_avail;
+    size_t out_size = stream->window_size - pos;
+    stream->status = tinfl_decompress(
+        &stream->inflator, stream->in + stream->in_ofs, &in_size,
+        stream->window, stream->window + pos, &out_size,
+        stream->comp_read < stream->comp_size ? TINFL_FLAG_HAS_MORE_INPUT : 0);
+    stream->in_ofs += in_size;
+    stream->in_avail -= in_size;
+
+    if (stream->status < TINFL_STATUS_DONE) {
+        eprintfln("Inflate error %d", stream->status);
+        return -EIO;
+    }
+
+    if (stream->crc_known) {
+        stream->out_crc32 =
+            crc_update(stream->out_crc32, stream->window + pos, out_size);
+    }
+    stream->out_pos += out_size;
+    if (stream->out_pos > stream->uncomp_size) {
+        eprintfln("Entry inflates to more than %llu bytes",
+                  stream->uncomp_size);
+        return -EIO;
+    }
+
+    if (stream->status == TINFL_STATUS_DONE) {
+        if (stream->out_pos != stream->uncomp_size ||
+            (stream->crc_known && stream->out_crc32 != stream->crc32)) {
+            eprintfln("Entry is corrupted");
+            return -EIO;
+        }
+        if (stream->index != NULL) {
+            pthread_mutex_lock(&stream->index->mutex);
+            if (!stream->index->complete) {
+                stream->index->complete = 1;
+                stream->index->modified = 1;
+            }
+            pthread_mutex_unlock(&stream->index->mutex);
+        }
+    } else if (stream->status == TINFL_STATUS_NEEDS_MORE_INPUT &&
+               stream->in_avail == 0 &&
+               stream->comp_read >= stream->comp_size) {
+        eprintfln("Entry is truncated");
+        return -EIO;
+    } else if (stream->index != NULL && stream->out_pos >= stream->next_point) {
+        stream_checkpoint(stream);
+    }
+
+    return 0;
+}
+
+ssize_t stream_read(struct stream_t *stream, stream_read_func read,
+                    void *opaque, char *buf, size_t size,
+                    unsigned long long offset) {
+    if (offset >= stream->uncomp_size) {
+        return 0;
+    }
+    unsigned long long end = offset + size;
+    if (end > stream->uncomp_size) {
+        end = stream->uncomp_size;
+    }
+
+    pthread_mutex_lock(&stream->mutex);
+
+    unsigned long long window_start =
+        stream->out_pos > stream->window_size
+            ? stream->out_pos - stream->window_size
+            : 0;
+    if (window_start < stream->window_base) {
+        window_start = stream->window_base;
+    }
+
+    // Resume at the closest point, if it saves going back to the beginning or
+    // inflating everything in front of it.
+    const struct stream_point_t *point =
+        stream->index != NULL ? index_find(stream->index, offset) : NULL;
+    if (point != NULL &&
+        (offset < window_start || point->out_pos > stream->out_pos)) {
+        debug_eprintfln("Resume at point %llu for offset %llu", point->out_pos,
+                        offset);
+        stream_restore(stream, point);
+    } else if (offset < window_start) {
+        debug_eprintfln("Offset %llu is before the window, restart", offset);
+        stream_reset(stream);
+    }
+
+    if (offset < stream->out_pos) {
+        unsigned long long hi = end < stream->out_pos ? end : stream->out_pos;
+        stream_copy(stream, buf, offset, hi - offset);
+    }
+
+    while (stream->out_pos < end) {
+        unsigned long long lo = stream->out_pos;
+        int ret = stream_inflate(stream, read, opaque);
+        if (ret != 0) {
+            stream_reset(stream);
+            pthread_mutex_unlock(&stream->mutex);
+            return ret;
+        }
+
+        unsigned long long hi = end < stream->out_pos ? end : stream->out_pos;
+        if (lo < offset) {
+            lo = offset;
+        }
+        if (lo < hi) {
+            stream_copy(stream, buf + (lo - offset), lo, hi - lo);
+        }
+    }
+
+    pthread_mutex_unlock(&stream->mutex);
+    return end - offset;
+}
+
+int stream_finish(struct stream_t *stream, stream_read_func read,
+                  void *opaque) {
+    pthread_mutex_lock(&stream->mutex);
+
+    // Start over from the last point, which is where the index ends.
+    const struct stream_point_t *point =
+        stream->index != NULL ? index_find(stream->index, stream->uncomp_size)
+                              : NULL;
+    if (point != NULL && point->out_pos > stream->out_pos) {
+        stream_restore(stream, point);
+    }
+
+    int ret = 0;
+    while (ret == 0 && stream->status != TINFL_STATUS_DONE) {
+        ret = stream_inflate(stream, read, opaque);
+    }
+    if (ret != 0) {
+        stream_reset(stream);
+    }
+
+    pthread_mutex_unlock(&stream->mutex);
+    return ret;
+}
@@ -0,0 +1,197 @@
+#pragma once
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/types.h>
+
+/**
+ * @struct stream_t
+ *
+ * Incremental inflater of a single deflated entry, which keeps only a window
+ * of the most recently decompressed data.
+ */
+struct stream_t;
+
+/**
+ * @struct stream_index_t
+ *
+ * Points of a deflated entry at which inflating can be resumed, spaced out
+ * evenly over its decompressed data. Can be shared by the streams of the same
+ * entry, which add points while they inflate.
+ */
+struct stream_index_t;
+
+/**
+ * Reads raw bytes of the archive, returning the number of bytes read.
+ */
+typedef size_t (*stream_read_func)(void *opaque, unsigned long long offset,
+                                   void *buf, size_t size);
+
+/**
+ * Creates an empty index.
+ *
+ * @param spacing distance in decompressed bytes between points, at least the
+ *        32 KiB deflate dictionary size.
+ *
+ * @return the index, or NULL on error.
+ */
+extern struct stream_index_t *stream_index_create(unsigned long long spacing);
+
+/**
+ * Releases the index, which must not be used by any stream.
+ *
+ * @param index index created by stream_index_create or stream_index_load.
+ */
+extern void stream_index_free(struct stream_index_t *index);
+
+/**
+ * Adds a point at which inflating can start afresh, with an empty dictionary,
+ * such as after a full flush of the deflater, which takes no memory for a
+ * window.
+ *
+ * @param index the index.
+ * @param out_pos offset of the point in the decompressed data.
+ * @param in_pos offset of the next deflate block in the compressed data.
+ * @param out_crc32 CRC-32 of the decompressed data before out_pos.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error or
+ *         if there is a point at out_pos already.
+ */
+extern int stream_index_add(struct stream_index_t *index,
+                            unsigned long long out_pos,
+                            unsigned long long in_pos, unsigned int out_crc32);
+
+/**
+ * Tells whether the index covers the whole entry.
+ *
+ * @param index the index.
+ *
+ * @return 1 if a stream has inflated up to the end of the entry, 0 otherwise.
+ */
+extern int stream_index_complete(struct stream_index_t *index);
+
+/**
+ * Returns where the first point at or after an offset is.
+ *
+ * @param index the index.
+ * @param offset offset in the decompressed data.
+ *
+ * @return the offset of the point in the decompressed data, or ULLONG_MAX if
+ *         there is none.
+ */
+extern unsigned long long stream_index_next(struct stream_index_t *index,
+                                            unsigned long long offset);
+
+/**
+ * Tells whether the index has changed since it was created, loaded or saved.
+ *
+ * @param index the index.
+ *
+ * @return 1 if changed, 0 otherwise.
+ */
+extern int stream_index_modified(struct stream_index_t *index);
+
+/**
+ * Writes the index at the current position of the file.
+ *
+ * @param index the index.
+ * @param file file opened for writing.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int stream_index_save(struct stream_index_t *index, FILE *file);
+
+/**
+ * Reads an index written by stream_index_save at the current position of the
+ * file.
+ *
+ * @param file file opened for reading.
+ *
+ * @return the index, or NULL on error or if it was saved by another build.
+ */
+extern struct stream_index_t *stream_index_load(FILE *file);
+
+/**
+ * Creates a stream over the compressed data of an entry.
+ *
+ * @param window_size size of the window of decompressed data, rounded up to a
+ *        power of two of at least the 32 KiB deflate dictionary size.
+ * @param data_offset offset of the compressed data in the archive.
+ * @param comp_size compressed size in bytes.
+ * @param uncomp_size uncompressed size in bytes.
+ * @param crc32 CRC-32 checksum of the uncompressed data.
+ * @param index index of the entry to use and extend, or NULL.
+ *
+ * @return the stream, or NULL on error.
+ */
+extern struct stream_t *stream_create(size_t window_size,
+                                      unsigned long long data_offset,
+                                      unsigned long long comp_size,
+                                      unsigned long long uncomp_size,
+                                      unsigned int crc32,
+                                      struct stream_index_t *index);
+
+/**
+ * Makes the stream inflate straight from the compressed data mapped in memory,
+ * instead of reading it.
+ *
+ * @param stream stream created by stream_create.
+ * @param comp_data compressed data of the entry, which must stay mapped until
+ *        the stream is released.
+ */
+extern void stream_map(struct stream_t *stream, const void *comp_data);
+
+/**
+ * Makes the stream skip computing and checking the CRC-32 checksum of the
+ * entry, which is otherwise checked once the end of the entry is inflated.
+ *
+ * @param stream stream created by stream_create.
+ */
+extern void stream_no_verify(struct stream_t *stream);
+
+/**
+ * Releases the stream.
+ *
+ * @param stream stream created by stream_create.
+ */
+extern void stream_free(struct stream_t *stream);
+
+/**
+ * Reads decompressed data of the entry.
+ *
+ * Data is only inflated up to the end of the requested range. Reading before
+ * the window resumes inflating at the closest point of the index before the
+ * offset, or restarts from the beginning of the entry without one. Reading far
+ * ahead skips to a point as well. Concurrent calls on the same stream are
+ * serialized.
+ *
+ * @param stream stream created by stream_create.
+ * @param read function reading the compressed data.
+ * @param opaque argument passed to read.
+ * @param buf output buffer.
+ * @param size number of bytes to read.
+ * @param offset offset in the decompressed data.
+ *
+ * @return the number of bytes read, which is only less than size at the end of
+ *         the entry, or a negative errno on error.
+ */
+extern ssize_t stream_read(struct stream_t *stream, stream_read_func read,
+                           void *opaque, char *buf, size_t size,
+                           unsigned long long offset);
+
+/**
+ * Inflates the rest of the entry without returning any data, so that its index
+ * gets complete.
+ *
+ * @param stream stream created by stream_create.
+ * @param read function reading the compressed data.
+ * @param opaque argument passed to read.
+ *
+ * @return the return code - 0 on success, negative errno on error.
+ */
+extern int stream_finish(struct stream_t *stream, stream_read_func read,
+                         void *opaque);
+
+#endif
@@ -0,0 +1,559 @@
+#include "tree.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+
+#define TREE_MIN_BUCKETS 64
+#define TREE_BLOCK_NODES 4096
+#define TREE_POOL_SHIFT 20
+#define TREE_POOL_SIZE (1 << TREE_POOL_SHIFT)
+
+#define TREE_HASH_INIT 14695981039346656037ULL
+
+// Layout of a tree in a sidecar file, followed by its nodes, buckets, entries
+// and pools, the last pool being only pool_used bytes long.
+struct tree_header_t {
+    unsigned long long num_nodes;
+    unsigned long long num_buckets;
+    unsigned long long num_entries;
+    unsigned long long num_pools;
+    unsigned long long pool_used;
+    long long mtime;
+};
+
+// FNV-1a, which is cheap and good enough for path names. Hashing can go on
+// from a previous hash, as if the strings were concatenated.
+static unsigned long long tree_hash_more(unsigned long long h, const char *path,
+                                         size_t len) {
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)path[i];
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+static unsigned long long tree_hash(const char *path, size_t len) {
+    return tree_hash_more(TREE_HASH_INIT, path, len);
+}
+
+// Like memrchr(3), which is not available everywhere.
+static const char *last_slash(const char *path, size_t len) {
+    while (len > 0) {
+        if (path[--len] == '/') {
+            return path + len;
+        }
+    }
+    return NULL;
+}
+
+const char *tree_node_path(const struct tree_t *tree,
+                           const struct tree_node_t *node) {
+    if (node->path & TREE_PATH_OWN) {
+        unsigned long long offset = node->path & ~TREE_PATH_OWN;
+        return tree->pools[offset >> TREE_POOL_SHIFT] +
+               (offset & (TREE_POOL_SIZE - 1));
+    }
+    return tree->names + node->path;
+}
+
+static struct tree_node_t *tree_find(const struct tree_t *tree,
+                                     const char *path, size_t len,
+                                     unsigned long long h) {
+    unsigned int ino = tree->buckets[h & (tree->num_buckets - 1)];
+    while (ino != 0) {
+        struct tree_node_t *node = tree_get(tree, ino);
+        if (node->hash == h && node->path_len == len &&
+            memcmp(tree_node_path(tree, node), path, len) == 0) {
+            return node;
+        }
+        ino = node->hash_next;
+    }
+    return NULL;
+}
+
+static int tree_rehash(struct tree_t *tree, size_t num_buckets) {
+    unsigned int *buckets =
+        (unsigned int *)calloc(num_buckets, sizeof(*buckets));
+    if (buckets == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+
+    for (size_t i = 0; i < tree->num_buckets; ++i) {
+        unsigned int ino = tree->buckets[i];
+        while (ino != 0) {
+            struct tree_node_t *node = tree_get(tree, ino);
+            unsigned int next = node->hash_next;
+            size_t b = node->hash & (num_buckets - 1);
+            node->hash_next = buckets[b];
+            buckets[b] = ino;
+            ino = next;
+        }
+    }
+
+    free(tree->buckets);
+    tree->buckets = buckets;
+    tree->num_buckets = num_buckets;
+    return 0;
+}
+
+// Makes room for one more pointer in an array, doubling its capacity.
+static int tree_reserve(void ***array, size_t len, size_t *cap) {
+    if (len < *cap) {
+        return 0;
+    }
+    size_t new_cap = *cap ? *cap * 2 : 16;
+    void **p = (void **)realloc(*array, new_cap * sizeof(void *));
+    if (p == NULL) {
+        perror("realloc()");
+        return -1;
+    }
+    *array = p;
+    *cap = new_cap;
+    return 0;
+}
+
+// Takes a zeroed node with the next inode number.
+static struct tree_node_t *tree_new_node(struct tree_t *tree) {
+    size_t i = tree->num_nodes;
+    if (i == tree->num_blocks * TREE_BLOCK_NODES) {
+        if (tree_reserve((void ***)&tree->blocks, tree->num_blocks,
+                         &tree->cap_blocks) != 0) {
+            return NULL;
+        }
+        struct tree_node_t *block = (struct tree_node_t *)calloc(
+            TREE_BLOCK_NODES, sizeof(struct tree_node_t));
+        if (block == NULL) {
+            perror("calloc()");
+            return NULL;
+        }
+        tree->blocks[tree->num_blocks++] = block;
+    }
+
+    struct tree_node_t *node =
+        &tree->blocks[i / TREE_BLOCK_NODES][i % TREE_BLOCK_NODES];
+    ++tree->num_nodes;
+    node->st.st_ino = tree->num_nodes;
+    return node;
+}
+
+// Copies a path into the pools, returning its offset, or 0 on error.
+static unsigned long long tree_copy_path(struct tree_t *tree, const char *path,
+                                         size_t len) {
+    if (tree->num_pools == 0 || tree->pool_used + len + 1 > TREE_POOL_SIZE) {
+        if (tree_reserve((void ***)&tree->pools, tree->num_pools,
+                         &tree->cap_pools) != 0) {
+            return 0;
+        }
+        char *pool = (char *)malloc(TREE_POOL_SIZE);
+        if (pool == NULL) {
+            perror("malloc()");
+            return 0;
+        }
+        tree->pools[tree->num_pools++] = pool;
+        tree->pool_used = 0;
+    }
+
+    char *p = tree->pools[tree->num_pools - 1] + tree->pool_used;
+    memcpy(p, path, len);
+    p[len] = '\0';
+    unsigned long long offset =
+        ((unsigned long long)(tree->num_pools - 1) << TREE_POOL_SHIFT) |
+        tree->pool_used;
+    tree->pool_used += len + 1;
+    return TREE_PATH_OWN | offset;
+}
+
+// Inserts a new node which must not exist yet, and links it to its parent.
+// The path is copied into the pools unless copy is 0, in which case it must be
+// a name of the entry table.
+static struct tree_node_t *tree_insert(struct tree_t *tree, const char *path,
+                                       size_t len, int copy,
+                                       unsigned long long h,
+                                       struct tree_node_t *parent) {
+    if (tree->num_nodes >= tree->num_buckets &&
+        tree_rehash(tree, tree->num_buckets * 2) != 0) {
+        return NULL;
+    }
+
+    unsigned long long offset;
+    if (copy) {
+        offset = tree_copy_path(tree, path, len);
+        if (offset == 0) {
+            return NULL;
+        }
+    } else {
+        offset = path - tree->names;
+    }
+
+    struct tree_node_t *node = tree_new_node(tree);
+    if (node == NULL) {
+        return NULL;
+    }
+
+    const char *slash = last_slash(path, len);
+    node->hash = h;
+    node->path = offset;
+    node->path_len = len;
+    node->name_offset = slash == NULL ? 0 : slash + 1 - path;
+    node->index = -1;
+
+    unsigned int ino = node->st.st_ino;
+    if (parent != NULL) {
+        if (parent->last_child != 0) {
+            tree_get(tree, parent->last_child)->next_sibling = ino;
+        } else {
+            parent->first_child = ino;
+        }
+        parent->last_child = ino;
+        ++parent->num_children;
+        node->parent = parent->st.st_ino;
+    }
+
+    size_t b = h & (tree->num_buckets - 1);
+    node->hash_next = tree->buckets[b];
+    tree->buckets[b] = ino;
+    return node;
+}
+
+static void tree_init_dir(const struct tree_t *tree, struct tree_node_t *node) {
+    node->st.st_mode = S_IFDIR | 0755;
+    node->st.st_nlink = 2;
+    node->st.st_mtime = tree->mtime;
+    node->st.st_atime = tree->mtime;
+    node->st.st_ctime = tree->mtime;
+}
+
+// Returns the directory node of the path, synthesizing it and any missing
+// ancestors on the way. Returns NULL if the path is taken by a regular file.
+static struct tree_node_t *tree_get_dir(struct tree_t *tree, const char *path,
+                                        size_t len) {
+    unsigned long long h = tree_hash(path, len);
+    struct tree_node_t *node = tree_find(tree, path, len, h);
+    if (node != NULL) {
+        return S_ISDIR(node->st.st_mode) ? node : NULL;
+    }
+
+    const char *slash = last_slash(path, len);
+    struct tree_node_t *parent = slash == NULL
+                                     ? tree_get(tree, FUSE_ROOT_INO)
+                                     : tree_get_dir(tree, path, slash - path);
+    if (parent == NULL) {
+        return NULL;
+    }
+
+    node = tree_insert(tree, path, len, 1, h, parent);
+    if (node != NULL) {
+        tree_init_dir(tree, node);
+    }
+    return node;
+}
+
+static int tree_add_entry(struct tree_t *tree,
+                          const struct zip_entry_table_t *entries, int index) {
+    const char *path = zip_entry_table_name(entries, index);
+    size_t len = entries->name_lens[index];
+    // Be tolerant of names with leading slashes, which are not allowed by
+    // the spec but do exist in the wild.
+    while (len > 0 && *path == '/') {
+        ++path;
+        --len;
+    }
+    while (len > 0 && path[len - 1] == '/') {
+        --len;
+    }
+    if (len == 0) {
+        debug_eprintfln("Entry with empty name ignored");
+        return 0;
+    }
+
+    struct tree_node_t *node;
+    if (entries->isdirs[index]) {
+        node = tree_get_dir(tree, path, len);
+        if (node == NULL) {
+            debug_eprintfln("Dir entry '%.*s' conflicts with a file", (int)len,
+                            path);
+            return 0;
+        }
+        if (node->index < 0) {
+            node->index = index;
+            tree->entries[index] = node->st.st_ino;
+            node->st.st_mtime = entries->mtimes[index];
+            node->st.st_atime = node->st.st_mtime;
+            node->st.st_ctime = node->st.st_mtime;
+        }
+        return 0;
+    }
+
+    unsigned long long h = tree_hash(path, len);
+    if (tree_find(tree, path, len, h) != NULL) {
+        debug_eprintfln("Duplicate entry '%.*s' ignored", (int)len, path);
+        return 0;
+    }
+
+    const char *slash = last_slash(path, len);
+    struct tree_node_t *parent = slash == NULL
+                                     ? tree_get(tree, FUSE_ROOT_INO)
+                                     : tree_get_dir(tree, path, slash - path);
+    if (parent == NULL) {
+        debug_eprintfln("Parent of entry '%.*s' is a file", (int)len, path);
+        return 0;
+    }
+
+    // Names of files never end with a slash, so the path is the rest of the
+    // name in the table.
+    node = tree_insert(tree, path, len, 0, h, parent);
+    if (node == NULL) {
+        return -1;
+    }
+    node->index = index;
+    tree->entries[index] = node->st.st_ino;
+    node->method = entries->methods[index];
+    node->st.st_mode = S_IFREG | 0444;
+    node->st.st_nlink = 1;
+    node->st.st_size = entries->uncomp_sizes[index];
+    node->st.st_blocks = (node->st.st_size + 511) / 512;
+    node->st.st_mtime = entries->mtimes[index];
+    node->st.st_atime = node->st.st_mtime;
+    node->st.st_ctime = node->st.st_mtime;
+    return 0;
+}
+
+struct tree_t *tree_create(size_t num_entries, time_t mtime) {
+    struct tree_t *tree = (struct tree_t *)calloc(1, sizeof(*tree));
+    if (tree == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+
+    size_t num_buckets = TREE_MIN_BUCKETS;
+    while (num_buckets < num_entries * 2) {
+        num_buckets *= 2;
+    }
+    if (tree_rehash(tree, num_buckets) != 0) {
+        goto error;
+    }
+    tree->mtime = mtime;
+
+    tree->entries = (unsigned int *)calloc(num_entries > 0 ? num_entries : 1,
+                                           sizeof(*tree->entries));
+    if (tree->entries == NULL) {
+        perror("calloc()");
+        goto error;
+    }
+    tree->num_entries = num_entries;
+
+    struct tree_node_t *root =
+        tree_insert(tree, "", 0, 1, tree_hash("", 0), NULL);
+    if (root == NULL) {
+        goto error;
+    }
+    tree_init_dir(tree, root);
+    return tree;
+
+error:
+    tree_free(tree);
+    return NULL;
+}
+
+int tree_add_entries(struct tree_t *tree,
+                     const struct zip_entry_table_t *entries, size_t begin,
+                     size_t end) {
+    if (end > tree->num_entries || end > entries->num_entries) {
+        return -1;
+    }
+    tree->names = entries->names;
+    for (size_t i = begin; i < end; ++i) {
+        if (tree_add_entry(tree, entries, (int)i) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct tree_t *tree_build(const struct zip_entry_table_t *entries,
+                          time_t mtime) {
+    size_t n = entries->num_entries;
+    debug_eprintfln("Total entries are %zu", n);
+
+    struct tree_t *tree = tree_create(n, mtime);
+    if (tree == NULL) {
+        return NULL;
+    }
+    if (tree_add_entries(tree, entries, 0, n) != 0) {
+        tree_free(tree);
+        return NULL;
+    }
+
+    debug_eprintfln("Tree with %zu nodes built", tree->num_nodes);
+    return tree;
+}
+
+int tree_save(const struct tree_t *tree, FILE *file) {
+    struct tree_header_t header;
+    memset(&header, 0, sizeof(header));
+    header.num_nodes = tree->num_nodes;
+    header.num_buckets = tree->num_buckets;
+    header.num_entries = tree->num_entries;
+    header.num_pools = tree->num_pools;
+    header.pool_used = tree->pool_used;
+    header.mtime = tree->mtime;
+    if (sidecar_write(file, &header, sizeof(header)) != 0) {
+        return -1;
+    }
+
+    // Blocks are written back to back, so that the nodes are one array.
+    for (size_t i = 0; i < tree->num_blocks; ++i) {
+        size_t n = tree->num_nodes - i * TREE_BLOCK_NODES;
+        if (n > TREE_BLOCK_NODES) {
+            n = TREE_BLOCK_NODES;
+        }
+        if (fwrite(tree->blocks[i], sizeof(struct tree_node_t), n, file) !=
+            n) {
+            return -1;
+        }
+    }
+    if (sidecar_write(file, tree->buckets,
+                      tree->num_buckets * sizeof(*tree->buckets)) != 0 ||
+        sidecar_write(file, tree->entries,
+                      tree->num_entries * sizeof(*tree->entries)) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < tree->num_pools; ++i) {
+        size_t size =
+            i + 1 < tree->num_pools ? TREE_POOL_SIZE : tree->pool_used;
+        if (sidecar_write(file, tree->pools[i], size) != 0) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+struct tree_t *tree_map(struct sidecar_reader_t *reader,
+                        const struct zip_entry_table_t *entries) {
+    const struct tree_header_t *header =
+        (const struct tree_header_t *)sidecar_take(reader, sizeof(*header));
+    if (header == NULL || header->num_nodes == 0 ||
+        header->num_entries != entries->num_entries ||
+        header->num_buckets == 0 ||
+        (header->num_buckets & (header->num_buckets - 1)) != 0) {
+        return NULL;
+    }
+
+    struct tree_t *tree = (struct tree_t *)calloc(1, sizeof(*tree));
+    if (tree == NULL) {
+        perror("calloc()");
+        return NULL;
+    }
+    tree->mapped = 1;
+    tree->names = entries->names;
+    tree->mtime = header->mtime;
+    tree->num_nodes = header->num_nodes;
+    tree->num_buckets = header->num_buckets;
+    tree->num_entries = header->num_entries;
+    tree->num_blocks =
+        (tree->num_nodes + TREE_BLOCK_NODES - 1) / TREE_BLOCK_NODES;
+    tree->num_pools = header->num_pools;
+    tree->pool_used = header->pool_used;
+
+    struct tree_node_t *nodes = (struct tree_node_t *)sidecar_take(
+        reader, tree->num_nodes * sizeof(struct tree_node_t));
+    tree->buckets = (unsigned int *)sidecar_take(
+        reader, tree->num_buckets * sizeof(*tree->buckets));
+    tree->entries = (unsigned int *)sidecar_take(
+        reader, tree->num_entries * sizeof(*tree->entries));
+    tree->blocks = (struct tree_node_t **)malloc(tree->num_blocks *
+                                                 sizeof(*tree->blocks));
+    tree->pools = (char **)malloc(
+        (tree->num_pools > 0 ? tree->num_pools : 1) * sizeof(*tree->pools));
+    if (nodes == NULL || tree->buckets == NULL || tree->entries == NULL ||
+        tree->blocks == NULL || tree->pools == NULL) {
+        goto error;
+    }
+
+    // Pointers to the blocks and pools are all there is to set up.
+    for (size_t i = 0; i < tree->num_blocks; ++i) {
+        tree->blocks[i] = nodes + i * TREE_BLOCK_NODES;
+    }
+    for (size_t i = 0; i < tree->num_pools; ++i) {
+        size_t size =
+            i + 1 < tree->num_pools ? TREE_POOL_SIZE : tree->pool_used;
+        tree->pools[i] = (char *)sidecar_take(reader, size);
+        if (tree->pools[i] == NULL) {
+            goto error;
+        }
+    }
+
+    debug_eprintfln("Tree with %zu nodes mapped", tree->num_nodes);
+    return tree;
+
+error:
+    tree_free(tree);
+    return NULL;
+}
+
+void tree_free(struct tree_t *tree) {
+    if (tree == NULL) {
+        return;
+    }
+
+    if (!tree->mapped) {
+        for (size_t i = 0; i < tree->num_blocks; ++i) {
+            free(tree->blocks[i]);
+        }
+        for (size_t i = 0; i < tree->num_pools; ++i) {
+            free(tree->pools[i]);
+        }
+        free(tree->buckets);
+        free(tree->entries);
+    }
+    free(tree->blocks);
+    free(tree->pools);
+    free(tree);
+}
+
+struct tree_node_t *tree_lookup(const struct tree_t *tree, const char *path) {
+    size_t len = strlen(path);
+    return tree_find(tree, path, len, tree_hash(path, len));
+}
+
+struct tree_node_t *tree_get(const struct tree_t *tree,
+                             unsigned long long ino) {
+    if (ino == 0 || ino > tree->num_nodes) {
+        return NULL;
+    }
+    --ino;
+    return &tree->blocks[ino / TREE_BLOCK_NODES][ino % TREE_BLOCK_NODES];
+}
+
+struct tree_node_t *tree_get_entry(const struct tree_t *tree, int index) {
+    if (index < 0 || (size_t)index >= tree->num_entries) {
+        return NULL;
+    }
+    return tree_get(tree, tree->entries[index]);
+}
+
+struct tree_node_t *tree_lookup_child(const struct tree_t *tree,
+                                      const struct tree_node_t *parent,
+                                      const char *name) {
+    unsigned long long h = TREE_HASH_INIT;
+    if (parent->path_len > 0) {
+        h = tree_hash_more(h, tree_node_path(tree, parent), parent->path_len);
+        h = tree_hash_more(h, "/", 1);
+    }
+    h = tree_hash_more(h, name, strlen(name));
+
+    unsigned int ino = tree->buckets[h & (tree->num_buckets - 1)];
+    while (ino != 0) {
+        struct tree_node_t *node = tree_get(tree, ino);
+        if (node->hash == h && node->parent == parent->st.st_ino &&
+            strcmp(tree_node_name(tree, node), name) == 0) {
+            return node;
+        }
+        ino = node->hash_next;
+    }
+    return NULL;
+}
@@ -0,0 +1,226 @@
+#pragma once
+#ifndef TREE_H
+#define TREE_H
+
+#include <stddef.h>
+#include <stdio.h>
+#include <sys/stat.h>
+#include <time.h>
+
+#include "sidecar.h"
+#include "zip.h"
+
+// Set in the path offset of a node whose path is stored by the tree itself,
+// rather than in the names of the entry table.
+#define TREE_PATH_OWN (1ULL << 63)
+
+// Inode number of the root directory, the same as FUSE_ROOT_ID.
+#define FUSE_ROOT_INO 1
+
+/**
+ * A node of the in-memory directory tree.
+ *
+ * Every path of the archive has exactly one node, including the parent
+ * directories which are only implied by the names of their children. Nodes
+ * refer to each other by inode number and to their paths by offset, so that
+ * they can be mapped from a sidecar file as they are.
+ */
+struct tree_node_t {
+    unsigned long long hash;
+    // Offset of the path relative to the archive root, without leading or
+    // trailing slashes, and terminated by '\0'. The root node has an empty
+    // path.
+    unsigned long long path;
+    unsigned int path_len;
+    // Offset of the last component in the path.
+    unsigned int name_offset;
+    // Inode numbers of related nodes, or 0 for none.
+    unsigned int hash_next;
+    unsigned int parent;
+    unsigned int first_child;
+    unsigned int last_child;
+    unsigned int next_sibling;
+    unsigned int num_children;
+    // Index in the central directory, or -1 for a synthesized directory.
+    int index;
+    // Compression method of a file, as returned by zip_entry_method.
+    int method;
+    // Attributes, with the inode number which numbers the nodes from 1 for
+    // the root on.
+    struct stat st;
+};
+
+/**
+ * A path hash table over all the nodes, together with the tree they form.
+ */
+struct tree_t {
+    // All nodes by inode number minus 1, in blocks of TREE_BLOCK_NODES nodes
+    // which never move once allocated.
+    struct tree_node_t **blocks;
+    size_t num_blocks;
+    size_t cap_blocks;
+    size_t num_nodes;
+    // Inode numbers of the first node of each hash bucket.
+    unsigned int *buckets;
+    size_t num_buckets;
+    // Inode numbers by index in the central directory, 0 for ignored entries.
+    unsigned int *entries;
+    size_t num_entries;
+    // Names of the entry table, which paths of files point into.
+    const char *names;
+    // Blocks of TREE_POOL_SIZE bytes holding the paths of directories, which
+    // never move once allocated either.
+    char **pools;
+    size_t num_pools;
+    size_t cap_pools;
+    size_t pool_used;
+    // Modification time of directories without an entry of their own.
+    time_t mtime;
+    // Set if the nodes and their paths are mapped from a sidecar file.
+    int mapped;
+};
+
+/**
+ * Creates a tree with only the root directory, to which entries can be added.
+ *
+ * @param num_entries number of entries in the zip archive.
+ * @param mtime modification time of directories which have no entry of their
+ *        own, usually the one of the archive.
+ *
+ * @return the tree, or NULL on error.
+ */
+extern struct tree_t *tree_create(size_t num_entries, time_t mtime);
+
+/**
+ * Adds a range of entries to the tree, along with their parent directories.
+ *
+ * Entries must be added in the order of their indexes, so that inode numbers
+ * do not depend on how the range is split up.
+ *
+ * @param tree tree created by tree_create.
+ * @param entries entry table of the zip archive, which must outlive the tree.
+ * @param begin index of the first entry to add.
+ * @param end index after the last entry to add.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int tree_add_entries(struct tree_t *tree,
+                            const struct zip_entry_table_t *entries,
+                            size_t begin, size_t end);
+
+/**
+ * Builds the directory tree of all entries in the zip archive.
+ *
+ * Inode numbers only depend on the order of the entries, so they are the same
+ * for every mount of the same archive. Paths of files point into the names of
+ * the entry table, which must outlive the tree.
+ *
+ * @param entries entry table of the zip archive.
+ * @param mtime modification time of directories which have no entry of their
+ *        own, usually the one of the archive.
+ *
+ * @return the tree, or NULL on error.
+ */
+extern struct tree_t *tree_build(const struct zip_entry_table_t *entries,
+                                 time_t mtime);
+
+/**
+ * Writes the tree at the current position of a sidecar file.
+ *
+ * @param tree tree built by tree_build.
+ * @param file file opened for writing.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int tree_save(const struct tree_t *tree, FILE *file);
+
+/**
+ * Sets up a tree over the data written by tree_save, without copying it.
+ *
+ * @param reader reader of the mapped sidecar file.
+ * @param entries entry table of the zip archive, which must outlive the tree.
+ *
+ * @return the tree, which must be released before the data is unmapped, or
+ *         NULL on error.
+ */
+extern struct tree_t *tree_map(struct sidecar_reader_t *reader,
+                               const struct zip_entry_table_t *entries);
+
+/**
+ * Releases the tree and all of its nodes.
+ *
+ * @param tree tree created by tree_create, tree_build or tree_map.
+ */
+extern void tree_free(struct tree_t *tree);
+
+/**
+ * Looks up a node by its path relative to the archive root.
+ *
+ * @param tree the tree.
+ * @param path path without a leading slash, or an empty string for the root.
+ *
+ * @return the node, or NULL if the path does not exist.
+ */
+extern struct tree_node_t *tree_lookup(const struct tree_t *tree,
+                                       const char *path);
+
+/**
+ * Looks up a node by its inode number.
+ *
+ * @param tree the tree.
+ * @param ino inode number.
+ *
+ * @return the node, or NULL if there is no such inode.
+ */
+extern struct tree_node_t *tree_get(const struct tree_t *tree,
+                                    unsigned long long ino);
+
+/**
+ * Looks up the node of an entry by its index in the central directory.
+ *
+ * @param tree the tree.
+ * @param index index of the entry.
+ *
+ * @return the node, or NULL if there is no such entry or it was ignored.
+ */
+extern struct tree_node_t *tree_get_entry(const struct tree_t *tree,
+                                          int index);
+
+/**
+ * Looks up a child of a directory by its name.
+ *
+ * @param tree the tree.
+ * @param parent the directory node.
+ * @param name name of the child, without any slash.
+ *
+ * @return the node, or NULL if the directory has no such child.
+ */
+extern struct tree_node_t *tree_lookup_child(const struct tree_t *tree,
+                                             const struct tree_node_t *parent,
+                                             const char *name);
+
+/**
+ * Returns the path of a node.
+ *
+ * @param tree the tree.
+ * @param node node of the tree.
+ *
+ * @return the path, terminated by '\0'.
+ */
+extern const char *tree_node_path(const struct tree_t *tree,
+                                  const struct tree_node_t *node);
+
+/**
+ * Returns the last component of the path of a node.
+ *
+ * @param tree the tree.
+ * @param node node of the tree.
+ *
+ * @return the name, terminated by '\0'.
+ */
+static inline const char *tree_node_name(const struct tree_t *tree,
+                                         const struct tree_node_t *node) {
+    return tree_node_path(tree, node) + node->name_offset;
+}
+
+#endif
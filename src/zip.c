@@ -35,6 +35,7 @@ int symlink(const char *target, const char *linkpath); // needed on Linux
 
 #endif
 
+#include "crc.h"
 #include "miniz.h"
 #include "zip.h"
 
@@ -151,8 +152,27 @@ struct zip_t {
   mz_zip_archive archive;
   mz_uint level;
   struct zip_entry_t entry;
+  // Set if the central directory is borrowed from another handler.
+  int shared;
+  // Alignment of the data of the entries written next, or 0.
+  mz_uint alignment;
 };
 
+// Returns the number of zeros to write before the local header of an entry, so
+// that its data following the header and the name is aligned.
+static mz_uint zip_data_padding(struct zip_t *zip, size_t entrylen) {
+  mz_uint64 data_ofs;
+
+  if (!zip->alignment) {
+    return mz_zip_writer_compute_padding_needed_for_file_alignment(
+        &(zip->archive));
+  }
+  data_ofs = zip->archive.m_archive_size + MZ_ZIP_LOCAL_DIR_HEADER_SIZE +
+             entrylen;
+  return (mz_uint)((zip->alignment - (data_ofs & (zip->alignment - 1))) &
+                   (zip->alignment - 1));
+}
+
 struct zip_t *zip_open(const char *zipname, int level, char mode) {
   struct zip_t *zip = NULL;
 
@@ -184,6 +204,9 @@ struct zip_t *zip_open(const char *zipname, int level, char mode) {
 
   case 'r':
   case 'a':
+    // The central directory is sorted by name on the first lookup by name
+    // rather than here, so that opening an archive which is only read by
+    // index, as zipfs does, stays linear in its number of entries.
     if (!mz_zip_reader_init_file(
             &(zip->archive), zipname,
             zip->level | MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY)) {
@@ -209,8 +232,138 @@ cleanup:
   return NULL;
 }
 
+struct zip_t *zip_stream_open(const char *stream, size_t size, int level,
+                              char mode) {
+  struct zip_t *zip = NULL;
+
+  if (!stream || size == 0) {
+    // zip_t archive stream is empty or NULL
+    goto cleanup;
+  }
+
+  if (level < 0)
+    level = MZ_DEFAULT_LEVEL;
+  if ((level & 0xF) > MZ_UBER_COMPRESSION) {
+    // Wrong compression level
+    goto cleanup;
+  }
+
+  if (mode != 'r') {
+    // Only reading from a memory stream is supported
+    goto cleanup;
+  }
+
+  zip = (struct zip_t *)calloc((size_t)1, sizeof(struct zip_t));
+  if (!zip)
+    goto cleanup;
+
+  zip->level = (mz_uint)level;
+  // Sorted on the first lookup by name, as in zip_open.
+  if (!mz_zip_reader_init_mem(&(zip->archive), stream, size,
+                              zip->level |
+                                  MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY)) {
+    // Cannot initialize zip_archive reader
+    goto cleanup;
+  }
+
+  return zip;
+
+cleanup:
+  CLEANUP(zip);
+  return NULL;
+}
+
+struct zip_t *zip_reader_open(size_t (*read)(void *opaque,
+                                             unsigned long long offset,
+                                             void *buf, size_t size),
+                              void *opaque, unsigned long long size) {
+  struct zip_t *zip = NULL;
+
+  if (!read || size == 0) {
+    return NULL;
+  }
+
+  zip = (struct zip_t *)calloc((size_t)1, sizeof(struct zip_t));
+  if (!zip) {
+    return NULL;
+  }
+
+  // Sorted on the first lookup by name, as in zip_open.
+  zip->archive.m_pRead = read;
+  zip->archive.m_pIO_opaque = opaque;
+  if (!mz_zip_reader_init(&(zip->archive), size,
+                          MZ_ZIP_FLAG_DO_NOT_SORT_CENTRAL_DIRECTORY)) {
+    CLEANUP(zip);
+    return NULL;
+  }
+
+  return zip;
+}
+
+struct zip_t *zip_dup(struct zip_t *zip, const char *zipname) {
+  struct zip_t *dup = NULL;
+  mz_zip_internal_state *pState = NULL;
+  MZ_FILE *pFile = NULL;
+
+  if (!zip || !zip->archive.m_pState ||
+      zip->archive.m_zip_mode != MZ_ZIP_MODE_READING) {
+    // zip_t handler is not opened for reading
+    return NULL;
+  }
+
+  if (zip->archive.m_pState->m_pFile) {
+    if (!zipname || !(pFile = MZ_FOPEN(zipname, "rb"))) {
+      // Cannot reopen the archive file
+      return NULL;
+    }
+  }
+
+  dup = (struct zip_t *)calloc((size_t)1, sizeof(struct zip_t));
+  if (!dup)
+    goto cleanup;
+
+  pState = (mz_zip_internal_state *)zip->archive.m_pAlloc(
+      zip->archive.m_pAlloc_opaque, 1, sizeof(mz_zip_internal_state));
+  if (!pState)
+    goto cleanup;
+
+  // Only the I/O state is private, the central directory arrays still point
+  // to the ones of the original handler.
+  memcpy(pState, zip->archive.m_pState, sizeof(mz_zip_internal_state));
+  pState->m_pFile = pFile;
+
+  memcpy(&(dup->archive), &(zip->archive), sizeof(mz_zip_archive));
+  dup->archive.m_pState = pState;
+  // Callbacks of zip_reader_open keep their own opaque.
+  if (zip->archive.m_pIO_opaque == &(zip->archive)) {
+    dup->archive.m_pIO_opaque = &(dup->archive);
+  }
+  dup->level = zip->level;
+  dup->shared = 1;
+  // The names are sorted for the handler on its own first lookup by name, so
+  // that it does not share an array the original may not have built yet.
+  memset(&(pState->m_sorted_central_dir_offsets), 0, sizeof(mz_zip_array));
+  MZ_ZIP_ARRAY_SET_ELEMENT_SIZE(&(pState->m_sorted_central_dir_offsets),
+                                sizeof(mz_uint32));
+
+  return dup;
+
+cleanup:
+  if (pFile)
+    MZ_FCLOSE(pFile);
+  CLEANUP(dup);
+  return NULL;
+}
+
 void zip_close(struct zip_t *zip) {
   if (zip) {
+    if (zip->shared && zip->archive.m_pState) {
+      // Do not release the central directory of the original handler.
+      memset(&(zip->archive.m_pState->m_central_dir), 0, sizeof(mz_zip_array));
+      memset(&(zip->archive.m_pState->m_central_dir_offsets), 0,
+             sizeof(mz_zip_array));
+    }
+
     // Always finalize, even if adding failed for some reason, so we have a
     // valid central directory.
     mz_zip_writer_finalize_archive(&(zip->archive));
@@ -236,6 +389,26 @@ int zip_is64(struct zip_t *zip) {
   return (int)zip->archive.m_pState->m_zip64;
 }
 
+// Sorts the central directory by name, on the first lookup by name, for
+// mz_zip_reader_locate_file to search it by halves. It is scanned instead if
+// the sorted offsets cannot be allocated.
+static void zip_sort_central_dir(struct zip_t *zip) {
+  mz_zip_archive *pzip = &(zip->archive);
+  mz_zip_array *sorted = &(pzip->m_pState->m_sorted_central_dir_offsets);
+  mz_uint i;
+
+  if (sorted->m_size || pzip->m_total_files < 2) {
+    return;
+  }
+  if (!mz_zip_array_resize(pzip, sorted, pzip->m_total_files, MZ_FALSE)) {
+    return;
+  }
+  for (i = 0; i < pzip->m_total_files; ++i) {
+    MZ_ZIP_ARRAY_ELEMENT(sorted, mz_uint32, i) = i;
+  }
+  mz_zip_reader_sort_central_dir_offsets_by_filename(pzip);
+}
+
 int zip_entry_open(struct zip_t *zip, const char *entryname) {
   size_t entrylen = 0;
   mz_zip_archive *pzip = NULL;
@@ -270,6 +443,7 @@ int zip_entry_open(struct zip_t *zip, const char *entryname) {
 
   pzip = &(zip->archive);
   if (pzip->m_zip_mode == MZ_ZIP_MODE_READING) {
+    zip_sort_central_dir(zip);
     zip->entry.index =
         mz_zip_reader_locate_file(pzip, zip->entry.name, NULL, 0);
     if (zip->entry.index < 0) {
@@ -309,8 +483,7 @@ int zip_entry_open(struct zip_t *zip, const char *entryname) {
   zip->entry.external_attr = 0;
 #endif
 
-  num_alignment_padding_bytes =
-      mz_zip_writer_compute_padding_needed_for_file_alignment(pzip);
+  num_alignment_padding_bytes = zip_data_padding(zip, entrylen);
 
   if (!pzip->m_pState || (pzip->m_zip_mode != MZ_ZIP_MODE_WRITING)) {
     // Wrong zip mode
@@ -336,7 +509,7 @@ int zip_entry_open(struct zip_t *zip, const char *entryname) {
   }
 
   zip->entry.header_offset += num_alignment_padding_bytes;
-  if (pzip->m_file_offset_alignment) {
+  if (pzip->m_file_offset_alignment && !zip->alignment) {
     MZ_ASSERT(
         (zip->entry.header_offset & (pzip->m_file_offset_alignment - 1)) == 0);
   }
@@ -558,6 +731,99 @@ unsigned int zip_entry_crc32(struct zip_t *zip) {
   return zip ? zip->entry.uncomp_crc32 : 0;
 }
 
+unsigned long long zip_entry_comp_size(struct zip_t *zip) {
+  return zip ? zip->entry.comp_size : 0;
+}
+
+time_t zip_entry_mtime(struct zip_t *zip) {
+  return zip ? zip->entry.m_time : 0;
+}
+
+int zip_entry_method(struct zip_t *zip) {
+  return zip ? (int)zip->entry.method : -1;
+}
+
+long long zip_entry_data_offset(struct zip_t *zip) {
+  mz_zip_archive *pzip = NULL;
+  mz_uint32
+      local_header_u32[(MZ_ZIP_LOCAL_DIR_HEADER_SIZE + sizeof(mz_uint32) - 1) /
+                       sizeof(mz_uint32)];
+  mz_uint8 *pLocal_header = (mz_uint8 *)local_header_u32;
+  mz_uint64 offset;
+
+  if (!zip) {
+    // zip_t handler is not initialized
+    return -1;
+  }
+
+  pzip = &(zip->archive);
+  if (pzip->m_zip_mode != MZ_ZIP_MODE_READING || zip->entry.index < 0) {
+    // the entry is not found or we do not have read access
+    return -1;
+  }
+
+  // The local header may have different name and extra field lengths than the
+  // central directory header, so it has to be read.
+  if (pzip->m_pRead(pzip->m_pIO_opaque, zip->entry.header_offset,
+                    pLocal_header, MZ_ZIP_LOCAL_DIR_HEADER_SIZE) !=
+      MZ_ZIP_LOCAL_DIR_HEADER_SIZE) {
+    // Cannot read local header
+    return -1;
+  }
+  if (MZ_READ_LE32(pLocal_header) != MZ_ZIP_LOCAL_DIR_HEADER_SIG) {
+    // Invalid local header
+    return -1;
+  }
+
+  offset = zip->entry.header_offset + MZ_ZIP_LOCAL_DIR_HEADER_SIZE +
+           MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_FILENAME_LEN_OFS) +
+           MZ_READ_LE16(pLocal_header + MZ_ZIP_LDH_EXTRA_LEN_OFS);
+  if (offset + zip->entry.comp_size > pzip->m_archive_size) {
+    // Entry data is out of the archive
+    return -1;
+  }
+
+  return (long long)offset;
+}
+
+const void *zip_archive_mem(struct zip_t *zip) {
+  if (!zip || !zip->archive.m_pState ||
+      zip->archive.m_zip_mode != MZ_ZIP_MODE_READING) {
+    // zip_t handler is not opened for reading
+    return NULL;
+  }
+
+  return zip->archive.m_pState->m_pMem;
+}
+
+ssize_t zip_archive_read(struct zip_t *zip, unsigned long long offset,
+                         void *buf, size_t bufsize) {
+  mz_zip_archive *pzip = NULL;
+
+  if (!zip) {
+    // zip_t handler is not initialized
+    return -1;
+  }
+
+  pzip = &(zip->archive);
+  if (pzip->m_zip_mode != MZ_ZIP_MODE_READING) {
+    // we do not have read access
+    return -1;
+  }
+
+  if (offset >= pzip->m_archive_size) {
+    return 0;
+  }
+  if (bufsize > pzip->m_archive_size - offset) {
+    bufsize = (size_t)(pzip->m_archive_size - offset);
+  }
+
+  if (pzip->m_pRead(pzip->m_pIO_opaque, offset, buf, bufsize) != bufsize) {
+    return -1;
+  }
+  return (ssize_t)bufsize;
+}
+
 int zip_entry_write(struct zip_t *zip, const void *buf, size_t bufsize) {
   mz_uint level;
   mz_zip_archive *pzip = NULL;
@@ -644,6 +910,196 @@ int zip_entry_fwrite(struct zip_t *zip, const char *filename) {
   return status;
 }
 
+int zip_set_alignment(struct zip_t *zip, unsigned int alignment) {
+  if (!zip || (alignment & (alignment - 1))) {
+    // Wrong alignment
+    return -1;
+  }
+
+  zip->alignment = alignment;
+  return 0;
+}
+
+struct zip_copy_t {
+  struct zip_t *zip;
+  size_t flush_size;
+  mz_uint64 uncomp_size;
+  int (*on_flush)(void *arg, unsigned long long uncomp_offset,
+                  unsigned long long comp_offset, unsigned int crc32);
+  void *arg;
+};
+
+// Deflates extracted data, ending the deflate block with a full flush at
+// every multiple of the flush size.
+static size_t zip_copy_deflate(void *arg, unsigned long long offset,
+                               const void *buf, size_t bufsize) {
+  struct zip_copy_t *copy = (struct zip_copy_t *)arg;
+  const mz_uint8 *data = (const mz_uint8 *)buf;
+  size_t left = bufsize;
+  size_t n;
+  unsigned long long boundary;
+  tdefl_status status;
+
+  while (left > 0) {
+    boundary = (offset / copy->flush_size + 1) * copy->flush_size;
+    n = (size_t)MZ_MIN(left, boundary - offset);
+    if (zip_entry_write(copy->zip, data, n) != 0) {
+      return 0;
+    }
+    offset += n;
+    data += n;
+    left -= n;
+
+    if (offset == boundary && (copy->zip->level & 0xF)) {
+      status = tdefl_compress_buffer(&(copy->zip->entry.comp), "", 0,
+                                     TDEFL_FULL_FLUSH);
+      if (status != TDEFL_STATUS_DONE && status != TDEFL_STATUS_OKAY) {
+        // Cannot flush compressed buffer
+        return 0;
+      }
+      // The flush wrote out everything compressed so far.
+      if (copy->on_flush && offset < copy->uncomp_size &&
+          copy->on_flush(copy->arg, offset,
+                         copy->zip->entry.state.m_comp_size,
+                         copy->zip->entry.uncomp_crc32) != 0) {
+        return 0;
+      }
+    }
+  }
+
+  return bufsize;
+}
+
+int zip_entry_copy(struct zip_t *zip, struct zip_t *src, int index,
+                   size_t flush_size,
+                   int (*on_flush)(void *arg, unsigned long long uncomp_offset,
+                                   unsigned long long comp_offset,
+                                   unsigned int crc32),
+                   void *arg) {
+  mz_zip_archive *pzip = NULL;
+  mz_zip_archive *psrc = NULL;
+  mz_zip_archive_file_stat stats;
+  struct zip_copy_t copy;
+  mz_uint8 header[MZ_ZIP_LOCAL_DIR_HEADER_SIZE];
+  mz_uint8 buf[MZ_ZIP_MAX_IO_BUF_SIZE];
+  mz_uint64 header_offset, offset, pos;
+  mz_uint16 entrylen, bit_flags, dos_time, dos_date;
+  mz_uint num_alignment_padding_bytes;
+  long long data_offset;
+  size_t n;
+  int status = -1;
+
+  if (!zip || !src) {
+    // zip_t handler is not initialized
+    return -1;
+  }
+
+  pzip = &(zip->archive);
+  psrc = &(src->archive);
+  if (!pzip->m_pState || (pzip->m_zip_mode != MZ_ZIP_MODE_WRITING)) {
+    // Wrong zip mode
+    return -1;
+  }
+  if (zip_entry_openbyindex(src, index) != 0 ||
+      !mz_zip_reader_file_stat(psrc, (mz_uint)index, &stats)) {
+    goto cleanup;
+  }
+
+  if (flush_size && stats.m_method == MZ_DEFLATED &&
+      !(stats.m_bit_flag & MZ_ZIP_GENERAL_PURPOSE_BIT_FLAG_IS_ENCRYPTED)) {
+    if (zip_entry_open(zip, src->entry.name) != 0) {
+      goto cleanup;
+    }
+    zip->entry.m_time = stats.m_time;
+    zip->entry.external_attr = stats.m_external_attr;
+
+    copy.zip = zip;
+    copy.flush_size = flush_size;
+    copy.uncomp_size = stats.m_uncomp_size;
+    copy.on_flush = on_flush;
+    copy.arg = arg;
+    if (zip_entry_extract(src, zip_copy_deflate, &copy) != 0) {
+      // Cannot deflate the entry anew
+      CLEANUP(zip->entry.name);
+      goto cleanup;
+    }
+    status = zip_entry_close(zip);
+    goto cleanup;
+  }
+
+  entrylen = (mz_uint16)strlen(src->entry.name);
+  data_offset = zip_entry_data_offset(src);
+  if (data_offset < 0) {
+    goto cleanup;
+  }
+
+  num_alignment_padding_bytes = zip_data_padding(zip, entrylen);
+  header_offset = pzip->m_archive_size + num_alignment_padding_bytes;
+  offset = header_offset + MZ_ZIP_LOCAL_DIR_HEADER_SIZE + entrylen;
+  // no zip64 support yet
+  if ((pzip->m_total_files == 0xFFFF) ||
+      ((offset + stats.m_comp_size + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE +
+        entrylen) > 0xFFFFFFFF)) {
+    // No zip64 support yet
+    goto cleanup;
+  }
+  if (!mz_zip_writer_write_zeros(pzip, pzip->m_archive_size,
+                                 num_alignment_padding_bytes +
+                                     MZ_ZIP_LOCAL_DIR_HEADER_SIZE)) {
+    // Cannot memset zip entry header
+    goto cleanup;
+  }
+  if (pzip->m_pWrite(pzip->m_pIO_opaque,
+                     header_offset + MZ_ZIP_LOCAL_DIR_HEADER_SIZE,
+                     src->entry.name, entrylen) != entrylen) {
+    // Cannot write data to zip entry
+    goto cleanup;
+  }
+
+  for (pos = 0; pos < stats.m_comp_size; pos += n) {
+    n = (size_t)MZ_MIN(stats.m_comp_size - pos, MZ_ZIP_MAX_IO_BUF_SIZE);
+    if (psrc->m_pRead(psrc->m_pIO_opaque, (mz_uint64)data_offset + pos, buf,
+                      n) != n ||
+        pzip->m_pWrite(pzip->m_pIO_opaque, offset + pos, buf, n) != n) {
+      // Cannot copy compressed data
+      goto cleanup;
+    }
+  }
+
+  // The sizes are known up front, so there is no data descriptor (bit 3).
+  bit_flags = (mz_uint16)(stats.m_bit_flag & ~8);
+  mz_zip_time_t_to_dos_time(stats.m_time, &dos_time, &dos_date);
+  if (!mz_zip_writer_create_local_dir_header(
+          pzip, header, entrylen, 0, stats.m_uncomp_size, stats.m_comp_size,
+          stats.m_crc32, (mz_uint16)stats.m_method, bit_flags, dos_time,
+          dos_date)) {
+    // Cannot create zip entry header
+    goto cleanup;
+  }
+  if (pzip->m_pWrite(pzip->m_pIO_opaque, header_offset, header,
+                     sizeof(header)) != sizeof(header)) {
+    // Cannot write zip entry header
+    goto cleanup;
+  }
+
+  if (!mz_zip_writer_add_to_central_dir(
+          pzip, src->entry.name, entrylen, NULL, 0, "", 0,
+          stats.m_uncomp_size, stats.m_comp_size, stats.m_crc32,
+          (mz_uint16)stats.m_method, bit_flags, dos_time, dos_date,
+          header_offset, stats.m_external_attr)) {
+    // Cannot write to zip central dir
+    goto cleanup;
+  }
+
+  pzip->m_total_files++;
+  pzip->m_archive_size = offset + stats.m_comp_size;
+  status = 0;
+
+cleanup:
+  zip_entry_close(src);
+  return status;
+}
+
 ssize_t zip_entry_read(struct zip_t *zip, void **buf, size_t *bufsize) {
   mz_zip_archive *pzip = NULL;
   mz_uint idx;
@@ -774,6 +1230,244 @@ int zip_total_entries(struct zip_t *zip) {
   return (int)zip->archive.m_total_files;
 }
 
+struct zip_entry_table_t *zip_entry_table_create(struct zip_t *zip) {
+  mz_zip_archive *pzip = NULL;
+  mz_zip_internal_state *pState = NULL;
+  struct zip_entry_table_t *table = NULL;
+  mz_uint16 dos_time = 0, dos_date = 0;
+  time_t m_time = 0;
+  size_t n, i, names_size = 0;
+
+  if (!zip) {
+    // zip_t handler is not initialized
+    return NULL;
+  }
+
+  pzip = &(zip->archive);
+  pState = pzip->m_pState;
+  if (pzip->m_zip_mode != MZ_ZIP_MODE_READING || !pState) {
+    // the table requires readonly mode
+    return NULL;
+  }
+
+  table = (struct zip_entry_table_t *)calloc(1, sizeof(*table));
+  if (!table) {
+    return NULL;
+  }
+
+  n = pzip->m_total_files;
+  table->num_entries = n;
+  // Every name comes with a header of its own in the central directory, which
+  // is larger than the terminating '\0', so it bounds the size of all names.
+  table->names = (char *)malloc(pState->m_central_dir.m_size + 1);
+  table->name_offsets = (size_t *)malloc((n + 1) * sizeof(size_t));
+  table->name_lens =
+      (unsigned short *)malloc((n + 1) * sizeof(unsigned short));
+  table->uncomp_sizes = (unsigned long long *)malloc(
+      (n + 1) * sizeof(unsigned long long));
+  table->comp_sizes = (unsigned long long *)malloc(
+      (n + 1) * sizeof(unsigned long long));
+  table->header_offsets = (unsigned long long *)malloc(
+      (n + 1) * sizeof(unsigned long long));
+  table->crc32s = (unsigned int *)malloc((n + 1) * sizeof(unsigned int));
+  table->methods = (unsigned short *)malloc((n + 1) * sizeof(unsigned short));
+  table->mtimes = (time_t *)malloc((n + 1) * sizeof(time_t));
+  table->isdirs = (unsigned char *)malloc((n + 1) * sizeof(unsigned char));
+  if (!table->names || !table->name_offsets || !table->name_lens ||
+      !table->uncomp_sizes || !table->comp_sizes || !table->header_offsets ||
+      !table->crc32s || !table->methods || !table->mtimes || !table->isdirs) {
+    goto cleanup;
+  }
+
+  for (i = 0; i < n; ++i) {
+    const mz_uint8 *pHeader = &MZ_ZIP_ARRAY_ELEMENT(
+        &pState->m_central_dir, mz_uint8,
+        MZ_ZIP_ARRAY_ELEMENT(&pState->m_central_dir_offsets, mz_uint32, i));
+    mz_uint namelen = MZ_READ_LE16(pHeader + MZ_ZIP_CDH_FILENAME_LEN_OFS);
+    const char *pFilename =
+        (const char *)pHeader + MZ_ZIP_CENTRAL_DIR_HEADER_SIZE;
+    char *name = table->names + names_size;
+    mz_uint16 t = MZ_READ_LE16(pHeader + MZ_ZIP_CDH_FILE_TIME_OFS);
+    mz_uint16 d = MZ_READ_LE16(pHeader + MZ_ZIP_CDH_FILE_DATE_OFS);
+    mz_uint j;
+
+    // Same as zip_entry_openbyindex, names are cut at the first '\0'.
+    for (j = 0; j < namelen && pFilename[j]; ++j) {
+      name[j] = pFilename[j] == '\\' ? '/' : pFilename[j];
+    }
+    name[j] = '\0';
+    table->name_offsets[i] = names_size;
+    table->name_lens[i] = (unsigned short)j;
+    names_size += j + 1;
+
+    table->isdirs[i] =
+        (j > 0 && name[j - 1] == '/') ||
+        (MZ_READ_LE32(pHeader + MZ_ZIP_CDH_EXTERNAL_ATTR_OFS) & 0x10) != 0;
+    table->methods[i] = MZ_READ_LE16(pHeader + MZ_ZIP_CDH_METHOD_OFS);
+    table->crc32s[i] = MZ_READ_LE32(pHeader + MZ_ZIP_CDH_CRC32_OFS);
+    table->comp_sizes[i] =
+        MZ_READ_LE32(pHeader + MZ_ZIP_CDH_COMPRESSED_SIZE_OFS);
+    table->uncomp_sizes[i] =
+        MZ_READ_LE32(pHeader + MZ_ZIP_CDH_DECOMPRESSED_SIZE_OFS);
+    table->header_offsets[i] =
+        MZ_READ_LE32(pHeader + MZ_ZIP_CDH_LOCAL_HEADER_OFS);
+
+    // Entries written together mostly share their timestamps, and converting
+    // one takes a mktime(3).
+    if (i == 0 || t != dos_time || d != dos_date) {
+      dos_time = t;
+      dos_date = d;
+      m_time = mz_zip_dos_to_time_t(t, d);
+    }
+    table->mtimes[i] = m_time;
+  }
+  table->names_size = names_size;
+
+  return table;
+
+cleanup:
+  zip_entry_table_free(table);
+  return NULL;
+}
+
+void zip_entry_table_free(struct zip_entry_table_t *table) {
+  if (!table) {
+    return;
+  }
+
+  if (table->mapped) {
+    // The arrays belong to the mapping.
+    free(table);
+    return;
+  }
+
+  CLEANUP(table->names);
+  CLEANUP(table->name_offsets);
+  CLEANUP(table->name_lens);
+  CLEANUP(table->uncomp_sizes);
+  CLEANUP(table->comp_sizes);
+  CLEANUP(table->header_offsets);
+  CLEANUP(table->crc32s);
+  CLEANUP(table->methods);
+  CLEANUP(table->mtimes);
+  CLEANUP(table->isdirs);
+  free(table);
+}
+
+struct zip_entry_table_t *
+zip_entry_table_merge(struct zip_entry_table_t *const *tables,
+                      const char *const *prefixes, size_t n) {
+  struct zip_entry_table_t *table = NULL;
+  size_t num_entries = 0, names_size = 0, i, j, k = 0;
+
+  for (i = 0; i < n; ++i) {
+    size_t prefix_len =
+        prefixes && prefixes[i] ? strlen(prefixes[i]) + 1 : 0;
+    num_entries += tables[i]->num_entries;
+    names_size +=
+        tables[i]->names_size + tables[i]->num_entries * prefix_len;
+  }
+
+  table = (struct zip_entry_table_t *)calloc(1, sizeof(*table));
+  if (!table) {
+    return NULL;
+  }
+
+  table->num_entries = num_entries;
+  table->names = (char *)malloc(names_size + 1);
+  table->name_offsets =
+      (size_t *)malloc((num_entries + 1) * sizeof(size_t));
+  table->name_lens =
+      (unsigned short *)malloc((num_entries + 1) * sizeof(unsigned short));
+  table->uncomp_sizes = (unsigned long long *)malloc(
+      (num_entries + 1) * sizeof(unsigned long long));
+  table->comp_sizes = (unsigned long long *)malloc(
+      (num_entries + 1) * sizeof(unsigned long long));
+  table->header_offsets = (unsigned long long *)malloc(
+      (num_entries + 1) * sizeof(unsigned long long));
+  table->crc32s =
+      (unsigned int *)malloc((num_entries + 1) * sizeof(unsigned int));
+  table->methods =
+      (unsigned short *)malloc((num_entries + 1) * sizeof(unsigned short));
+  table->mtimes = (time_t *)malloc((num_entries + 1) * sizeof(time_t));
+  table->isdirs =
+      (unsigned char *)malloc((num_entries + 1) * sizeof(unsigned char));
+  if (!table->names || !table->name_offsets || !table->name_lens ||
+      !table->uncomp_sizes || !table->comp_sizes || !table->header_offsets ||
+      !table->crc32s || !table->methods || !table->mtimes || !table->isdirs) {
+    goto cleanup;
+  }
+
+  names_size = 0;
+  for (i = 0; i < n; ++i) {
+    const struct zip_entry_table_t *from = tables[i];
+    const char *prefix = prefixes && prefixes[i] ? prefixes[i] : "";
+    size_t prefix_len = strlen(prefix);
+
+    for (j = 0; j < from->num_entries; ++j, ++k) {
+      const char *name = zip_entry_table_name(from, j);
+      size_t len = from->name_lens[j];
+      char *to = table->names + names_size;
+      size_t to_len = 0;
+
+      // Names are relative to the prefix even with leading slashes, and
+      // left empty, which ignores the entry, if they get too long.
+      if (prefix_len > 0) {
+        while (len > 0 && *name == '/') {
+          ++name;
+          --len;
+        }
+        if (prefix_len + 1 + len <= 0xffff) {
+          memcpy(to, prefix, prefix_len);
+          to[prefix_len] = '/';
+          to_len = prefix_len + 1;
+        } else {
+          len = 0;
+        }
+      }
+      memcpy(to + to_len, name, len);
+      to_len += len;
+      to[to_len] = '\0';
+      table->name_offsets[k] = names_size;
+      table->name_lens[k] = (unsigned short)to_len;
+      names_size += to_len + 1;
+
+      table->uncomp_sizes[k] = from->uncomp_sizes[j];
+      table->comp_sizes[k] = from->comp_sizes[j];
+      table->header_offsets[k] = from->header_offsets[j];
+      table->crc32s[k] = from->crc32s[j];
+      table->methods[k] = from->methods[j];
+      table->mtimes[k] = from->mtimes[j];
+      table->isdirs[k] = from->isdirs[j];
+    }
+  }
+  table->names_size = names_size;
+
+  return table;
+
+cleanup:
+  zip_entry_table_free(table);
+  return NULL;
+}
+
+unsigned int zip_central_dir_crc32(struct zip_t *zip) {
+  mz_zip_archive *pzip = NULL;
+
+  if (!zip) {
+    // zip_t handler is not initialized
+    return 0;
+  }
+
+  pzip = &(zip->archive);
+  if (pzip->m_zip_mode != MZ_ZIP_MODE_READING || !pzip->m_pState) {
+    // the central directory is only read in readonly mode
+    return 0;
+  }
+
+  return crc_update(0, pzip->m_pState->m_central_dir.m_p,
+                    pzip->m_pState->m_central_dir.m_size);
+}
+
 int zip_create(const char *zipname, const char *filenames[], size_t len) {
   int status = 0;
   size_t i;
@@ -14,6 +14,7 @@
 
 #include <string.h>
 #include <sys/types.h>
+#include <time.h>
 
 #ifdef __cplusplus
 extern "C" {
@@ -84,6 +85,56 @@ struct zip_t;
  */
 extern struct zip_t *zip_open(const char *zipname, int level, char mode);
 
+/**
+ * Opens zip archive stream held in memory.
+ *
+ * The memory is not copied, and must stay valid until the handler and all of
+ * its duplicates are closed.
+ *
+ * @param stream zip archive stream.
+ * @param size stream size (in bytes).
+ * @param level compression level (0-9 are the standard zlib-style levels).
+ * @param mode file access mode.
+ *        - 'r': opens a stream for reading/extracting, which is the only
+ *               supported mode.
+ *
+ * @return the zip archive handler or NULL on error
+ */
+extern struct zip_t *zip_stream_open(const char *stream, size_t size,
+                                     int level, char mode);
+
+/**
+ * Opens an archive for reading through a callback, such as from a remote
+ * server or from a range of another file.
+ *
+ * @param read reads up to size bytes at an offset of the archive, returning
+ *        the number of bytes read, which must be safe to call concurrently
+ *        from duplicated handlers.
+ * @param opaque passed to read.
+ * @param size size of the archive.
+ *
+ * @return the zip archive handler or NULL on error
+ */
+extern struct zip_t *zip_reader_open(size_t (*read)(void *opaque,
+                                                    unsigned long long offset,
+                                                    void *buf, size_t size),
+                                     void *opaque, unsigned long long size);
+
+/**
+ * Opens another handler of an archive opened in 'r' mode.
+ *
+ * The new handler has its own file stream and current entry, so that it can be
+ * used concurrently with the original one, but it shares the central directory
+ * of the original handler, which must be closed last.
+ *
+ * @param zip zip archive handler opened in 'r' mode.
+ * @param zipname zip archive file name, unused if the archive is held in
+ *        memory.
+ *
+ * @return the zip archive handler or NULL on error
+ */
+extern struct zip_t *zip_dup(struct zip_t *zip, const char *zipname);
+
 /**
  * Closes the zip archive, releases resources - always finalize.
  *
@@ -106,7 +157,8 @@ extern int zip_is64(struct zip_t *zip);
  *
  * For zip archive opened in 'w' or 'a' mode the function will append
  * a new entry. In readonly mode the function tries to locate the entry
- * in global dictionary.
+ * in global dictionary, with a binary search over the names, which are sorted
+ * on the first lookup by name rather than when the archive is opened.
  *
  * @param zip zip archive handler.
  * @param entryname an entry name in local dictionary.
@@ -189,6 +241,72 @@ extern unsigned long long zip_entry_size(struct zip_t *zip);
  */
 extern unsigned int zip_entry_crc32(struct zip_t *zip);
 
+/**
+ * Returns a compressed size of the current zip entry.
+ *
+ * @param zip zip archive handler.
+ *
+ * @return the compressed size in bytes.
+ */
+extern unsigned long long zip_entry_comp_size(struct zip_t *zip);
+
+/**
+ * Returns the last modification time of the current zip entry.
+ *
+ * @param zip zip archive handler.
+ *
+ * @return the time in local time, as stored by the archive.
+ */
+extern time_t zip_entry_mtime(struct zip_t *zip);
+
+/**
+ * Returns the compression method of the current zip entry.
+ *
+ * @param zip zip archive handler.
+ *
+ * @return the method (0 for stored, 8 for deflated), negative number (< 0) on
+ *         error.
+ */
+extern int zip_entry_method(struct zip_t *zip);
+
+/**
+ * Returns the offset of the data of the current zip entry in the archive,
+ * right after its local header.
+ *
+ * This function is only valid if zip archive was opened in 'r' (readonly) mode.
+ *
+ * @param zip zip archive handler.
+ *
+ * @return the offset in bytes, negative number (< 0) on error.
+ */
+extern long long zip_entry_data_offset(struct zip_t *zip);
+
+/**
+ * Returns the archive stream of a handler opened by zip_stream_open.
+ *
+ * @param zip zip archive handler.
+ *
+ * @return the stream, or NULL if the archive is not held in memory.
+ */
+extern const void *zip_archive_mem(struct zip_t *zip);
+
+/**
+ * Reads raw bytes of the archive file.
+ *
+ * This function is only valid if zip archive was opened in 'r' (readonly) mode.
+ *
+ * @param zip zip archive handler.
+ * @param offset offset in the archive.
+ * @param buf output buffer.
+ * @param bufsize output buffer size (in bytes).
+ *
+ * @return the return code - the number of bytes actually read on success,
+ *         which is only less than bufsize at the end of the archive.
+ *         Otherwise a -1 on error.
+ */
+extern ssize_t zip_archive_read(struct zip_t *zip, unsigned long long offset,
+                                void *buf, size_t bufsize);
+
 /**
  * Compresses an input buffer for the current zip entry.
  *
@@ -210,6 +328,47 @@ extern int zip_entry_write(struct zip_t *zip, const void *buf, size_t bufsize);
  */
 extern int zip_entry_fwrite(struct zip_t *zip, const char *filename);
 
+/**
+ * Sets the alignment of the data of the entries written next, which are
+ * preceded by zeros as needed.
+ *
+ * @param zip zip archive handler opened in 'w' mode.
+ * @param alignment alignment in bytes, a power of 2, or 0 for none.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_set_alignment(struct zip_t *zip, unsigned int alignment);
+
+/**
+ * Copies an entry of another zip archive as the next entry, with its name,
+ * modification time and attributes.
+ *
+ * The compressed data is copied as is, unless flush_size is set and the entry
+ * is deflated. In that case it is deflated anew at the level of the archive,
+ * with a full flush every flush_size bytes of uncompressed data, after which
+ * inflating can start over with an empty dictionary at the next byte of
+ * compressed data. Each such point but the end of the entry is passed to
+ * on_flush.
+ *
+ * @param zip zip archive handler opened in 'w' mode.
+ * @param src zip archive handler opened in 'r' mode.
+ * @param index index of the entry in src.
+ * @param flush_size distance between full flushes, or 0 to copy as is.
+ * @param on_flush callback function, or NULL, taking the offsets of the point
+ *        in the uncompressed and the compressed data, along with the CRC-32
+ *        of the uncompressed data before it, and returning 0 to go on.
+ * @param arg opaque pointer passed to on_flush.
+ *
+ * @return the return code - 0 on success, negative number (< 0) on error.
+ */
+extern int zip_entry_copy(struct zip_t *zip, struct zip_t *src, int index,
+                          size_t flush_size,
+                          int (*on_flush)(void *arg,
+                                          unsigned long long uncomp_offset,
+                                          unsigned long long comp_offset,
+                                          unsigned int crc32),
+                          void *arg);
+
 /**
  * Extracts the current zip entry into output buffer.
  *
@@ -282,6 +441,86 @@ zip_entry_extract(struct zip_t *zip,
  */
 extern int zip_total_entries(struct zip_t *zip);
 
+/**
+ * @struct zip_entry_table_t
+ *
+ * Properties of all entries in the zip archive, read straight from the central
+ * directory into one array per property, indexed by entry index.
+ */
+struct zip_entry_table_t {
+  size_t num_entries;
+  // Names with backslashes replaced by slashes, each terminated by '\0', all
+  // packed into a single buffer.
+  char *names;
+  size_t names_size;
+  size_t *name_offsets;
+  unsigned short *name_lens;
+  unsigned long long *uncomp_sizes;
+  unsigned long long *comp_sizes;
+  unsigned long long *header_offsets;
+  unsigned int *crc32s;
+  unsigned short *methods;
+  time_t *mtimes;
+  unsigned char *isdirs;
+  // Set if the arrays are mapped from a sidecar file rather than allocated.
+  int mapped;
+};
+
+/**
+ * Reads the properties of all entries of the zip archive at once, without
+ * opening any of them.
+ *
+ * @param zip zip archive handler opened in 'r' mode.
+ *
+ * @return the entry table, or NULL on error.
+ */
+extern struct zip_entry_table_t *zip_entry_table_create(struct zip_t *zip);
+
+/**
+ * Releases the entry table.
+ *
+ * @param table entry table created by zip_entry_table_create.
+ */
+extern void zip_entry_table_free(struct zip_entry_table_t *table);
+
+/**
+ * Returns the name of an entry of the table.
+ *
+ * @param table entry table created by zip_entry_table_create.
+ * @param index index of the entry.
+ *
+ * @return the name, terminated by '\0'.
+ */
+static inline const char *
+zip_entry_table_name(const struct zip_entry_table_t *table, size_t index) {
+  return table->names + table->name_offsets[index];
+}
+
+/**
+ * Concatenates entry tables into one, in which the entries of each table
+ * follow the ones of the tables before it.
+ *
+ * @param tables entry tables created by zip_entry_table_create.
+ * @param prefixes directory prepended to the names of each table, or NULL
+ *        for none, or NULL for none at all.
+ * @param n number of tables.
+ *
+ * @return the merged entry table, or NULL on error.
+ */
+extern struct zip_entry_table_t *
+zip_entry_table_merge(struct zip_entry_table_t *const *tables,
+                      const char *const *prefixes, size_t n);
+
+/**
+ * Computes the CRC-32 checksum of the whole central directory, which changes
+ * with any entry added, removed or rewritten.
+ *
+ * @param zip zip archive handler opened in 'r' mode.
+ *
+ * @return the checksum, or 0 on error.
+ */
+extern unsigned int zip_central_dir_crc32(struct zip_t *zip);
+
 /**
  * Creates a new archive and puts files into a single zip archive.
  *
@@ -1,444 +1,2592 @@
-#define FUSE_USE_VERSION 26
+#define FUSE_USE_VERSION 31
 
-#include <assert.h>
 #include <errno.h>
 #include <fcntl.h>
-#include <fuse.h>
+#include <fuse_lowlevel.h>
 #include <inttypes.h>
+#include <limits.h>
 #include <pthread.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/mman.h>
 #include <sys/stat.h>
 #include <sys/syslimits.h>
+#include <sys/uio.h>
+#include <unistd.h>
 
+#include "cache.h"
+#include "crc.h"
+#include "decode.h"
 #include "fuse_opt.h"
+#include "inflate.h"
+#include "io.h"
+#include "log.h"
+#include "parallel.h"
+#include "pool.h"
+#include "prefetch.h"
+#include "reader.h"
+#include "remote.h"
+#include "seek.h"
+#include "seekable.h"
+#include "sidecar.h"
+#include "size.h"
+#include "slab.h"
+#include "stats.h"
+#include "stream.h"
+#include "tree.h"
 #include "zip.h"
 
-#define VAL(x) #x
-#define STR(x) VAL(x)
+// An archive served by the mount. Several archives are served from one entry
+// table, into which theirs are merged, so that the tree, the cache and the
+// workers are shared, and entries are numbered across all of them. Only
+// reading from the archives themselves is done per archive.
+struct zipfs_archive_t {
+    char path[PATH_MAX];
+    // Directory the archive is served in, or NULL for the root.
+    char *prefix;
+    // Set for an archive stored in another one, at an offset in the file of
+    // the outer archive, whose descriptor and mapping it shares.
+    int nested;
+    unsigned long long offset;
+    // Index of the first entry of the archive in the entry table.
+    int first_index;
+    // Entry table of the archive alone, until merged.
+    struct zip_entry_table_t *table;
+    struct zip_t *zip;
+    // Separate descriptor of the file, for reading stored entries directly.
+    int fd;
+    // The whole archive when mapped into memory by --mmap.
+    void *map;
+    size_t map_size;
+    // Set for an archive at a URL, which is read through its chunk cache
+    // instead of fd, which is -1.
+    struct remote_t *remote;
+    // Set for an archive read with --io-uring or --o-direct, whose handlers
+    // all read through it instead of a stream each.
+    struct io_t *io;
+    struct reader_pool_t *readers;
+};
+
+static struct zipfs_archive_t *archives;
+static size_t num_archives;
+static size_t cap_archives;
+
+// Properties of all entries, which the paths of the tree point into.
+static struct zip_entry_table_t *entries;
+
+#define DEFAULT_CACHE_SIZE "256M"
+#define NUM_CACHE_SHARDS 16
+static struct cache_t *cache;
+
+#define DEFAULT_NUM_READERS 1
+
+// Chunks of archives at URLs are cached on disk, within a budget per archive.
+#define DEFAULT_REMOTE_CACHE "/var/tmp/zipfs"
+#define DEFAULT_REMOTE_CACHE_SIZE "1G"
+static size_t remote_cache_size;
+
+static struct tree_t *tree;
+
+// With --lazy, the entry table and the tree are filled in by a background
+// thread, in batches of entries, while requests are already served. Until it
+// is done, the tree is only accessed with tree_lock held, and requests which
+// need to see every entry wait for it.
+#define LAZY_BATCH_SIZE 4096
+static pthread_rwlock_t tree_lock;
+static pthread_mutex_t tree_built_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t tree_built_cond = PTHREAD_COND_INITIALIZER;
+static int tree_built = 1;
+static int tree_build_ret;
+static pthread_t tree_builder;
+static int tree_builder_started;
+
+// Decompression off the threads serving requests runs on a pool of workers,
+// by default as many as prefetching, --parallel and --preload-small need, and
+// optionally pinned to CPUs with --worker-cpus.
+static struct pool_t *pool;
+
+// Entries following the ones opened in sequence are extracted into the cache
+// in the background, up to so many at a time. Only entries which fit well into
+// a cache shard are, and they may take up to a quarter of the cache.
+#define DEFAULT_PREFETCH_DEPTH 8
+#define NUM_PREFETCH_THREADS 2
+static struct prefetch_t *prefetch;
+static size_t prefetch_max_size;
+
+// With --preload-small, compressed entries up to a size are extracted into a
+// slab by so many workers once mounted, taking memory on top of the cache, and
+// served from there with neither a reader nor the cache.
+#define NUM_PRELOAD_THREADS 4
+static struct slab_t *slab;
+static size_t preload_max_size;
+
+// The archive never changes while mounted, so the kernel can cache names,
+// attributes and data for as long as it wants.
+#define DEFAULT_TIMEOUT 86400
+
+// Deflated entries of at least this size are inflated incrementally by each
+// open file, instead of being extracted into the cache as a whole. The data is
+// cached in blocks, which are shared by all files open on the same entry.
+// Larger entries would not be prefetched by default anyway.
+#define DEFAULT_STREAM_MIN_SIZE "8M"
+#define DEFAULT_STREAM_WINDOW_SIZE "1M"
+#define BLOCK_SIZE (1 << 20)
+#define MAX_READ_BLOCKS 8
+static size_t stream_min_size;
+static size_t stream_window_size;
+
+// Streamed entries keep points every so many bytes at which inflating can be
+// resumed, optionally persisted to a sidecar file.
+#define DEFAULT_INDEX_SPACING "4M"
+static struct seek_table_t *seeks;
+
+// With --parallel, workers inflate the segments of a streamed entry following
+// the block being read, each resuming at a seek point of its own, once the
+// index of the entry is complete. A segment spans the points up to at least
+// PARALLEL_SEGMENT_SIZE bytes, and so many segments per worker are queued
+// ahead, within a quarter of the cache.
+#define PARALLEL_SEGMENT_SIZE (16 << 20)
+#define PARALLEL_SEGMENTS_PER_WORKER 2
+static struct parallel_t *parallel;
+static unsigned long long parallel_ahead_size;
+
+// With --index, the entry table, the tree and the seek indexes are mapped from
+// a sidecar file if it matches the archive, and written to it otherwise.
+static struct sidecar_key_t sidecar_key;
+static struct sidecar_t *sidecar;
+
+// A hidden directory in the root, which is not listed, holds read-only files
+// with the state of the mount, generated when opened. Their inode numbers come
+// after all the ones of the tree. An entry of the archive with the same name
+// hides the directory.
+#define CTL_DIR_NAME ".zipfs"
+#define CTL_STATS_NAME "stats"
+#define CTL_DIR_INO (1ULL << 32)
+#define CTL_STATS_INO (CTL_DIR_INO + 1)
+// Attributes of the root, which the control files are owned like, copied
+// before the builder of the tree starts moving the nodes about.
+static struct stat ctl_root_st;
+
+// State of an open file, so that reads do not have to look up the entry again.
+struct zipfs_file_t {
+    // Index of the entry, or -1 for a control file, whose content is buf.
+    int index;
+    // Data of an entry preloaded into the slab, or NULL.
+    const char *preloaded;
+    struct zipfs_archive_t *archive;
+    struct stream_t *stream;
+    // Frames of a zstd entry in the seekable format, served in blocks like
+    // streams.
+    struct seekable_t *seekable;
+    // Offset in the archive of the data of a stored entry, or -1.
+    long long stored_offset;
+    unsigned long long size;
+    // Cache entry of a cached entry once loaded, which stays valid without a
+    // reference of its own since the entry is pinned while the file is open.
+    struct cache_entry_t *entry;
+    // Block of a streamed entry read last, which the next read most likely
+    // continues in, referenced by the file.
+    struct cache_entry_t *block;
+    // Index of a streamed entry which is inflated ahead by the parallel
+    // workers, or NULL.
+    struct stream_index_t *parallel_index;
+    // Block from which the next segment is queued to the workers.
+    pthread_mutex_t ahead_mutex;
+    unsigned long long ahead;
+    // Output buffer of reads of a streamed entry spanning more than
+    // MAX_READ_BLOCKS blocks, reused by every such read.
+    pthread_mutex_t buf_mutex;
+    char *buf;
+    size_t buf_size;
+};
+
+static struct zipfs_options {
+    char *cache_size;
+    size_t num_readers;
+    char *stream_min_size;
+    char *stream_window_size;
+    char *index_file;
+    char *index_spacing;
+    int build_index;
+    int mmap;
+    double attr_timeout;
+    double entry_timeout;
+    int no_keep_cache;
+    size_t prefetch_depth;
+    int lazy;
+    int no_verify_crc;
+    size_t parallel;
+    int merge;
+    int nested;
+    char *remote_cache;
+    char *remote_cache_size;
+    char *preload_small;
+    int io_uring;
+    int o_direct;
+    size_t num_workers;
+    char *worker_cpus;
+} zipfs_options = {.attr_timeout = DEFAULT_TIMEOUT,
+                   .entry_timeout = DEFAULT_TIMEOUT,
+                   .prefetch_depth = DEFAULT_PREFETCH_DEPTH};
+
+#define ZIPFS_OPTION(t, p)                                                     \
+    { t, offsetof(struct zipfs_options, p), 1 }
+static const struct fuse_opt option_spec[] = {
+    ZIPFS_OPTION("--cache-size=%s", cache_size),
+    ZIPFS_OPTION("--readers=%zu", num_readers),
+    ZIPFS_OPTION("--stream-min=%s", stream_min_size),
+    ZIPFS_OPTION("--stream-window=%s", stream_window_size),
+    ZIPFS_OPTION("--index=%s", index_file),
+    ZIPFS_OPTION("--index-spacing=%s", index_spacing),
+    ZIPFS_OPTION("--build-index", build_index),
+    ZIPFS_OPTION("--mmap", mmap),
+    ZIPFS_OPTION("--attr-timeout=%lf", attr_timeout),
+    ZIPFS_OPTION("--entry-timeout=%lf", entry_timeout),
+    ZIPFS_OPTION("--no-keep-cache", no_keep_cache),
+    ZIPFS_OPTION("--prefetch=%zu", prefetch_depth),
+    ZIPFS_OPTION("--lazy", lazy),
+    ZIPFS_OPTION("--no-verify-crc", no_verify_crc),
+    ZIPFS_OPTION("--parallel=%zu", parallel),
+    ZIPFS_OPTION("--union", merge),
+    ZIPFS_OPTION("--nested", nested),
+    ZIPFS_OPTION("--remote-cache=%s", remote_cache),
+    ZIPFS_OPTION("--remote-cache-size=%s", remote_cache_size),
+    ZIPFS_OPTION("--preload-small=%s", preload_small),
+    ZIPFS_OPTION("--io-uring", io_uring),
+    ZIPFS_OPTION("--o-direct", o_direct),
+    ZIPFS_OPTION("--workers=%zu", num_workers),
+    ZIPFS_OPTION("--worker-cpus=%s", worker_cpus), FUSE_OPT_END};
+
+static void show_help(const char *progname) {
+    printf("usage: %s <zip-file>... <mountpoint> [options]\n\n", progname);
+    printf("file-system specific options:\n"
+            "    --cache-size        Memory budget for decompressed zip "
+            "entries, with\n"
+            "                        an optional K, M or G suffix (default: "
+            "" DEFAULT_CACHE_SIZE ")\n"
+            "    --readers           Number of zip entries which can be "
+            "decompressed\n"
+            "                        in parallel (default: " STR(
+                DEFAULT_NUM_READERS) ", plus one per "
+            "worker)\n"
+            "    --stream-min        Minimal size of deflated and seekable "
+            "zstd zip\n"
+            "                        entries which are decoded into cached "
+            "blocks\n"
+            "                        instead of as a whole (default: "
+            "" DEFAULT_STREAM_MIN_SIZE ")\n"
+            "    --stream-window     Size of the window of decompressed data "
+            "kept per\n"
+            "                        open file for incremental inflating "
+            "(default: " DEFAULT_STREAM_WINDOW_SIZE ")\n"
+            "    --index             Sidecar file to map the directory tree, "
+            "entry\n"
+            "                        table and seek indexes from, written "
+            "whenever it\n"
+            "                        does not match the archive or indexes "
+            "changed\n"
+            "    --index-spacing     Distance between seek points of "
+            "streamed entries\n"
+            "                        (default: " DEFAULT_INDEX_SPACING ")\n"
+            "    --build-index       Index all streamed entries before "
+            "mounting,\n"
+            "                        instead of on first read\n"
+            "    --mmap              Map the zip file into memory instead of "
+            "reading it\n"
+            "    --attr-timeout      Seconds for which the kernel caches "
+            "attributes\n"
+            "                        (default: " STR(DEFAULT_TIMEOUT) ")\n"
+            "    --entry-timeout     Seconds for which the kernel caches "
+            "names\n"
+            "                        (default: " STR(DEFAULT_TIMEOUT) ")\n"
+            "    --no-keep-cache     Drop cached data and directory listings "
+            "of the\n"
+            "                        kernel when files are opened again\n"
+            "    --prefetch          Maximal number of entries extracted "
+            "ahead when\n"
+            "                        entries are opened in sequence, 0 to "
+            "disable\n"
+            "                        (default: " STR(
+                DEFAULT_PREFETCH_DEPTH) ")\n"
+            "    --lazy              Mount right away and read the central "
+            "directory\n"
+            "                        in the background, ignored with "
+            "--build-index\n"
+            "    --no-verify-crc     Skip checking CRC-32 checksums of "
+            "decompressed\n"
+            "                        entries, for archives verified "
+            "otherwise\n"
+            "    --parallel          Number of workers inflating streamed "
+            "entries ahead\n"
+            "                        of their reader, from the seek points "
+            "of a\n"
+            "                        complete index, 0 to disable (default: "
+            "0)\n"
+            "    --union             Serve several zip files merged into "
+            "one tree, in\n"
+            "                        which a path is served from the first "
+            "zip file\n"
+            "                        having it, instead of each in a "
+            "directory named\n"
+            "                        after it\n"
+            "    --nested            Serve zip files stored in zip files "
+            "as directories\n"
+            "                        in their place, reading them in place\n"
+            "    --remote-cache      Directory of the chunks of zip files at "
+            "URLs\n"
+            "                        cached on disk (default: "
+            "" DEFAULT_REMOTE_CACHE ")\n"
+            "    --remote-cache-size Disk budget for the chunks of each zip "
+            "file at a\n"
+            "                        URL, with an optional K, M or G suffix\n"
+            "                        (default: " DEFAULT_REMOTE_CACHE_SIZE ")\n"
+            "    --preload-small     Extract compressed zip entries up to "
+            "this size,\n"
+            "                        with an optional K, M or G suffix, "
+            "into memory\n"
+            "                        in the background once mounted, "
+            "outside the\n"
+            "                        cache, ignored with --lazy\n"
+            "    --io-uring          Read compressed data through an "
+            "io_uring shared\n"
+            "                        by all readers, so that their reads "
+            "are in flight\n"
+            "                        at once, falling back to pread\n"
+            "    --o-direct          Read compressed data with O_DIRECT, "
+            "bypassing the\n"
+            "                        page cache\n"
+            "    --workers           Number of workers decompressing for "
+            "prefetching,\n"
+            "                        --parallel and --preload-small "
+            "(default: " STR(NUM_PREFETCH_THREADS) "\n"
+            "                        with prefetching, plus the number "
+            "given to\n"
+            "                        --parallel, plus " STR(
+                NUM_PRELOAD_THREADS) " with --preload-small)\n"
+            "    --worker-cpus       Comma separated CPUs and ranges of "
+            "CPUs such as\n"
+            "                        0-3,8 to pin the workers to in turn\n"
+            "\n"
+            "A zip file may be an http://, https:// or s3:// URL, read with "
+            "range\n"
+            "requests, if built with REMOTE=1. s3:// URLs are signed with "
+            "the AWS_*\n"
+            "credentials of the environment. Zip files stored in them are "
+            "not served\n"
+            "as directories.\n"
+            "\n"
+            "Several zip files share the cache, readers aside, and the "
+            "workers. They\n"
+            "ignore --lazy and --index, and so does --nested.\n"
+            "\n"
+            "Statistics in the Prometheus text format are read from "
+            "/" CTL_DIR_NAME "/" CTL_STATS_NAME "\n"
+            "under the mountpoint.\n"
+            "\n"
+            "general options:\n");
+    fuse_cmdline_help();
+    fuse_lowlevel_help();
+}
+
+// Parses a comma separated list of CPUs and ranges of CPUs.
+static int parse_cpus(const char *str, int **cpus, size_t *num_cpus) {
+    *cpus = NULL;
+    *num_cpus = 0;
+    while (*str != '\0') {
+        char *end;
+        errno = 0;
+        long first = strtol(str, &end, 10);
+        long last = first;
+        if (errno == 0 && end != str && *end == '-') {
+            str = end + 1;
+            last = strtol(str, &end, 10);
+        }
+        if (errno != 0 || end == str || first < 0 || last < first ||
+            last >= POOL_MAX_CPUS || (*end != ',' && *end != '\0')) {
+            free(*cpus);
+            return -1;
+        }
+
+        int *grown = (int *)realloc(
+            *cpus, (*num_cpus + (size_t)(last - first) + 1) * sizeof(int));
+        if (grown == NULL) {
+            perror("realloc()");
+            free(*cpus);
+            return -1;
+        }
+        *cpus = grown;
+        for (long cpu = first; cpu <= last; ++cpu) {
+            (*cpus)[(*num_cpus)++] = (int)cpu;
+        }
+        str = *end == ',' ? end + 1 : end;
+    }
+    return *num_cpus > 0 ? 0 : -1;
+}
+
+static int zipfs_map(struct zipfs_archive_t *archive, size_t size) {
+    archive->map_size = size;
+    archive->map =
+        mmap(NULL, archive->map_size, PROT_READ, MAP_SHARED, archive->fd, 0);
+    if (archive->map == MAP_FAILED) {
+        perror("mmap()");
+        archive->map = NULL;
+        return -1;
+    }
+    debug_eprintfln("ZIP file of %zu bytes mapped", archive->map_size);
+    return 0;
+}
+
+// Tells the kernel how a range of the mapped archive is going to be read, or
+// of the file read through io. The chunks of a range of a remote archive
+// about to be read are fetched instead, in one go.
+static void zipfs_advise(struct zipfs_archive_t *archive,
+                         unsigned long long offset, unsigned long long size,
+                         int advice) {
+    if (archive->remote != NULL && advice == MADV_WILLNEED) {
+        if (remote_prefetch(archive->remote, offset, size) != 0) {
+            debug_eprintfln("Prefetch at offset %llu error", offset);
+        }
+        return;
+    }
+    if (archive->io != NULL) {
+        io_advise(archive->io, offset, size,
+                  advice == MADV_WILLNEED ? POSIX_FADV_WILLNEED
+                                          : POSIX_FADV_SEQUENTIAL);
+        return;
+    }
+    if (archive->map == NULL) {
+        return;
+    }
+
+    unsigned long long page = sysconf(_SC_PAGESIZE);
+    unsigned long long start = offset & ~(page - 1);
+    if (madvise((char *)archive->map + start, offset + size - start,
+                advice) != 0) {
+        debug_eprintfln("madvise() at offset %llu error", offset);
+    }
+}
+
+// Returns the archive of an entry, along with the index of the entry in it.
+static struct zipfs_archive_t *zipfs_archive_get(int index, int *local) {
+    size_t lo = 0;
+    size_t hi = num_archives;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (archives[mid].first_index <= index) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    *local = index - archives[lo].first_index;
+    return &archives[lo];
+}
+
+static int zipfs_lock_init(void) {
+    pthread_rwlockattr_t attr;
+    pthread_rwlockattr_init(&attr);
+#ifdef __GLIBC__
+    // Otherwise a steady stream of requests keeps the builder out.
+    pthread_rwlockattr_setkind_np(&attr,
+                                  PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP);
+#endif
+    int ret = pthread_rwlock_init(&tree_lock, &attr);
+    pthread_rwlockattr_destroy(&attr);
+    if (ret != 0) {
+        errno = ret;
+        perror("pthread_rwlock_init()");
+        return -1;
+    }
+    return 0;
+}
+
+// Read-locks the tree if it is still being built, returning whether it did.
+static int zipfs_tree_lock(void) {
+    if (__atomic_load_n(&tree_built, __ATOMIC_ACQUIRE)) {
+        return 0;
+    }
+    pthread_rwlock_rdlock(&tree_lock);
+    return 1;
+}
+
+static void zipfs_tree_unlock(int locked) {
+    if (locked) {
+        pthread_rwlock_unlock(&tree_lock);
+    }
+}
+
+// Waits for the tree to be built, returning 0 if it has all entries.
+static int zipfs_tree_wait(void) {
+    if (!__atomic_load_n(&tree_built, __ATOMIC_ACQUIRE)) {
+        pthread_mutex_lock(&tree_built_mutex);
+        while (!__atomic_load_n(&tree_built, __ATOMIC_ACQUIRE)) {
+            pthread_cond_wait(&tree_built_cond, &tree_built_mutex);
+        }
+        pthread_mutex_unlock(&tree_built_mutex);
+    }
+    return tree_build_ret;
+}
+
+// Looks up a node by inode number, which may be done while the tree is being
+// built. Nodes are never moved, and only the times of directories change once
+// they are added.
+static struct tree_node_t *zipfs_tree_get(fuse_ino_t ino) {
+    int locked = zipfs_tree_lock();
+    struct tree_node_t *node = tree_get(tree, ino);
+    zipfs_tree_unlock(locked);
+    return node;
+}
+
+static int zipfs_tree_add(size_t begin, size_t end) {
+    pthread_rwlock_wrlock(&tree_lock);
+    int ret = tree_add_entries(tree, entries, begin, end);
+    pthread_rwlock_unlock(&tree_lock);
+    return ret;
+}
+
+static void *zipfs_tree_build(void *arg) {
+    (void)arg;
+
+    int ret = 0;
+    // Nothing but the builder uses the table until the tree is built, which
+    // is only done lazily for a single archive.
+    entries = zip_entry_table_create(archives[0].zip);
+    if (entries == NULL) {
+        eprintfln("Read central directory failed");
+        ret = -1;
+    }
+    for (size_t i = 0; ret == 0 && i < tree->num_entries;
+         i += LAZY_BATCH_SIZE) {
+        size_t end = i + LAZY_BATCH_SIZE < tree->num_entries
+                         ? i + LAZY_BATCH_SIZE
+                         : tree->num_entries;
+        ret = zipfs_tree_add(i, end);
+        if (ret != 0) {
+            eprintfln("Build directory tree failed");
+        }
+    }
+    if (ret == 0) {
+        debug_eprintfln("Tree with %zu nodes built", tree->num_nodes);
+    }
+
+    pthread_mutex_lock(&tree_built_mutex);
+    tree_build_ret = ret;
+    __atomic_store_n(&tree_built, 1, __ATOMIC_RELEASE);
+    pthread_cond_broadcast(&tree_built_cond);
+    pthread_mutex_unlock(&tree_built_mutex);
+
+    if (ret == 0 && zipfs_options.index_file != NULL) {
+        sidecar_save(zipfs_options.index_file, &sidecar_key, entries, tree,
+                     seeks);
+    }
+    return NULL;
+}
+
+static void zipfs_tree_join(void) {
+    if (tree_builder_started) {
+        pthread_join(tree_builder, NULL);
+        tree_builder_started = 0;
+    }
+}
+
+static void zipfs_init(void *userdata, struct fuse_conn_info *conn) {
+    (void)userdata;
+
+    // Listings carry the attributes of every entry, which are at hand anyway,
+    // so that the kernel needs no lookup of each of them afterwards.
+    if (conn->capable & FUSE_CAP_READDIRPLUS) {
+        conn->want |= FUSE_CAP_READDIRPLUS;
+        conn->want &= ~FUSE_CAP_READDIRPLUS_AUTO;
+    }
+
+    // Threads do not survive fuse_daemonize, which is done by now.
+    if (!tree_built) {
+        if (pthread_create(&tree_builder, NULL, zipfs_tree_build, NULL) != 0) {
+            perror("pthread_create()");
+            zipfs_tree_build(NULL);
+        } else {
+            tree_builder_started = 1;
+        }
+    }
+    if (pool != NULL && pool_start(pool) != 0) {
+        eprintfln("Start workers failed");
+    }
+    if (slab != NULL && slab_start(slab) != 0) {
+        eprintfln("Start preload workers failed");
+    }
+
+    debug_eprintfln("zipfs has initialized");
+}
+
+static void zipfs_destroy(void *userdata) {
+    (void)userdata;
+    debug_eprintfln("zipfs has been destroyed");
+}
+
+// Fills in the attributes of a control file or directory, returning 0 if the
+// inode is one.
+static int zipfs_ctl_stat(fuse_ino_t ino, struct stat *st) {
+    if (ino != CTL_DIR_INO && ino != CTL_STATS_INO) {
+        return -1;
+    }
+
+    // Owned by whoever owns the root.
+    *st = ctl_root_st;
+    st->st_ino = ino;
+    st->st_size = 0;
+    if (ino == CTL_DIR_INO) {
+        st->st_mode = S_IFDIR | 0555;
+        st->st_nlink = 2;
+    } else {
+        st->st_mode = S_IFREG | 0444;
+        st->st_nlink = 1;
+    }
+    return 0;
+}
+
+static void zipfs_ctl_lookup(fuse_req_t req, const char *name) {
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.attr_timeout = zipfs_options.attr_timeout;
+    e.entry_timeout = zipfs_options.entry_timeout;
+    if (strcmp(name, CTL_STATS_NAME) == 0) {
+        e.ino = CTL_STATS_INO;
+        zipfs_ctl_stat(e.ino, &e.attr);
+    }
+    fuse_reply_entry(req, &e);
+}
+
+static void zipfs_lookup(fuse_req_t req, fuse_ino_t parent, const char *name) {
+    if (parent == CTL_DIR_INO) {
+        zipfs_ctl_lookup(req, name);
+        return;
+    }
+
+    // The tree is immutable once built, hence no locking is needed then.
+    struct tree_node_t *dir = zipfs_tree_get(parent);
+    if (dir == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+    if (!S_ISDIR(dir->st.st_mode)) {
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
+
+    // Missing entries are replied with inode 0 as well, so that the kernel
+    // caches their absence too.
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.attr_timeout = zipfs_options.attr_timeout;
+    e.entry_timeout = zipfs_options.entry_timeout;
+
+    int locked = zipfs_tree_lock();
+    struct tree_node_t *node = tree_lookup_child(tree, dir, name);
+    if (node == NULL && locked) {
+        // The entry may not have been added yet.
+        zipfs_tree_unlock(locked);
+        locked = 0;
+        if (zipfs_tree_wait() != 0) {
+            fuse_reply_err(req, EIO);
+            return;
+        }
+        node = tree_lookup_child(tree, dir, name);
+    }
+    if (node != NULL) {
+        e.ino = node->st.st_ino;
+        e.attr = node->st;
+    } else if (dir->st.st_ino == FUSE_ROOT_INO &&
+               strcmp(name, CTL_DIR_NAME) == 0) {
+        e.ino = CTL_DIR_INO;
+        zipfs_ctl_stat(e.ino, &e.attr);
+    } else {
+        debug_eprintfln("Entry '%s' not found in '%s'", name,
+                        tree_node_path(tree, dir));
+    }
+    zipfs_tree_unlock(locked);
+    fuse_reply_entry(req, &e);
+}
+
+static void zipfs_getattr(fuse_req_t req, fuse_ino_t ino,
+                          struct fuse_file_info *fi) {
+    (void)fi;
+
+    struct stat ctl_st;
+    if (zipfs_ctl_stat(ino, &ctl_st) == 0) {
+        fuse_reply_attr(req, &ctl_st, zipfs_options.attr_timeout);
+        return;
+    }
+
+    int locked = zipfs_tree_lock();
+    struct tree_node_t *node = tree_get(tree, ino);
+    if (node == NULL) {
+        zipfs_tree_unlock(locked);
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    struct stat st = node->st;
+    debug_eprintfln("Size of entry '%s' is %lld", tree_node_path(tree, node),
+                    (long long)st.st_size);
+    zipfs_tree_unlock(locked);
+    fuse_reply_attr(req, &st, zipfs_options.attr_timeout);
+}
+
+// Reads from the remote file passed as opaque, for the handlers of a remote
+// archive, which may move along with archives while nested ones are opened.
+static size_t zipfs_remote_read(void *opaque, unsigned long long offset,
+                                void *buf, size_t size) {
+    ssize_t ret = remote_read((struct remote_t *)opaque, offset, buf, size);
+    return ret < 0 ? 0 : (size_t)ret;
+}
+
+// Reads from the file passed as opaque, for the handlers of an archive read
+// through io.
+static size_t zipfs_io_read(void *opaque, unsigned long long offset, void *buf,
+                            size_t size) {
+    ssize_t ret = io_read((struct io_t *)opaque, offset, buf, size);
+    return ret < 0 ? 0 : (size_t)ret;
+}
+
+// Reads from the file of the outer archive, for the handlers of the nested
+// archive whose index is passed as opaque, which all share its descriptor.
+// The index holds as archives grows, which it no longer does once serving.
+static size_t zipfs_nested_read(void *opaque, unsigned long long offset,
+                                void *buf, size_t size) {
+    const struct zipfs_archive_t *archive = &archives[(uintptr_t)opaque];
+    size_t done = 0;
+    while (done < size) {
+        ssize_t n = pread(archive->fd, (char *)buf + done, size - done,
+                          (off_t)(archive->offset + offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+// Reads from the archive passed as opaque.
+static size_t zipfs_archive_read(void *opaque, unsigned long long offset,
+                                 void *buf, size_t size) {
+    struct zipfs_archive_t *archive = (struct zipfs_archive_t *)opaque;
+    if (archive->remote != NULL) {
+        // Safe to read concurrently, without taking a reader.
+        return zipfs_remote_read(archive->remote, offset, buf, size);
+    }
+    if (archive->io != NULL) {
+        return zipfs_io_read(archive->io, offset, buf, size);
+    }
+
+    struct reader_t *reader = reader_acquire(archive->readers);
+    ssize_t ret = zip_archive_read(reader->zip, offset, buf, size);
+    reader_release(reader);
+    return ret < 0 ? 0 : (size_t)ret;
+}
+
+// Sets up incremental inflating if the entry is deflated, leaving the stream
+// NULL otherwise.
+static int zipfs_stream_create(int index, struct stream_t **stream) {
+    int ret = 0;
+    int local;
+    struct zipfs_archive_t *archive = zipfs_archive_get(index, &local);
+    struct reader_t *reader = reader_acquire(archive->readers);
+    struct zip_t *zip = reader->zip;
+
+    *stream = NULL;
+    if (zip_entry_openbyindex(zip, local) != 0) {
+        ret = -ENOENT;
+        goto unlock;
+    }
+
+    if (zip_entry_method(zip) != 8) {
+        debug_eprintfln("Entry with index %d is not deflated", index);
+        goto cleanup;
+    }
+
+    long long data_offset = zip_entry_data_offset(zip);
+    if (data_offset < 0) {
+        eprintfln("Locate data of entry with index %d error", index);
+        ret = -EIO;
+        goto cleanup;
+    }
+
+    // Streams without an index still work, only seeking is slower.
+    *stream = stream_create(stream_window_size, data_offset,
+                            zip_entry_comp_size(zip), zip_entry_size(zip),
+                            zip_entry_crc32(zip), seek_table_get(seeks, index));
+    if (*stream == NULL) {
+        ret = -ENOMEM;
+        goto cleanup;
+    }
+    if (zipfs_options.no_verify_crc) {
+        stream_no_verify(*stream);
+    }
+    if (archive->map != NULL) {
+        stream_map(*stream, (const char *)archive->map + data_offset);
+    }
+    zipfs_advise(archive, data_offset, zip_entry_comp_size(zip),
+                 MADV_SEQUENTIAL);
+    debug_eprintfln("Entry with index %d is streamed", index);
+
+cleanup:
+    zip_entry_close(zip);
+unlock:
+    reader_release(reader);
+    return ret;
+}
+
+// Locates the data of a stored entry, which is served from the archive as is.
+// Leaves stored_offset at -1 if the entry is not stored after all.
+static int zipfs_stored_locate(struct zipfs_file_t *file) {
+    int ret = 0;
+    int local;
+    zipfs_archive_get(file->index, &local);
+    struct reader_t *reader = reader_acquire(file->archive->readers);
+    struct zip_t *zip = reader->zip;
+
+    if (zip_entry_openbyindex(zip, local) != 0) {
+        ret = -ENOENT;
+        goto unlock;
+    }
+
+    // Encrypted entries are larger than their data.
+    if (zip_entry_method(zip) != 0 ||
+        zip_entry_comp_size(zip) != zip_entry_size(zip)) {
+        debug_eprintfln("Entry with index %d is not plainly stored",
+                        file->index);
+        goto cleanup;
+    }
+
+    file->stored_offset = zip_entry_data_offset(zip);
+    if (file->stored_offset < 0) {
+        eprintfln("Locate data of entry with index %d error", file->index);
+        ret = -EIO;
+        goto cleanup;
+    }
+    debug_eprintfln("Entry with index %d is stored at offset %lld",
+                    file->index, file->stored_offset);
+
+cleanup:
+    zip_entry_close(zip);
+unlock:
+    reader_release(reader);
+    return ret;
+}
+
+// Reads the seek table of a zstd entry, leaving the seekable NULL if it has
+// none, in which case it is decoded as a whole.
+static int zipfs_seekable_open(int index, struct seekable_t **seekable) {
+    int local;
+    struct zipfs_archive_t *archive = zipfs_archive_get(index, &local);
+    struct reader_t *reader = reader_acquire(archive->readers);
+    struct zip_t *zip = reader->zip;
+
+    *seekable = NULL;
+    if (zip_entry_openbyindex(zip, local) != 0) {
+        reader_release(reader);
+        return -ENOENT;
+    }
+    long long data_offset = zip_entry_data_offset(zip);
+    unsigned long long comp_size = zip_entry_comp_size(zip);
+    unsigned long long uncomp_size = zip_entry_size(zip);
+    zip_entry_close(zip);
+    // The table is read with a reader of its own.
+    reader_release(reader);
+    if (data_offset < 0) {
+        eprintfln("Locate data of entry with index %d error", index);
+        return -EIO;
+    }
+
+    *seekable = seekable_open(zipfs_archive_read, archive, data_offset,
+                              comp_size, uncomp_size);
+    if (*seekable == NULL) {
+        debug_eprintfln("Entry with index %d is not seekable", index);
+        return 0;
+    }
+    if (archive->map != NULL) {
+        seekable_map(*seekable, (const char *)archive->map + data_offset);
+    }
+    debug_eprintfln("Entry with index %d is decoded by frame", index);
+    return 0;
+}
+
+static void zipfs_file_free(struct zipfs_file_t *file) {
+    if (file->block != NULL) {
+        cache_release(cache, file->block);
+    }
+    pthread_mutex_destroy(&file->ahead_mutex);
+    pthread_mutex_destroy(&file->buf_mutex);
+    free(file->buf);
+    free(file);
+}
+
+// Writes the statistics of the mount, on top of the ones counted by each
+// thread.
+static void zipfs_stats_write(FILE *file) {
+    stats_write(file);
+
+    fprintf(file, "# HELP zipfs_cache_used_bytes Decompressed data cached.\n"
+                  "# TYPE zipfs_cache_used_bytes gauge\n"
+                  "zipfs_cache_used_bytes %zu\n",
+            cache_used(cache));
+    if (slab != NULL) {
+        fprintf(file,
+                "# HELP zipfs_preload_size_bytes Size of the slab of small "
+                "entries.\n"
+                "# TYPE zipfs_preload_size_bytes gauge\n"
+                "zipfs_preload_size_bytes %zu\n"
+                "# HELP zipfs_preload_filled_bytes Bytes of entries preloaded "
+                "so far.\n"
+                "# TYPE zipfs_preload_filled_bytes gauge\n"
+                "zipfs_preload_filled_bytes %zu\n"
+                "# HELP zipfs_preload_filled_entries Entries preloaded so "
+                "far.\n"
+                "# TYPE zipfs_preload_filled_entries gauge\n"
+                "zipfs_preload_filled_entries %zu\n",
+                slab->size,
+                __atomic_load_n(&slab->filled_bytes, __ATOMIC_RELAXED),
+                __atomic_load_n(&slab->num_filled, __ATOMIC_RELAXED));
+    }
+    if (prefetch == NULL) {
+        return;
+    }
+    pthread_mutex_lock(&prefetch->mutex);
+    fprintf(file,
+            "# HELP zipfs_prefetch_loaded_total Entries loaded ahead.\n"
+            "# TYPE zipfs_prefetch_loaded_total counter\n"
+            "zipfs_prefetch_loaded_total %llu\n"
+            "# HELP zipfs_prefetch_loaded_bytes_total Bytes of entries loaded "
+            "ahead.\n"
+            "# TYPE zipfs_prefetch_loaded_bytes_total counter\n"
+            "zipfs_prefetch_loaded_bytes_total %llu\n"
+            "# HELP zipfs_prefetch_hits_total Entries opened in sequence "
+            "which were loaded already.\n"
+            "# TYPE zipfs_prefetch_hits_total counter\n"
+            "zipfs_prefetch_hits_total %llu\n"
+            "# HELP zipfs_prefetch_evicted_total Entries loaded ahead but "
+            "evicted before they were opened.\n"
+            "# TYPE zipfs_prefetch_evicted_total counter\n"
+            "zipfs_prefetch_evicted_total %llu\n"
+            "# HELP zipfs_prefetch_depth Entries currently loaded ahead.\n"
+            "# TYPE zipfs_prefetch_depth gauge\n"
+            "zipfs_prefetch_depth %zu\n",
+            prefetch->loaded_entries, prefetch->loaded_bytes, prefetch->hits,
+            prefetch->evicted, prefetch->depth);
+    pthread_mutex_unlock(&prefetch->mutex);
+}
+
+// Opens the statistics file, whose content is generated once, so that it is
+// consistent however it is read.
+static void zipfs_ctl_open(fuse_req_t req, struct fuse_file_info *fi) {
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    struct zipfs_file_t *file =
+        (struct zipfs_file_t *)calloc(1, sizeof(struct zipfs_file_t));
+    if (file == NULL) {
+        perror("calloc()");
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    file->index = -1;
+    file->stored_offset = -1;
+    pthread_mutex_init(&file->ahead_mutex, NULL);
+    pthread_mutex_init(&file->buf_mutex, NULL);
+
+    FILE *stream = open_memstream(&file->buf, &file->buf_size);
+    if (stream == NULL) {
+        perror("open_memstream()");
+        zipfs_file_free(file);
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    zipfs_stats_write(stream);
+    fclose(stream);
+    file->size = file->buf_size;
+
+    // The size is not known to the kernel, which must not cache anything.
+    fi->fh = (uintptr_t)file;
+    fi->direct_io = 1;
+    fuse_reply_open(req, fi);
+}
+
+static void zipfs_open(fuse_req_t req, fuse_ino_t ino,
+                       struct fuse_file_info *fi) {
+    if (ino == CTL_STATS_INO) {
+        zipfs_ctl_open(req, fi);
+        return;
+    }
+
+    struct tree_node_t *node = zipfs_tree_get(ino);
+    if (node == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
+
+    if (S_ISDIR(node->st.st_mode)) {
+        debug_eprintfln("Entry %llu is dir", (unsigned long long)ino);
+        fuse_reply_err(req, EISDIR);
+        return;
+    }
+
+    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+        debug_eprintfln("Access mode is not read-only");
+        fuse_reply_err(req, EACCES);
+        return;
+    }
+
+    struct zipfs_file_t *file =
+        (struct zipfs_file_t *)calloc(1, sizeof(struct zipfs_file_t));
+    if (file == NULL) {
+        perror("calloc()");
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
+    file->index = node->index;
+    int local;
+    file->archive = zipfs_archive_get(file->index, &local);
+    file->stored_offset = -1;
+    file->size = node->st.st_size;
+    pthread_mutex_init(&file->ahead_mutex, NULL);
+    pthread_mutex_init(&file->buf_mutex, NULL);
+
+    int ret = 0;
+    if (node->method == 0) {
+        ret = zipfs_stored_locate(file);
+    } else if ((size_t)node->st.st_size >= stream_min_size &&
+               node->method == DECODE_METHOD_ZSTD) {
+        ret = zipfs_seekable_open(file->index, &file->seekable);
+    } else if ((size_t)node->st.st_size >= stream_min_size) {
+        ret = zipfs_stream_create(file->index, &file->stream);
+    }
+    if (ret != 0) {
+        zipfs_file_free(file);
+        fuse_reply_err(req, -ret);
+        return;
+    }
+    if (parallel != NULL && file->stream != NULL) {
+        struct stream_index_t *index = seek_table_get(seeks, file->index);
+        if (index != NULL && stream_index_complete(index)) {
+            file->parallel_index = index;
+        }
+    }
+
+    // Keep the entry cached for as long as it is open, unless it is preloaded.
+    size_t preloaded_size;
+    if (file->stream == NULL && file->seekable == NULL &&
+        file->stored_offset < 0 && slab != NULL) {
+        file->preloaded = slab_get(slab, file->index, &preloaded_size);
+        stats_add(STATS_PRELOAD_HITS, file->preloaded != NULL);
+    }
+    if (file->stream == NULL && file->seekable == NULL &&
+        file->stored_offset < 0 && file->preloaded == NULL) {
+        int hit = cache_contains(cache, file->index);
+        if (cache_pin(cache, file->index) != 0) {
+            zipfs_file_free(file);
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        stats_add(STATS_ENTRY_HITS, hit);
+        if (prefetch != NULL) {
+            prefetch_access(prefetch, file->index, hit);
+        }
+    }
+
+    fi->fh = (uintptr_t)file;
+    fi->keep_cache = !zipfs_options.no_keep_cache;
+    debug_eprintfln("Entry index is %d", file->index);
+    fuse_reply_open(req, fi);
+}
+
+// Decodes the current entry of the handler in one go, from the mapped archive
+// or from its compressed data read into memory.
+static int zipfs_decode(struct zipfs_archive_t *archive, struct zip_t *zip,
+                        char *data, size_t size) {
+    long long data_offset = zip_entry_data_offset(zip);
+    unsigned long long comp_size = zip_entry_comp_size(zip);
+    if (data_offset < 0) {
+        return -1;
+    }
+
+    const char *comp;
+    char *buf = NULL;
+    if (archive->map != NULL) {
+        if (data_offset + comp_size > archive->map_size) {
+            return -1;
+        }
+        comp = (const char *)archive->map + data_offset;
+    } else {
+        buf = (char *)malloc(comp_size > 0 ? comp_size : 1);
+        if (buf == NULL) {
+            perror("malloc()");
+            return -1;
+        }
+        if (zip_archive_read(zip, data_offset, buf, comp_size) !=
+            (ssize_t)comp_size) {
+            free(buf);
+            return -1;
+        }
+        comp = buf;
+    }
+
+    int ret = decode_whole(zip_entry_method(zip), comp, comp_size, data, size);
+    free(buf);
+    return ret;
+}
+
+// Extracts the current entry of the handler into data of its size. Decoded
+// entries are checked here once, anything else is left to miniz, which checks
+// it as it extracts.
+static int zipfs_extract(struct zipfs_archive_t *archive, struct zip_t *zip,
+                         int index, char *data, size_t size) {
+    unsigned long long start = stats_now();
+    ssize_t extracted;
+    int decoded = decode_supported(zip_entry_method(zip));
+    if (decoded) {
+        extracted = zipfs_decode(archive, zip, data, size) == 0 ? 0 : -1;
+    } else {
+        extracted = zip_entry_noallocread(zip, (void *)data, size);
+    }
+    if (extracted == -1) {
+        eprintfln("Extract entry with index %d error", index);
+        return -EIO;
+    }
+    if (decoded && !zipfs_options.no_verify_crc &&
+        crc_update(0, data, size) != zip_entry_crc32(zip)) {
+        eprintfln("Entry with index %d is corrupted", index);
+        return -EIO;
+    }
+    debug_eprintfln("Entry with index %d extracted", index);
+    stats_add(STATS_BYTES_DECODED, size);
+    stats_add(STATS_DECODE_NS, stats_now() - start);
+    return 0;
+}
+
+// Extracts the whole entry into the cache entry to be loaded by the caller.
+static int zipfs_load(struct cache_entry_t *entry, int index) {
+    int ret = 0;
+    int local;
+    struct zipfs_archive_t *archive = zipfs_archive_get(index, &local);
+    struct reader_t *reader = reader_acquire(archive->readers);
+    struct zip_t *zip = reader->zip;
+
+    if (zip_entry_openbyindex(zip, local) != 0) {
+        ret = -ENOENT;
+        goto unlock;
+    }
+
+    size_t entry_size = zip_entry_size(zip);
+    debug_eprintfln("Entry size is %zu", entry_size);
+    if (archive->map != NULL || archive->remote != NULL ||
+        archive->io != NULL) {
+        long long data_offset = zip_entry_data_offset(zip);
+        if (data_offset >= 0) {
+            zipfs_advise(archive, data_offset, zip_entry_comp_size(zip),
+                         MADV_WILLNEED);
+        }
+    }
+    // Always allocate something, so that empty entries are cached as well.
+    char *data = (char *)malloc(entry_size > 0 ? entry_size : 1);
+    if (data == NULL) {
+        perror("malloc()");
+        ret = -ENOMEM;
+        goto cleanup;
+    }
+
+    ret = zipfs_extract(archive, zip, index, data, entry_size);
+    if (ret != 0) {
+        free(data);
+        goto cleanup;
+    }
+    stats_add(STATS_ENTRY_MISSES, 1);
+    cache_complete(cache, entry, data, entry_size);
+
+cleanup:
+    zip_entry_close(zip);
+unlock:
+    reader_release(reader);
+    return ret;
+}
+
+// Extracts an entry into the cache ahead of time, if it would be cached when
+// opened.
+static long long zipfs_prefetch(void *opaque, int index) {
+    (void)opaque;
+
+    int locked = zipfs_tree_lock();
+    struct tree_node_t *node = tree_get_entry(tree, index);
+    zipfs_tree_unlock(locked);
+    if (node == NULL || !S_ISREG(node->st.st_mode) || node->method == 0 ||
+        (size_t)node->st.st_size >= stream_min_size ||
+        (size_t)node->st.st_size > prefetch_max_size ||
+        (slab != NULL && slab_contains(slab, index))) {
+        return 0;
+    }
+
+    int load;
+    struct cache_entry_t *entry = cache_acquire(cache, index, &load);
+    if (entry == NULL) {
+        return -1;
+    }
+
+    long long ret = 0;
+    if (load) {
+        ret = zipfs_load(entry, index);
+        if (ret != 0) {
+            cache_abort(cache, entry);
+        } else {
+            ret = entry->size;
+        }
+    }
+    cache_release(cache, entry);
+    return ret;
+}
 
-#define DEBUG_PRINT_PREFIX "[DEBUG " __FILE__ ":" STR(__LINE__) "] "
+// Tells the size of an entry to preload, which is any compressed file served
+// in the tree which would be cached as a whole.
+static long long zipfs_preload_size(void *opaque, int index) {
+    (void)opaque;
+
+    struct tree_node_t *node = tree_get_entry(tree, index);
+    if (node == NULL || !S_ISREG(node->st.st_mode) || node->method == 0 ||
+        (size_t)node->st.st_size > preload_max_size ||
+        (size_t)node->st.st_size >= stream_min_size) {
+        return -1;
+    }
+    return node->st.st_size;
+}
+
+// Extracts an entry into its place in the slab.
+static int zipfs_preload(void *opaque, int index, char *data, size_t size) {
+    (void)opaque;
+
+    int ret = -ENOENT;
+    int local;
+    struct zipfs_archive_t *archive = zipfs_archive_get(index, &local);
+    struct reader_t *reader = reader_acquire(archive->readers);
+    struct zip_t *zip = reader->zip;
+    if (zip_entry_openbyindex(zip, local) == 0) {
+        ret = zip_entry_size(zip) == size
+                  ? zipfs_extract(archive, zip, index, data, size)
+                  : -EIO;
+        zip_entry_close(zip);
+    }
+    reader_release(reader);
+    return ret;
+}
+
+// Clamps a read of a stored entry to its size, returning the number of bytes
+// to read.
+static size_t zipfs_stored_size(const struct zipfs_file_t *file, size_t size,
+                                off_t offset) {
+    if ((unsigned long long)offset >= file->size) {
+        return 0;
+    }
+    return file->size - offset < size ? file->size - offset : size;
+}
+
+// Replies with a slice of the archive. Unless it is mapped, FUSE can splice
+// the slice to the kernel without copying it through user space.
+static void zipfs_read_stored(fuse_req_t req, struct zipfs_file_t *file,
+                              size_t size, off_t offset) {
+    size = zipfs_stored_size(file, size, offset);
+    stats_add(STATS_BYTES_SERVED, size);
+    if (file->archive->map != NULL) {
+        fuse_reply_buf(req,
+                       (char *)file->archive->map + file->stored_offset +
+                           offset,
+                       size);
+        return;
+    }
+    if (file->archive->remote != NULL) {
+        char *buf = (char *)malloc(size > 0 ? size : 1);
+        if (buf == NULL) {
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        ssize_t ret = remote_read(file->archive->remote,
+                                  file->stored_offset + offset, buf, size);
+        if (ret < 0) {
+            fuse_reply_err(req, -ret);
+        } else {
+            fuse_reply_buf(req, buf, ret);
+        }
+        free(buf);
+        return;
+    }
+
+    struct fuse_bufvec bufv = FUSE_BUFVEC_INIT(size);
+    bufv.buf[0].flags = FUSE_BUF_IS_FD | FUSE_BUF_FD_SEEK;
+    bufv.buf[0].fd = file->archive->fd;
+    bufv.buf[0].pos = file->archive->offset + file->stored_offset + offset;
+    fuse_reply_data(req, &bufv, FUSE_BUF_SPLICE_MOVE);
+}
+
+// Keys of blocks come after the ones of whole entries, which are their
+// indexes.
+static unsigned long long zipfs_block_key(int index, unsigned long long block) {
+    return ((block + 1) << 32) | (unsigned int)index;
+}
+
+// Returns the first block starting at or after an offset of a streamed entry,
+// or the number of blocks if there is none.
+static unsigned long long zipfs_block_after(const struct zipfs_file_t *file,
+                                            unsigned long long offset) {
+    if (offset >= file->size) {
+        return (file->size + BLOCK_SIZE - 1) / BLOCK_SIZE;
+    }
+    return (offset + BLOCK_SIZE - 1) / BLOCK_SIZE;
+}
+
+// Queues the segments of a streamed entry following the block being read to
+// the parallel workers, so that they are inflated by the time the reader gets
+// there. Each segment starts at the block after a seek point, which is where
+// its worker resumes.
+static void zipfs_parallel_ahead(struct zipfs_file_t *file,
+                                 unsigned long long block) {
+    // Concurrent reads of the file would only plan the same segments.
+    if (pthread_mutex_trylock(&file->ahead_mutex) != 0) {
+        return;
+    }
+
+    struct stream_index_t *index = file->parallel_index;
+    unsigned long long end = zipfs_block_after(
+        file, (block + 1) * BLOCK_SIZE + parallel_ahead_size);
+    unsigned long long first = file->ahead;
+    // Start over after seeking, leaving the segment being read to the reader.
+    if (first <= block || first > end + PARALLEL_SEGMENT_SIZE / BLOCK_SIZE) {
+        first = zipfs_block_after(
+            file, stream_index_next(index, (block + 1) * BLOCK_SIZE));
+    }
+    while (first < end) {
+        unsigned long long next = zipfs_block_after(
+            file, stream_index_next(index, first * BLOCK_SIZE +
+                                               PARALLEL_SEGMENT_SIZE));
+        // The reader is about to wait for the segment it gets to next.
+        enum pool_priority_t priority =
+            first <= block + PARALLEL_SEGMENT_SIZE / BLOCK_SIZE
+                ? POOL_DEMAND
+                : POOL_SPECULATIVE;
+        if (parallel_queue(parallel, priority, file->index, first, next) !=
+            0) {
+            break;
+        }
+        debug_eprintfln("Blocks %llu to %llu of entry with index %d queued",
+                        first, next, file->index);
+        first = next;
+    }
+    file->ahead = first;
+
+    pthread_mutex_unlock(&file->ahead_mutex);
+}
+
+// Acquires a block of a streamed entry, inflating it with the stream of the
+// file unless it is cached already. Only inflating takes the lock of the
+// stream, so hits never wait for another read to inflate.
+static struct cache_entry_t *zipfs_block_acquire(struct zipfs_file_t *file,
+                                                 unsigned long long block,
+                                                 int *err) {
+    unsigned long long key = zipfs_block_key(file->index, block);
+    // Taking the last block of the file needs no lock at all.
+    struct cache_entry_t *entry =
+        __atomic_exchange_n(&file->block, NULL, __ATOMIC_ACQUIRE);
+    if (entry != NULL) {
+        if (entry->key == key) {
+            stats_add(STATS_BLOCK_HITS, 1);
+            return entry;
+        }
+        cache_release(cache, entry);
+    }
+
+    if (file->parallel_index != NULL) {
+        zipfs_parallel_ahead(file, block);
+    }
+
+    int load;
+    entry = cache_acquire(cache, key, &load);
+    if (entry == NULL) {
+        *err = ENOMEM;
+        return NULL;
+    }
+    if (!load) {
+        stats_add(STATS_BLOCK_HITS, 1);
+        return entry;
+    }
+
+    unsigned long long start = stats_now();
+    unsigned long long offset = block * BLOCK_SIZE;
+    size_t size = file->size - offset < BLOCK_SIZE ? file->size - offset
+                                                   : BLOCK_SIZE;
+    char *data = (char *)malloc(size > 0 ? size : 1);
+    if (data == NULL) {
+        perror("malloc()");
+        *err = ENOMEM;
+        goto abort;
+    }
+    ssize_t ret =
+        file->stream != NULL
+            ? stream_read(file->stream, zipfs_archive_read, file->archive,
+                          data, size, offset)
+            : seekable_read(file->seekable, zipfs_archive_read,
+                            file->archive, data, size, offset);
+    if (ret != (ssize_t)size) {
+        eprintfln("Inflate block %llu of entry with index %d error", block,
+                  file->index);
+        free(data);
+        *err = ret < 0 ? -ret : EIO;
+        goto abort;
+    }
+    debug_eprintfln("Block %llu of entry with index %d inflated", block,
+                    file->index);
+    stats_add(STATS_BLOCK_MISSES, 1);
+    stats_add(STATS_BYTES_DECODED, size);
+    stats_add(STATS_DECODE_NS, stats_now() - start);
+    cache_complete(cache, entry, data, size);
+    return entry;
+
+abort:
+    cache_abort(cache, entry);
+    cache_release(cache, entry);
+    return NULL;
+}
+
+// Keeps the block for the next read of the file.
+static void zipfs_block_keep(struct zipfs_file_t *file,
+                             struct cache_entry_t *entry) {
+    struct cache_entry_t *old =
+        __atomic_exchange_n(&file->block, entry, __ATOMIC_RELEASE);
+    if (old != NULL) {
+        cache_release(cache, old);
+    }
+}
+
+// Inflates blocks of a streamed entry ahead of its reader, with a stream of its
+// own resuming at the seek point in front of the first block.
+static int zipfs_parallel_load(void *opaque, int index,
+                               unsigned long long first,
+                               unsigned long long last) {
+    (void)opaque;
+
+    int locked = zipfs_tree_lock();
+    struct tree_node_t *node = tree_get_entry(tree, index);
+    zipfs_tree_unlock(locked);
+    if (node == NULL) {
+        return -1;
+    }
+    unsigned long long entry_size = node->st.st_size;
+    int local;
+    struct zipfs_archive_t *archive = zipfs_archive_get(index, &local);
+
+    struct cache_entry_t **blocks =
+        (struct cache_entry_t **)calloc(last - first, sizeof(*blocks));
+    if (blocks == NULL) {
+        perror("calloc()");
+        return -1;
+    }
+
+    // Blocks are claimed up front and in order, so that a reader catching up
+    // waits for them instead of inflating them once more.
+    size_t num_loads = 0;
+    for (unsigned long long block = first; block < last; ++block) {
+        int load;
+        struct cache_entry_t *entry =
+            cache_acquire(cache, zipfs_block_key(index, block), &load);
+        if (entry == NULL) {
+            break;
+        }
+        if (!load) {
+            cache_release(cache, entry);
+            continue;
+        }
+        blocks[block - first] = entry;
+        ++num_loads;
+    }
+
+    int ret = 0;
+    struct stream_t *stream = NULL;
+    if (num_loads > 0 &&
+        (zipfs_stream_create(index, &stream) != 0 || stream == NULL)) {
+        ret = -1;
+    }
+    for (unsigned long long block = first; block < last; ++block) {
+        struct cache_entry_t *entry = blocks[block - first];
+        if (entry == NULL) {
+            continue;
+        }
+
+        unsigned long long offset = block * BLOCK_SIZE;
+        size_t size = entry_size - offset < BLOCK_SIZE ? entry_size - offset
+                                                       : BLOCK_SIZE;
+        unsigned long long start = stats_now();
+        char *data = ret == 0 ? (char *)malloc(size > 0 ? size : 1) : NULL;
+        if (data != NULL &&
+            stream_read(stream, zipfs_archive_read, archive, data, size,
+                        offset) == (ssize_t)size) {
+            stats_add(STATS_BLOCK_MISSES, 1);
+            stats_add(STATS_BYTES_DECODED, size);
+            stats_add(STATS_DECODE_NS, stats_now() - start);
+            cache_complete(cache, entry, data, size);
+        } else {
+            free(data);
+            cache_abort(cache, entry);
+            ret = -1;
+        }
+        cache_release(cache, entry);
+    }
+    stream_free(stream);
+    free(blocks);
+
+    if (ret == 0) {
+        debug_eprintfln("%zu block(s) of entry with index %d inflated ahead",
+                        num_loads, index);
+    }
+    return ret;
+}
+
+// Copies a read spanning too many blocks to reply with them directly.
+static void zipfs_read_blocks_copy(fuse_req_t req, struct zipfs_file_t *file,
+                                   size_t size, off_t offset) {
+    pthread_mutex_lock(&file->buf_mutex);
+    if (file->buf_size < size) {
+        char *buf = (char *)realloc(file->buf, size);
+        if (buf == NULL) {
+            perror("realloc()");
+            pthread_mutex_unlock(&file->buf_mutex);
+            fuse_reply_err(req, ENOMEM);
+            return;
+        }
+        file->buf = buf;
+        file->buf_size = size;
+    }
+
+    size_t pos = 0;
+    while (pos < size) {
+        unsigned long long block = (offset + pos) / BLOCK_SIZE;
+        int err;
+        struct cache_entry_t *entry = zipfs_block_acquire(file, block, &err);
+        if (entry == NULL) {
+            pthread_mutex_unlock(&file->buf_mutex);
+            fuse_reply_err(req, err);
+            return;
+        }
+        size_t begin = offset + pos - block * BLOCK_SIZE;
+        size_t len = entry->size - begin < size - pos ? entry->size - begin
+                                                      : size - pos;
+        memcpy(file->buf + pos, entry->data + begin, len);
+        pos += len;
+        zipfs_block_keep(file, entry);
+    }
+
+    stats_add(STATS_BYTES_SERVED, size);
+    fuse_reply_buf(req, file->buf, size);
+    pthread_mutex_unlock(&file->buf_mutex);
+}
+
+// Replies straight from the cached blocks of a streamed entry, which stay
+// referenced until the reply has been sent.
+static void zipfs_read_blocks(fuse_req_t req, struct zipfs_file_t *file,
+                              size_t size, off_t offset) {
+    if ((unsigned long long)offset >= file->size || size == 0) {
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+
+    unsigned long long first = offset / BLOCK_SIZE;
+    unsigned long long last = (offset + size - 1) / BLOCK_SIZE;
+    if (last - first >= MAX_READ_BLOCKS) {
+        zipfs_read_blocks_copy(req, file, size, offset);
+        return;
+    }
+
+    struct cache_entry_t *blocks[MAX_READ_BLOCKS];
+    struct iovec iov[MAX_READ_BLOCKS];
+    size_t n = 0;
+    int err = 0;
+    for (unsigned long long block = first; block <= last; ++block) {
+        struct cache_entry_t *entry = zipfs_block_acquire(file, block, &err);
+        if (entry == NULL) {
+            break;
+        }
+        size_t begin = block == first ? offset - block * BLOCK_SIZE : 0;
+        size_t end = block == last ? offset + size - block * BLOCK_SIZE
+                                   : entry->size;
+        blocks[n] = entry;
+        iov[n].iov_base = entry->data + begin;
+        iov[n].iov_len = end - begin;
+        ++n;
+    }
+
+    if (err != 0) {
+        fuse_reply_err(req, err);
+    } else {
+        stats_add(STATS_BYTES_SERVED, size);
+        fuse_reply_iov(req, iov, n);
+        debug_eprintfln("%zu byte(s) replied from %zu block(s)", size, n);
+    }
+    for (size_t i = 0; i < n; ++i) {
+        if (err == 0 && i + 1 == n) {
+            zipfs_block_keep(file, blocks[i]);
+        } else {
+            cache_release(cache, blocks[i]);
+        }
+    }
+}
+
+// Returns the loaded cache entry of a file, loading it on the first read.
+static struct cache_entry_t *zipfs_file_entry(struct zipfs_file_t *file,
+                                              int *err) {
+    struct cache_entry_t *entry =
+        __atomic_load_n(&file->entry, __ATOMIC_ACQUIRE);
+    if (entry != NULL) {
+        return entry;
+    }
 
-#define eprintf(...) fprintf(stderr, __VA_ARGS__)
-#define eprintfln(...)                                                         \
-    do {                                                                       \
-        eprintf(__VA_ARGS__);                                                  \
-        eprintf("\n");                                                         \
-    } while (0)
+    int load;
+    entry = cache_acquire(cache, file->index, &load);
+    if (entry == NULL) {
+        *err = ENOMEM;
+        return NULL;
+    }
+    if (load) {
+        int ret = zipfs_load(entry, file->index);
+        if (ret != 0) {
+            cache_abort(cache, entry);
+            cache_release(cache, entry);
+            *err = -ret;
+            return NULL;
+        }
+    }
 
-#if defined DEBUG
-#define debug_eprintf(...) eprintf(DEBUG_PRINT_PREFIX __VA_ARGS__)
-#else
-#define debug_eprintf(...)
-#endif
+    // The pin keeps the entry loaded, so the reference can go right away.
+    // Concurrent first reads store the same entry.
+    __atomic_store_n(&file->entry, entry, __ATOMIC_RELEASE);
+    cache_release(cache, entry);
+    return entry;
+}
 
-#if defined DEBUG
-#define debug_eprintfln(...) eprintfln(DEBUG_PRINT_PREFIX __VA_ARGS__)
-#else
-#define debug_eprintfln(...)
-#endif
+// Replies straight from the cached data, which stays loaded while the file is
+// open.
+static void zipfs_read_cached(fuse_req_t req, struct zipfs_file_t *file,
+                              size_t size, off_t offset) {
+    int err;
+    struct cache_entry_t *entry = zipfs_file_entry(file, &err);
+    if (entry == NULL) {
+        fuse_reply_err(req, err);
+        return;
+    }
 
-#define DEFAULT_MIN_BUF_SIZE (4 * 1024 * 1024)
-static size_t min_buf_size = DEFAULT_MIN_BUF_SIZE;
-struct zip_buffer_t {
-    int index;
-    char *data;
-    size_t buf_size;
-    size_t entry_size;
-};
+    if ((size_t)offset >= entry->size) {
+        debug_eprintfln("Offset %lld is out of bound for entry size %zu",
+                        (long long)offset, entry->size);
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+    if (size > entry->size - offset) {
+        size = entry->size - offset;
+    }
+    stats_add(STATS_BYTES_SERVED, size);
+    fuse_reply_buf(req, entry->data + offset, size);
+    debug_eprintfln("%zu byte(s) replied from offset %lld", size,
+                    (long long)offset);
+}
 
-static struct zip_buffer_t zip_buf;
+// Replies from the whole content of a control file or a preloaded entry.
+static void zipfs_read_memory(fuse_req_t req, struct zipfs_file_t *file,
+                              const char *data, size_t size, off_t offset) {
+    if ((unsigned long long)offset >= file->size) {
+        fuse_reply_buf(req, NULL, 0);
+        return;
+    }
+    if (size > file->size - offset) {
+        size = file->size - offset;
+    }
+    if (file->index >= 0) {
+        stats_add(STATS_BYTES_SERVED, size);
+    }
+    fuse_reply_buf(req, data + offset, size);
+}
 
-static struct zip_t *zip;
-static pthread_mutex_t zip_mutex;
+static void zipfs_read(fuse_req_t req, fuse_ino_t ino, size_t size,
+                       off_t offset, struct fuse_file_info *fi) {
+    (void)ino;
+
+    struct zipfs_file_t *file = (struct zipfs_file_t *)(uintptr_t)fi->fh;
+    debug_eprintfln("Invoked with index %d", file->index);
+
+    if (file->index < 0) {
+        zipfs_read_memory(req, file, file->buf, size, offset);
+    } else if (file->preloaded != NULL) {
+        zipfs_read_memory(req, file, file->preloaded, size, offset);
+    } else if (file->stored_offset >= 0) {
+        zipfs_read_stored(req, file, size, offset);
+    } else if (file->stream != NULL || file->seekable != NULL) {
+        zipfs_read_blocks(req, file, size, offset);
+    } else {
+        zipfs_read_cached(req, file, size, offset);
+    }
+}
 
-#define MAX_ZIP_ENTRIES 65535
-static char *zip_entry_names[MAX_ZIP_ENTRIES];
+static void zipfs_release(fuse_req_t req, fuse_ino_t ino,
+                          struct fuse_file_info *fi) {
+    (void)ino;
+
+    struct zipfs_file_t *file = (struct zipfs_file_t *)(uintptr_t)fi->fh;
+    if (file->stream != NULL) {
+        stream_free(file->stream);
+    } else if (file->seekable != NULL) {
+        seekable_free(file->seekable);
+    } else if (file->stored_offset < 0 && file->index >= 0 &&
+               file->preloaded == NULL) {
+        cache_unpin(cache, file->index);
+    }
+    zipfs_file_free(file);
+    fuse_reply_err(req, 0);
+}
 
-static struct zipfs_options {
-    int show_help;
-    size_t min_buf_size;
-} zipfs_options;
+// Inflates every entry which would be streamed, so that their indexes are
+// complete before the first read.
+static int zipfs_build_index(void) {
+    for (int i = 0; (size_t)i < entries->num_entries; ++i) {
+        if (entries->isdirs[i] || entries->uncomp_sizes[i] < stream_min_size) {
+            continue;
+        }
 
-#define ZIPFS_OPTION(t, p)                                                     \
-    { t, offsetof(struct zipfs_options, p), 1 }
-static const struct fuse_opt option_spec[] = {
-    ZIPFS_OPTION("-h", show_help), ZIPFS_OPTION("--help", show_help),
-    ZIPFS_OPTION("--min-buf=%zu", min_buf_size), FUSE_OPT_END};
+        struct stream_index_t *index = seek_table_get(seeks, i);
+        if (index != NULL && stream_index_complete(index)) {
+            continue;
+        }
 
-inline static int starts_with(const char *pre, const char *str) {
-    return strncmp(pre, str, strlen(pre)) == 0;
+        struct stream_t *stream;
+        if (zipfs_stream_create(i, &stream) != 0) {
+            return -1;
+        }
+        if (stream == NULL) {
+            continue;
+        }
+        int local;
+        int ret = stream_finish(stream, zipfs_archive_read,
+                                zipfs_archive_get(i, &local));
+        stream_free(stream);
+        if (ret != 0) {
+            eprintfln("Index entry with index %d error", i);
+            return -1;
+        }
+        debug_eprintfln("Entry with index %d indexed", i);
+    }
+    return 0;
 }
 
-static void show_help(const char *progname) {
-    eprintf("usage: %s <zip-file> <mountpoint> [options]\n\n", progname);
-    eprintf("general options:\n"
-            "    -h | --help         print help\n"
-            "    -V | --version      print version\n"
-            "\n");
-    eprintf("file-system specific options:\n"
-            "    --min-buf           Minimal buffer size in bytes for reading "
-            "zip entries\n"
-            "\n");
-}
+static void zipfs_opendir(fuse_req_t req, fuse_ino_t ino,
+                          struct fuse_file_info *fi) {
+    if (ino == CTL_DIR_INO) {
+        fuse_reply_open(req, fi);
+        return;
+    }
 
-static void *zipfs_init(struct fuse_conn_info *conn) {
-    (void)conn;
+    struct tree_node_t *node = zipfs_tree_get(ino);
+    if (node == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
+    }
 
-    debug_eprintfln("zipfs has initialized");
-    return NULL;
-}
+    if (!S_ISDIR(node->st.st_mode)) {
+        debug_eprintfln("Entry %llu is not dir", (unsigned long long)ino);
+        fuse_reply_err(req, ENOTDIR);
+        return;
+    }
 
-static void zipfs_destroy(void *arg) {
-    (void)arg;
-    debug_eprintfln("zipfs has been destroyed");
+#if FUSE_VERSION >= FUSE_MAKE_VERSION(3, 5)
+    fi->cache_readdir = !zipfs_options.no_keep_cache;
+    fi->keep_cache = !zipfs_options.no_keep_cache;
+#endif
+    fuse_reply_open(req, fi);
 }
 
-static void zipfs_entry_getattr(struct zip_t *zip, struct stat *stbuf) {
-    if (zip_entry_isdir(zip)) {
-        debug_eprintfln("Entry is dir");
-        stbuf->st_mode = S_IFDIR | 0755;
-        // For consistency, always set the size of a dir to 0.
-    } else {
-        debug_eprintfln("Entry is regular file");
-        stbuf->st_mode = S_IFREG | 0444;
-        stbuf->st_size = zip_entry_size(zip);
+// Adds an entry to a listing, along with its attributes for readdirplus, which
+// count as a lookup of it.
+static size_t zipfs_add_direntry(fuse_req_t req, char *buf, size_t size,
+                                 const char *name, const struct stat *st,
+                                 off_t off, int plus) {
+    if (!plus) {
+        return fuse_add_direntry(req, buf, size, name, st, off);
     }
-    debug_eprintfln("Size of the entry is %lld",
-                    (unsigned long long)stbuf->st_size);
+
+    struct fuse_entry_param e;
+    memset(&e, 0, sizeof(e));
+    e.ino = st->st_ino;
+    e.attr = *st;
+    e.attr_timeout = zipfs_options.attr_timeout;
+    e.entry_timeout = zipfs_options.entry_timeout;
+    return fuse_add_direntry_plus(req, buf, size, name, &e, off);
 }
 
-static int zipfs_getattr(const char *path, struct stat *stbuf) {
-    int ret = 0;
-    memset(stbuf, 0, sizeof(struct stat));
-    pthread_mutex_lock(&zip_mutex);
+// Lists the control directory, whose entries are at offsets 1 to 3.
+static void zipfs_ctl_readdir(fuse_req_t req, size_t size, off_t off,
+                              int plus) {
+    static const char *const names[] = {".", "..", CTL_STATS_NAME};
+    const fuse_ino_t inos[] = {CTL_DIR_INO, FUSE_ROOT_INO, CTL_STATS_INO};
+
+    char *buf = (char *)malloc(size > 0 ? size : 1);
+    if (buf == NULL) {
+        perror("malloc()");
+        fuse_reply_err(req, ENOMEM);
+        return;
+    }
 
-    if (strcmp(path, "/") == 0) {
-        debug_eprintfln("Path is '/'");
-        stbuf->st_mode = S_IFDIR | 0755;
-    } else {
-        debug_eprintfln("Entry is '%s'", path + 1);
-        if (zip_entry_open(zip, path + 1) == 0) {
-            // The entry can be directly opened.
-            // We can infer it is likely to be a regular file.
-            zipfs_entry_getattr(zip, stbuf);
-            zip_entry_close(zip);
-        } else {
-            // Entry might be a directory
-            for (int i = 0; i < MAX_ZIP_ENTRIES && zip_entry_names[i] != NULL;
-                 ++i) {
-                // Since the entry cannot be opened defore,
-                // we can determine that the entry name must not be included
-                // in zip_entry_names. Thus, any other entry name starting with
-                // it must be longer than it.
-                if (starts_with(path + 1, zip_entry_names[i]) &&
-                    zip_entry_names[i][strlen(path + 1)] == '/') {
-                    debug_eprintfln("Path '%s' is dir", path);
-                    stbuf->st_mode = S_IFDIR | 0755;
-                    goto unlock;
-                }
-            }
-            debug_eprintfln("Entry '%s' cannot be opened", path + 1);
-            ret = -ENOENT;
+    size_t pos = 0;
+    for (; off >= 0 && off < 3; ++off) {
+        struct stat st;
+        if (zipfs_ctl_stat(inos[off], &st) != 0) {
+            st = ctl_root_st;
         }
+        size_t len = zipfs_add_direntry(req, buf + pos, size - pos,
+                                        names[off], &st, off + 1, plus);
+        if (len > size - pos) {
+            break;
+        }
+        pos += len;
     }
 
-unlock:
-    pthread_mutex_unlock(&zip_mutex);
-    return ret;
+    fuse_reply_buf(req, buf, pos);
+    free(buf);
 }
 
-static int zipfs_open(const char *path, struct fuse_file_info *fi) {
-    int ret = 0;
-    pthread_mutex_lock(&zip_mutex);
+// Lists a directory from the tree, in which the attributes of every entry are
+// ready, with them if plus is set.
+static void zipfs_list(fuse_req_t req, fuse_ino_t ino, size_t size, off_t off,
+                       int plus) {
+    if (ino == CTL_DIR_INO) {
+        zipfs_ctl_readdir(req, size, off, plus);
+        return;
+    }
 
-    if (strcmp(path, "/") == 0) {
-        debug_eprintfln("Path '/' cannot be opened");
-        ret = -ENOENT;
-        goto unlock;
+    // Children may still be added to any directory.
+    if (zipfs_tree_wait() != 0) {
+        fuse_reply_err(req, EIO);
+        return;
     }
 
-    if (zip_entry_open(zip, path + 1) != 0) {
-        debug_eprintfln("Entry '%s' cannot be opened", path + 1);
-        // For simplicity, we return -ENOENT, but it could also be -EISDIR.
-        ret = -ENOENT;
-        goto unlock;
+    struct tree_node_t *node = tree_get(tree, ino);
+    if (node == NULL) {
+        fuse_reply_err(req, ENOENT);
+        return;
     }
 
-    if (zip_entry_isdir(zip)) {
-        debug_eprintfln("Entry '%s' is dir", path + 1);
-        ret = -EISDIR;
-        goto cleanup;
+    char *buf = (char *)malloc(size > 0 ? size : 1);
+    if (buf == NULL) {
+        perror("malloc()");
+        fuse_reply_err(req, ENOMEM);
+        return;
     }
 
-    if ((fi->flags & O_ACCMODE) != O_RDONLY) {
-        debug_eprintfln("Access mode is not read-only");
-        ret = -EACCES;
-        goto cleanup;
+    // The offsets of the dot entries are 1 and 2, and the one of a child is
+    // its inode number plus 2, so that listing resumes at its next sibling.
+    size_t pos = 0;
+    struct tree_node_t *child = NULL;
+    if (off == 2) {
+        child = tree_get(tree, node->first_child);
+    } else if (off > 2) {
+        struct tree_node_t *prev = tree_get(tree, off - 2);
+        if (prev != NULL && prev->parent == node->st.st_ino) {
+            child = tree_get(tree, prev->next_sibling);
+        }
     }
+    while (off < 2 || child != NULL) {
+        const char *name;
+        const struct stat *st;
+        off_t next_off;
+        if (off == 0) {
+            name = ".";
+            st = &node->st;
+            next_off = 1;
+        } else if (off == 1) {
+            struct tree_node_t *parent = tree_get(tree, node->parent);
+            name = "..";
+            st = parent != NULL ? &parent->st : &node->st;
+            next_off = 2;
+        } else {
+            name = tree_node_name(tree, child);
+            st = &child->st;
+            next_off = child->st.st_ino + 2;
+        }
 
-    fi->fh = zip_entry_index(zip);
-    debug_eprintfln("Entry index is %" PRIu64, fi->fh);
+        size_t len = zipfs_add_direntry(req, buf + pos, size - pos, name, st,
+                                        next_off, plus);
+        if (len > size - pos) {
+            break;
+        }
+        pos += len;
+        debug_eprintfln("Entry '%s' filled", name);
 
-cleanup:
-    zip_entry_close(zip);
-unlock:
-    pthread_mutex_unlock(&zip_mutex);
-    return ret;
+        if (off >= 2) {
+            child = tree_get(tree, child->next_sibling);
+        } else if (next_off == 2) {
+            child = tree_get(tree, node->first_child);
+        }
+        off = next_off;
+    }
+
+    fuse_reply_buf(req, buf, pos);
+    free(buf);
 }
 
-static int zipfs_read(const char *path, char *buf, size_t size, off_t offset,
-                      struct fuse_file_info *fi) {
-    int ret;
-    int index;
+static void zipfs_readdir(fuse_req_t req, fuse_ino_t ino, size_t size,
+                          off_t off, struct fuse_file_info *fi) {
+    (void)fi;
+    zipfs_list(req, ino, size, off, 0);
+}
+
+static void zipfs_readdirplus(fuse_req_t req, fuse_ino_t ino, size_t size,
+                              off_t off, struct fuse_file_info *fi) {
+    (void)fi;
+    zipfs_list(req, ino, size, off, 1);
+}
 
-    pthread_mutex_lock(&zip_mutex);
+// Requests are timed including their replies.
+static void zipfs_lookup_timed(fuse_req_t req, fuse_ino_t parent,
+                               const char *name) {
+    unsigned long long start = stats_now();
+    zipfs_lookup(req, parent, name);
+    stats_op(STATS_OP_LOOKUP, start);
+}
 
-    if (fi == NULL) {
-        if (strcmp(path, "/") == 0) {
-            debug_eprintfln("Path '/' cannot be read");
-            ret = -ENOENT;
-            goto unlock;
-        }
+static void zipfs_getattr_timed(fuse_req_t req, fuse_ino_t ino,
+                                struct fuse_file_info *fi) {
+    unsigned long long start = stats_now();
+    zipfs_getattr(req, ino, fi);
+    stats_op(STATS_OP_GETATTR, start);
+}
 
-        debug_eprintfln("Invoked with path '%s'", path);
+static void zipfs_open_timed(fuse_req_t req, fuse_ino_t ino,
+                             struct fuse_file_info *fi) {
+    unsigned long long start = stats_now();
+    zipfs_open(req, ino, fi);
+    stats_op(STATS_OP_OPEN, start);
+}
 
-        if (zip_entry_open(zip, path + 1) != 0) {
-            ret = -ENOENT;
-            goto unlock;
-        }
-        index = zip_entry_index(zip);
-    } else {
-        index = fi->fh;
-        debug_eprintfln("Invoked with index %d", index);
+static void zipfs_read_timed(fuse_req_t req, fuse_ino_t ino, size_t size,
+                             off_t offset, struct fuse_file_info *fi) {
+    unsigned long long start = stats_now();
+    zipfs_read(req, ino, size, offset, fi);
+    stats_op(STATS_OP_READ, start);
+}
+
+static void zipfs_release_timed(fuse_req_t req, fuse_ino_t ino,
+                                struct fuse_file_info *fi) {
+    unsigned long long start = stats_now();
+    zipfs_release(req, ino, fi);
+    stats_op(STATS_OP_RELEASE, start);
+}
+
+static void zipfs_opendir_timed(fuse_req_t req, fuse_ino_t ino,
+                                struct fuse_file_info *fi) {
+    unsigned long long start = stats_now();
+    zipfs_opendir(req, ino, fi);
+    stats_op(STATS_OP_OPENDIR, start);
+}
+
+static void zipfs_readdir_timed(fuse_req_t req, fuse_ino_t ino, size_t size,
+                                off_t off, struct fuse_file_info *fi) {
+    unsigned long long start = stats_now();
+    zipfs_readdir(req, ino, size, off, fi);
+    stats_op(STATS_OP_READDIR, start);
+}
+
+static void zipfs_readdirplus_timed(fuse_req_t req, fuse_ino_t ino,
+                                    size_t size, off_t off,
+                                    struct fuse_file_info *fi) {
+    unsigned long long start = stats_now();
+    zipfs_readdirplus(req, ino, size, off, fi);
+    stats_op(STATS_OP_READDIRPLUS, start);
+}
+
+static const struct fuse_lowlevel_ops zipfs_operations = {
+    .init = zipfs_init,
+    .destroy = zipfs_destroy,
+    .lookup = zipfs_lookup_timed,
+    .getattr = zipfs_getattr_timed,
+    .open = zipfs_open_timed,
+    .read = zipfs_read_timed,
+    .release = zipfs_release_timed,
+    .opendir = zipfs_opendir_timed,
+    .readdir = zipfs_readdir_timed,
+    .readdirplus = zipfs_readdirplus_timed,
+};
+
+// Opens an archive at a URL, which has neither a descriptor nor a mapping.
+static int zipfs_remote_open(struct zipfs_archive_t *archive,
+                             struct stat *st) {
+    if (zipfs_options.mmap) {
+        eprintfln("--mmap is ignored for '%s'", archive->path);
+    }
+    archive->remote = remote_open(archive->path,
+                                  zipfs_options.remote_cache
+                                      ? zipfs_options.remote_cache
+                                      : DEFAULT_REMOTE_CACHE,
+                                  remote_cache_size);
+    if (archive->remote == NULL) {
+        return -1;
+    }
+
+    // Only the size and the time tell whether a sidecar file matches.
+    memset(st, 0, sizeof(*st));
+    st->st_size = archive->remote->size;
+    st->st_mtime = archive->remote->mtime;
+    archive->zip = zip_reader_open(zipfs_remote_read, archive->remote,
+                                   archive->remote->size);
+    return 0;
+}
 
-        if (zip_entry_openbyindex(zip, index) != 0) {
-            ret = -ENOENT;
-            goto unlock;
+// Opens an archive along with its readers.
+static int zipfs_archive_open(struct zipfs_archive_t *archive,
+                              size_t num_readers, struct stat *st) {
+    if (remote_is_url(archive->path)) {
+        if (zipfs_remote_open(archive, st) != 0) {
+            eprintfln("Open ZIP file '%s' error", archive->path);
+            return -1;
         }
+        goto readers;
     }
 
-    if (zip_entry_isdir(zip)) {
-        debug_eprintfln("Entry '%s' is dir", path + 1);
-        ret = -EISDIR;
-        goto cleanup;
+    archive->fd = open(archive->path, O_RDONLY);
+    if (archive->fd < 0) {
+        perror("open()");
+        eprintfln("Open ZIP file '%s' error", archive->path);
+        return -1;
     }
 
-    if (zip_buf.data == NULL) {
-        debug_eprintfln("Buffer has not initialized");
-        size_t entry_size = zip_entry_size(zip);
-        debug_eprintfln("Entry size is %zu", entry_size);
-        size_t buf_size = min_buf_size > entry_size ? min_buf_size : entry_size;
-        zip_buf.data = (char *)malloc(buf_size);
-        if (zip_buf.data == NULL) {
-            perror("malloc()");
-            ret = -errno;
-            goto cleanup;
-        }
-        debug_eprintfln("Buffer with size %zu allocated", buf_size);
-        zip_buf.buf_size = buf_size;
-        zip_buf.entry_size = entry_size;
-        zip_buf.index = index;
-        // To be strict, only use entry_size instead of buf_size.
-        assert(zip_entry_noallocread(zip, (void *)zip_buf.data,
-                                     zip_buf.entry_size) != -1);
-    } else if (zip_buf.index != index) {
-        debug_eprintfln("Entry with index %d not found", index);
-        size_t entry_size = zip_entry_size(zip);
-        debug_eprintfln("Entry size is %zu", entry_size);
-        if (zip_buf.buf_size < entry_size ||
-            (zip_buf.buf_size > entry_size &&
-             zip_buf.buf_size > min_buf_size)) {
-            size_t buf_size =
-                min_buf_size > entry_size ? min_buf_size : entry_size;
-            char *new_data = (char *)realloc(zip_buf.data, buf_size);
-            if (new_data == NULL) {
-                perror("realloc()");
-                ret = -errno;
-                goto cleanup;
-            }
-            debug_eprintfln("Buffer with size %zu reallocated", buf_size);
-            zip_buf.data = new_data;
-            zip_buf.buf_size = buf_size;
+    if (fstat(archive->fd, st) != 0) {
+        perror("fstat()");
+        return -1;
+    }
+
+    if (zipfs_options.mmap) {
+        if (zipfs_map(archive, st->st_size) != 0) {
+            eprintfln("Map ZIP file '%s' error", archive->path);
+            return -1;
         }
-        zip_buf.entry_size = entry_size;
-        zip_buf.index = index;
-        // To be strict, only use entry_size instead of buf_size.
-        assert(zip_entry_noallocread(zip, (void *)zip_buf.data,
-                                     zip_buf.entry_size) != -1);
+        archive->zip =
+            zip_stream_open(archive->map, archive->map_size, 0, 'r');
+    } else if (zipfs_options.io_uring || zipfs_options.o_direct) {
+        int flags = (zipfs_options.io_uring ? IO_URING : 0) |
+                    (zipfs_options.o_direct ? IO_DIRECT : 0);
+        archive->io = io_open(archive->path, flags);
+        if (archive->io == NULL) {
+            eprintfln("Open ZIP file '%s' error", archive->path);
+            return -1;
+        }
+        debug_eprintfln("ZIP file '%s' read with %s", archive->path,
+                        io_engine(archive->io));
+        archive->zip =
+            zip_reader_open(zipfs_io_read, archive->io, st->st_size);
+    } else {
+        archive->zip = zip_open(archive->path, 0, 'r');
     }
 
-    if (offset >= zip_buf.entry_size) {
-        debug_eprintfln("Offset %lld is out of bound for entry size %zu",
-                        offset, zip_buf.entry_size);
-        ret = 0;
-        goto cleanup;
+readers:
+    if (archive->zip == NULL) {
+        eprintfln("Open ZIP file '%s' error", archive->path);
+        return -1;
     }
-    ret =
-        offset + size > zip_buf.entry_size ? zip_buf.entry_size - offset : size;
-    memcpy(buf, zip_buf.data + offset, ret);
-    debug_eprintfln("%d byte(s) copied to buffer from offset %lld", ret,
-                    offset);
 
-cleanup:
-    zip_entry_close(zip);
-unlock:
-    pthread_mutex_unlock(&zip_mutex);
-    return ret;
+    archive->readers =
+        reader_pool_create(archive->zip, archive->path, num_readers);
+    if (archive->readers == NULL) {
+        eprintfln("Create readers failed");
+        return -1;
+    }
+    return 0;
 }
 
-static int zipfs_readdir(const char *path, void *buf, fuse_fill_dir_t filler,
-                         off_t off, struct fuse_file_info *fi) {
-    (void)off;
-    (void)fi;
+// Names the directory of each archive after its file, without the extension.
+static int zipfs_archive_names(void) {
+    for (size_t i = 0; i < num_archives; ++i) {
+        const char *slash = strrchr(archives[i].path, '/');
+        const char *base = slash != NULL ? slash + 1 : archives[i].path;
+        size_t len = strlen(base);
+        if (len > 4 && strcasecmp(base + len - 4, ".zip") == 0) {
+            len -= 4;
+        }
+        archives[i].prefix = strndup(base, len);
+        if (archives[i].prefix == NULL) {
+            perror("strndup()");
+            return -1;
+        }
 
-    int ret = 0;
-    int dir_index = -1;
-    char dir_name[MAX_PATH] = "";
-    char prev_name[MAX_PATH] = "";
-
-    debug_eprintfln("Invoked with path '%s'", path);
-    pthread_mutex_lock(&zip_mutex);
-
-    if (strcmp(path, "/") != 0) {
-        if (zip_entry_open(zip, path + 1) == 0) {
-            if (!zip_entry_isdir(zip)) {
-                debug_eprintfln("Entry '%s' is not dir", path + 1);
-                ret = -ENOTDIR;
-                zip_entry_close(zip);
-                goto unlock;
+        for (size_t j = 0; j < i; ++j) {
+            if (strcmp(archives[i].prefix, archives[j].prefix) == 0) {
+                eprintfln("ZIP files '%s' and '%s' have the same name",
+                          archives[j].path, archives[i].path);
+                return -1;
             }
+        }
+    }
+    return 0;
+}
 
-            dir_index = zip_entry_index(zip);
-            debug_eprintfln("Dir entry index is %d", dir_index);
+// Opens an entry of an archive as an archive of its own if it is a stored zip
+// file, served in a directory in place of the entry.
+static int zipfs_nested_open(size_t parent_i, size_t index,
+                             size_t num_readers) {
+    // Remote archives are not read from in place.
+    if (archives[parent_i].remote != NULL) {
+        return 0;
+    }
 
-            zip_entry_close(zip);
-        } else {
-            debug_eprintfln("zip_entry_open() '%s' error", path + 1);
+    struct zip_entry_table_t *table = archives[parent_i].table;
+    const char *name = zip_entry_table_name(table, index);
+    size_t len = table->name_lens[index];
+    while (len > 0 && *name == '/') {
+        ++name;
+        --len;
+    }
+    if (table->isdirs[index] || table->methods[index] != 0 || len <= 4 ||
+        strcasecmp(name + len - 4, ".zip") != 0 ||
+        table->comp_sizes[index] != table->uncomp_sizes[index]) {
+        return 0;
+    }
+
+    struct zip_t *zip = archives[parent_i].zip;
+    long long data_offset = -1;
+    if (zip_entry_openbyindex(zip, index) == 0) {
+        data_offset = zip_entry_data_offset(zip);
+        zip_entry_close(zip);
+    }
+    if (data_offset < 0) {
+        return 0;
+    }
+
+    if (num_archives == cap_archives) {
+        size_t cap = cap_archives * 2;
+        struct zipfs_archive_t *grown = (struct zipfs_archive_t *)realloc(
+            archives, cap * sizeof(struct zipfs_archive_t));
+        if (grown == NULL) {
+            perror("realloc()");
+            return -1;
         }
-        strcpy(dir_name, path + 1);
-        strcat(dir_name, "/");
+        archives = grown;
+        cap_archives = cap;
+    }
+    struct zipfs_archive_t *parent = &archives[parent_i];
+    struct zipfs_archive_t *archive = &archives[num_archives];
+    memset(archive, 0, sizeof(*archive));
+    memcpy(archive->path, parent->path, sizeof(archive->path));
+    archive->nested = 1;
+    archive->offset = parent->offset + data_offset;
+    archive->fd = parent->fd;
+    unsigned long long size = table->uncomp_sizes[index];
+    if (parent->map != NULL) {
+        archive->map = (char *)parent->map + data_offset;
+        archive->map_size = size;
+        archive->zip = zip_stream_open(archive->map, size, 0, 'r');
     } else {
-        debug_eprintfln("Path is '/'");
+        // Read through the descriptor of the outer archive rather than a
+        // file of its own for each handler, as archives nested by the
+        // thousand would run out of descriptors.
+        archive->zip = zip_reader_open(
+            zipfs_nested_read, (void *)(uintptr_t)num_archives, size);
+    }
+    if (archive->zip == NULL) {
+        debug_eprintfln("Entry '%.*s' is not a ZIP file", (int)len, name);
+        return 0;
     }
 
-    debug_eprintfln("Dir name is resolved as '%s'", dir_name);
+    const struct zipfs_archive_t *last = &archives[num_archives - 1];
+    unsigned long long first_index =
+        last->first_index + (unsigned long long)zip_total_entries(last->zip);
+    size_t prefix_len = parent->prefix != NULL ? strlen(parent->prefix) : 0;
+    archive->prefix = (char *)malloc(prefix_len + 1 + len + 1);
+    archive->readers = reader_pool_create(archive->zip, archive->path,
+                                          num_readers);
+    ++num_archives;
+    if (first_index + zip_total_entries(archive->zip) > INT_MAX) {
+        eprintfln("Too many entries in ZIP files");
+        return -1;
+    }
+    if (archive->prefix == NULL || archive->readers == NULL) {
+        eprintfln("Open nested ZIP file '%.*s' error", (int)len, name);
+        return -1;
+    }
+    archive->first_index = (int)first_index;
+    if (prefix_len > 0) {
+        memcpy(archive->prefix, parent->prefix, prefix_len);
+        archive->prefix[prefix_len++] = '/';
+    }
+    memcpy(archive->prefix + prefix_len, name, len);
+    archive->prefix[prefix_len + len] = '\0';
 
-    for (int i = dir_index + 1;
-         i < MAX_ZIP_ENTRIES && zip_entry_names[i] != NULL; ++i) {
-        const char *name = zip_entry_names[i];
+    // The tree serves the entry as the directory of the archive.
+    table->isdirs[index] = 1;
+    debug_eprintfln("Nested ZIP file '%s' opened", archive->prefix);
+    return 0;
+}
 
-        debug_eprintfln("Current entry name is '%s'", name);
+// Reads the entry table of every archive, along with the ones nested in them
+// with --nested, merging them if there are several.
+static struct zip_entry_table_t *zipfs_entries_create(size_t num_readers) {
+    if (num_archives == 1 && !zipfs_options.nested) {
+        return zip_entry_table_create(archives[0].zip);
+    }
 
-        if (!starts_with(dir_name, name)) {
-            if (dir_index == -1) {
-                continue;
-            } else {
-                break;
+    // Nested archives are appended, and read in turn.
+    int ret = 0;
+    for (size_t i = 0; ret == 0 && i < num_archives; ++i) {
+        archives[i].table = zip_entry_table_create(archives[i].zip);
+        if (archives[i].table == NULL) {
+            eprintfln("Read central directory of '%s' failed",
+                      archives[i].path);
+            ret = -1;
+        }
+        for (size_t j = 0; ret == 0 && zipfs_options.nested &&
+                           j < archives[i].table->num_entries;
+             ++j) {
+            ret = zipfs_nested_open(i, j, num_readers);
+        }
+    }
+
+    struct zip_entry_table_t *merged = NULL;
+    struct zip_entry_table_t **tables = NULL;
+    const char **prefixes = NULL;
+    if (ret == 0 && num_archives == 1) {
+        merged = archives[0].table;
+        archives[0].table = NULL;
+    } else if (ret == 0) {
+        tables = (struct zip_entry_table_t **)malloc(
+            num_archives * sizeof(struct zip_entry_table_t *));
+        prefixes = (const char **)malloc(num_archives * sizeof(const char *));
+        if (tables == NULL || prefixes == NULL) {
+            perror("malloc()");
+        } else {
+            for (size_t i = 0; i < num_archives; ++i) {
+                tables[i] = archives[i].table;
+                prefixes[i] = archives[i].prefix;
             }
+            merged = zip_entry_table_merge(tables, prefixes, num_archives);
         }
+    }
 
-        struct stat st;
-        memset(&st, 0, sizeof(struct stat));
+    for (size_t i = 0; i < num_archives; ++i) {
+        zip_entry_table_free(archives[i].table);
+        archives[i].table = NULL;
+    }
+    free(tables);
+    free(prefixes);
+    return merged;
+}
 
-        const char *local_name = name + strlen(dir_name);
-        char *slashp = (char *)strchr(local_name, '/');
+// Opens the archives and sets up everything needed to serve them.
+static int zipfs_setup(void) {
+    // The sidecar file and the builder of the tree cover a single archive.
+    if ((num_archives > 1 || zipfs_options.nested) &&
+        (zipfs_options.lazy || zipfs_options.index_file != NULL)) {
+        eprintfln("--lazy and --index are ignored with several or nested ZIP "
+                  "files");
+        zipfs_options.lazy = 0;
+        zipfs_options.index_file = NULL;
+    }
+    if (num_archives > 1 && !zipfs_options.merge &&
+        zipfs_archive_names() != 0) {
+        return -1;
+    }
+    // The slab is laid out from the whole entry table.
+    if (zipfs_options.preload_small != NULL && zipfs_options.lazy &&
+        !zipfs_options.build_index) {
+        eprintfln("--preload-small is ignored with --lazy");
+        zipfs_options.preload_small = NULL;
+    }
 
-        if (slashp == NULL) {
-            // The entry is a sub-file or sub-directory.
-            if (strcmp(prev_name, local_name) != 0) {
-                strcpy(prev_name, local_name);
+    size_t cache_size;
+    if (size_parse(zipfs_options.cache_size ? zipfs_options.cache_size
+                                            : DEFAULT_CACHE_SIZE,
+                   &cache_size) != 0) {
+        eprintfln("Invalid cache size '%s'", zipfs_options.cache_size);
+        return -1;
+    }
+    if (size_parse(zipfs_options.stream_min_size
+                       ? zipfs_options.stream_min_size
+                       : DEFAULT_STREAM_MIN_SIZE,
+                   &stream_min_size) != 0) {
+        eprintfln("Invalid stream min size '%s'",
+                  zipfs_options.stream_min_size);
+        return -1;
+    }
+    if (size_parse(zipfs_options.stream_window_size
+                       ? zipfs_options.stream_window_size
+                       : DEFAULT_STREAM_WINDOW_SIZE,
+                   &stream_window_size) != 0) {
+        eprintfln("Invalid stream window size '%s'",
+                  zipfs_options.stream_window_size);
+        return -1;
+    }
 
-                assert(zip_entry_open(zip, name) == 0);
-                zipfs_entry_getattr(zip, &st);
-                zip_entry_close(zip);
+    if (size_parse(zipfs_options.remote_cache_size
+                       ? zipfs_options.remote_cache_size
+                       : DEFAULT_REMOTE_CACHE_SIZE,
+                   &remote_cache_size) != 0) {
+        eprintfln("Invalid remote cache size '%s'",
+                  zipfs_options.remote_cache_size);
+        return -1;
+    }
 
-                filler(buf, local_name, &st, 0);
-                debug_eprintfln("Entry '%s' filled", local_name);
-            }
-        } else {
-            // The entry is a direct sub-file or sub-directory,
-            // but its name implies that a sub-directory should exist.
-            *slashp = '\0';
-            if (strcmp(prev_name, local_name) != 0) {
-                strcpy(prev_name, local_name);
+    if (zipfs_options.preload_small != NULL &&
+        size_parse(zipfs_options.preload_small, &preload_max_size) != 0) {
+        eprintfln("Invalid preload size '%s'", zipfs_options.preload_small);
+        return -1;
+    }
 
-                st.st_mode = S_IFDIR | 0755;
+    size_t index_spacing;
+    if (size_parse(zipfs_options.index_spacing
+                       ? zipfs_options.index_spacing
+                       : DEFAULT_INDEX_SPACING,
+                   &index_spacing) != 0) {
+        eprintfln("Invalid index spacing '%s'",
+                  zipfs_options.index_spacing);
+        return -1;
+    }
 
-                filler(buf, local_name, &st, 0);
-                debug_eprintfln("Entry '%s' filled", local_name);
-            }
-            *slashp = '/';
+    cache = cache_create(cache_size, NUM_CACHE_SHARDS);
+    if (cache == NULL) {
+        eprintfln("Create cache failed");
+        return -1;
+    }
+
+    size_t num_workers = zipfs_options.num_workers;
+    if (num_workers == 0) {
+        if (zipfs_options.prefetch_depth > 0) {
+            num_workers += NUM_PREFETCH_THREADS;
+        }
+        num_workers += zipfs_options.parallel;
+        if (zipfs_options.preload_small != NULL) {
+            num_workers += NUM_PRELOAD_THREADS;
+        }
+    }
+    if (num_workers > 0) {
+        int *cpus = NULL;
+        size_t num_cpus = 0;
+        if (zipfs_options.worker_cpus != NULL &&
+            parse_cpus(zipfs_options.worker_cpus, &cpus, &num_cpus) != 0) {
+            eprintfln("Invalid worker CPUs '%s'", zipfs_options.worker_cpus);
+            return -1;
+        }
+        pool = pool_create(num_workers, cpus, num_cpus);
+        free(cpus);
+        if (pool == NULL) {
+            eprintfln("Create workers failed");
+            return -1;
         }
     }
 
-unlock:
-    pthread_mutex_unlock(&zip_mutex);
-    return ret;
-}
+    if (zipfs_options.prefetch_depth > 0) {
+        prefetch = prefetch_create(pool, zipfs_options.prefetch_depth,
+                                   cache_size / 4, zipfs_prefetch, NULL);
+        if (prefetch == NULL) {
+            eprintfln("Create prefetcher failed");
+            return -1;
+        }
+        prefetch_max_size = cache_size / NUM_CACHE_SHARDS / 2;
+    }
 
-static int zipfs_read_all_entry_names(char **entry_names, struct zip_t *zip) {
-    int n = zip_total_entries(zip);
-    debug_eprintfln("Total entries are %d", n);
-    for (int i = 0; i < n && i < MAX_ZIP_ENTRIES; ++i) {
-        assert(zip_entry_openbyindex(zip, i) == 0);
-        const char *name = zip_entry_name(zip);
-        entry_names[i] = (char *)malloc(strlen(name));
-        if (entry_names[i] == NULL) {
-            perror("malloc()");
-            zip_entry_close(zip);
+    if (zipfs_options.parallel > 0) {
+        parallel = parallel_create(
+            pool, zipfs_options.parallel * PARALLEL_SEGMENTS_PER_WORKER * 2,
+            zipfs_parallel_load, NULL);
+        if (parallel == NULL) {
+            eprintfln("Create parallel workers failed");
+            return -1;
+        }
+        parallel_ahead_size = (unsigned long long)zipfs_options.parallel *
+                              PARALLEL_SEGMENTS_PER_WORKER *
+                              PARALLEL_SEGMENT_SIZE;
+        if (parallel_ahead_size > cache_size / 4) {
+            parallel_ahead_size = cache_size / 4;
+        }
+    }
+
+    // Workers get readers of their own, so that they do not hold up the
+    // reads of open files.
+    size_t num_readers = zipfs_options.num_readers;
+    if (num_readers == 0) {
+        num_readers = DEFAULT_NUM_READERS + num_workers;
+    }
+    // Directories without an entry of their own take the time of the archive
+    // modified last.
+    struct stat st;
+    time_t mtime = 0;
+    size_t num_entries = 0;
+    for (size_t i = 0; i < num_archives; ++i) {
+        if (zipfs_archive_open(&archives[i], num_readers, &st) != 0) {
             return -1;
         }
+        archives[i].first_index = (int)num_entries;
+        num_entries += zip_total_entries(archives[i].zip);
+        if (num_entries > INT_MAX) {
+            eprintfln("Too many entries in ZIP files");
+            return -1;
+        }
+        if (st.st_mtime > mtime) {
+            mtime = st.st_mtime;
+        }
+    }
 
-        strcpy(entry_names[i], name);
+    if (zipfs_options.index_file != NULL) {
+        seeks = seek_table_create(num_entries, index_spacing);
+        if (seeks == NULL) {
+            eprintfln("Create seek table failed");
+            return -1;
+        }
+        sidecar_key_init(&sidecar_key, archives[0].zip, &st);
+        sidecar = sidecar_load(zipfs_options.index_file, &sidecar_key, seeks,
+                               &entries, &tree);
+    }
 
-        debug_eprintfln("Current entry name is '%s'", entry_names[i]);
-        zip_entry_close(zip);
+    if (sidecar != NULL) {
+        // Everything is there already.
+    } else if (zipfs_options.lazy && !zipfs_options.build_index) {
+        // Only the root exists until the builder is started.
+        tree = tree_create(num_entries, mtime);
+        if (tree == NULL) {
+            eprintfln("Create directory tree failed");
+            return -1;
+        }
+        if (zipfs_lock_init() != 0) {
+            return -1;
+        }
+        tree_built = 0;
+    } else {
+        entries = zipfs_entries_create(num_readers);
+        if (entries == NULL) {
+            eprintfln("Read central directory failed");
+            return -1;
+        }
+        tree = tree_build(entries, mtime);
+        if (tree == NULL) {
+            eprintfln("Build directory tree failed");
+            return -1;
+        }
+        // Including the entries of nested archives.
+        num_entries = entries->num_entries;
+    }
+    ctl_root_st = tree_get(tree, FUSE_ROOT_INO)->st;
+
+    if (seeks == NULL) {
+        seeks = seek_table_create(num_entries, index_spacing);
+        if (seeks == NULL) {
+            eprintfln("Create seek table failed");
+            return -1;
+        }
+    }
+
+    if (zipfs_options.preload_small != NULL) {
+        slab = slab_create(pool, entries->num_entries, zipfs_preload_size,
+                           zipfs_preload, NULL);
+        if (slab == NULL) {
+            eprintfln("Create preload slab failed");
+            return -1;
+        }
     }
 
+    if (zipfs_options.build_index && zipfs_build_index() != 0) {
+        eprintfln("Build index failed");
+        return -1;
+    }
+    if (zipfs_options.index_file != NULL && tree_built &&
+        (sidecar == NULL || seek_table_modified(seeks))) {
+        sidecar_save(zipfs_options.index_file, &sidecar_key, entries, tree,
+                     seeks);
+    }
     return 0;
 }
 
-static void zipfs_free_all_entry_names(char **entry_names) {
-    for (int i = 0; i < MAX_ZIP_ENTRIES && entry_names[i] != NULL; ++i) {
-        free(entry_names[i]);
+// Releases everything set up by zipfs_setup, even if it failed halfway.
+static void zipfs_teardown(void) {
+    // Workers use everything else.
+    pool_free(pool);
+    slab_free(slab);
+    parallel_free(parallel);
+    prefetch_free(prefetch);
+    zipfs_tree_join();
+    seek_table_free(seeks);
+    cache_free(cache);
+    for (size_t i = 0; i < num_archives; ++i) {
+        struct zipfs_archive_t *archive = &archives[i];
+        reader_pool_free(archive->readers);
+        zip_close(archive->zip);
+        zip_entry_table_free(archive->table);
+        free(archive->prefix);
+        if (archive->nested) {
+            continue;
+        }
+        remote_free(archive->remote);
+        io_close(archive->io);
+        if (archive->map != NULL) {
+            munmap(archive->map, archive->map_size);
+        }
+        if (archive->fd >= 0) {
+            close(archive->fd);
+        }
     }
+    free(archives);
+    tree_free(tree);
+    zip_entry_table_free(entries);
+    sidecar_free(sidecar);
 }
 
-static struct fuse_operations zipfs_operations = {.getattr = zipfs_getattr,
-                                                  .open = zipfs_open,
-                                                  .read = zipfs_read,
-                                                  .readdir = zipfs_readdir,
-                                                  .init = zipfs_init,
-                                                  .destroy = zipfs_destroy};
-
 int main(int argc, char **argv) {
-    int ret;
-
-    char zip_file[PATH_MAX] = {0};
+    int ret = 1;
+    const char *progname = argv[0];
 
     if (argc >= 3) {
-        if (realpath(argv[1], zip_file) == NULL) {
-            eprintf("Resolve zip file path '%s' error", argv[1]);
+        // Leading arguments up to the mountpoint are zip files.
+        int n = 1;
+        while (n + 2 < argc && argv[n + 1][0] != '-' &&
+               argv[n + 2][0] != '-') {
+            ++n;
+        }
+        archives =
+            (struct zipfs_archive_t *)calloc(n, sizeof(struct zipfs_archive_t));
+        if (archives == NULL) {
+            perror("calloc()");
+            return 1;
+        }
+        for (int i = 0; i < n; ++i) {
+            archives[i].fd = -1;
+            if (remote_is_url(argv[i + 1])) {
+                if (strlen(argv[i + 1]) >= PATH_MAX) {
+                    eprintf("URL '%s' is too long", argv[i + 1]);
+                    n = 0;
+                    break;
+                }
+                strcpy(archives[i].path, argv[i + 1]);
+            } else if (realpath(argv[i + 1], archives[i].path) == NULL) {
+                eprintf("Resolve zip file path '%s' error", argv[i + 1]);
+                n = 0;
+                break;
+            }
+        }
+        if (n == 0) {
+            free(archives);
+            archives = NULL;
             argv[1] = "--help";
             argv[2] = NULL;
             argc = 2;
         } else {
-            zip = zip_open(zip_file, 0, 'r');
-            if (zip == NULL) {
-                eprintfln("Open ZIP file '%s' error", zip_file);
-                return 1;
-            }
-
-            if (zipfs_read_all_entry_names(zip_entry_names, zip) != 0) {
-                eprintfln("Read all entry names failed");
-                return 1;
-            }
-
-            ++argv;
-            --argc;
+            num_archives = n;
+            cap_archives = n;
+            argv += n;
+            argc -= n;
         }
     } else if (argc == 2) {
         if (argv[1][0] != '-') {
@@ -451,27 +2599,76 @@ int main(int argc, char **argv) {
     }
 
     struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+    struct fuse_cmdline_opts opts;
+    memset(&opts, 0, sizeof(opts));
+    struct fuse_session *se = NULL;
 
     if (fuse_opt_parse(&args, &zipfs_options, option_spec, NULL) == -1) {
         eprintfln("Parse options error");
-        return 1;
+        goto out;
+    }
+    if (fuse_parse_cmdline(&args, &opts) != 0) {
+        goto out;
     }
 
-    // When --help is specified, first print our own file-system specific help
-    // text, then signal fuse_main to show additional help (by adding `--help`
-    // to the options again) without usage: line (by setting argv[0] to the
-    // empty string)
-    if (zipfs_options.show_help) {
-        show_help(argv[0]);
-        assert(fuse_opt_add_arg(&args, "-ho") == 0);
+    if (opts.show_help) {
+        show_help(progname);
+        ret = 0;
+        goto out;
+    }
+    if (opts.show_version) {
+        printf("FUSE library version %s\n", fuse_pkgversion());
+        printf("Inflate engine %s\n", inflate_engine());
+        printf("Compression methods %s\n", decode_methods());
+        printf("CRC-32 routine %s\n", crc_engine());
+        printf("Remote engine %s\n", remote_engine());
+        fuse_lowlevel_version();
+        ret = 0;
+        goto out;
+    }
+    if (num_archives == 0 || opts.mountpoint == NULL) {
+        show_help(progname);
+        goto out;
     }
 
-    ret = fuse_main(args.argc, args.argv, &zipfs_operations, NULL);
-    fuse_opt_free_args(&args);
+    if (zipfs_setup() != 0) {
+        goto teardown;
+    }
+
+    se = fuse_session_new(&args, &zipfs_operations, sizeof(zipfs_operations),
+                          NULL);
+    if (se == NULL) {
+        goto teardown;
+    }
+    if (fuse_set_signal_handlers(se) != 0) {
+        goto destroy;
+    }
+    if (fuse_session_mount(se, opts.mountpoint) != 0) {
+        goto remove_handlers;
+    }
 
-    zip_close(zip);
-    free(zip_buf.data);
-    zipfs_free_all_entry_names(zip_entry_names);
+    fuse_daemonize(opts.foreground);
+    ret = opts.singlethread ? fuse_session_loop(se)
+                            : fuse_session_loop_mt(se, opts.clone_fd);
+
+    fuse_session_unmount(se);
+remove_handlers:
+    fuse_remove_signal_handlers(se);
+destroy:
+    fuse_session_destroy(se);
+
+    // The builder has saved the sidecar file already unless it failed.
+    zipfs_tree_join();
+    if (zipfs_options.index_file != NULL && tree_built &&
+        tree_build_ret == 0 && seek_table_modified(seeks)) {
+        sidecar_save(zipfs_options.index_file, &sidecar_key, entries, tree,
+                     seeks);
+    }
 
-    return ret;
+teardown:
+    zipfs_teardown();
+out:
+    free(opts.mountpoint);
+    fuse_opt_free_args(&args);
+    return ret ? 1 : 0;
 }
@@ -0,0 +1,371 @@
+// Rewrites a zip file into the layout zipfs reads fastest: entries of the same
+// directory next to each other with the central directory sorted the same way,
+// the data of stored entries aligned to pages so that they map cleanly, large
+// deflated entries optionally deflated anew in independent blocks, and a
+// sidecar file with the tree and complete seek indexes to mount it with, which
+// include the starts of those blocks.
+
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "log.h"
+#include "seek.h"
+#include "sidecar.h"
+#include "size.h"
+#include "stream.h"
+#include "tree.h"
+#include "zip.h"
+
+// The same defaults as zipfs, so that the sidecar indexes what zipfs streams.
+#define DEFAULT_ALIGNMENT "4K"
+#define DEFAULT_LEVEL 6
+#define DEFAULT_STREAM_MIN_SIZE "8M"
+#define DEFAULT_INDEX_SPACING "4M"
+#define INDEX_WINDOW_SIZE (1 << 20)
+
+// An entry to copy, along with where the name of its directory ends.
+struct pack_entry_t {
+    int index;
+    const char *name;
+    size_t parent_len;
+};
+
+// A point of an entry deflated anew, after a full flush, from which inflating
+// starts afresh.
+struct pack_flush_t {
+    size_t index;
+    unsigned long long out_pos;
+    unsigned long long in_pos;
+    unsigned int crc32;
+};
+
+// Flush points of all entries, by entry in the order written, then by offset.
+struct pack_flushes_t {
+    struct pack_flush_t *points;
+    size_t num_points;
+    size_t cap_points;
+    // Index of the entry being written.
+    size_t index;
+};
+
+static int pack_flush_add(void *arg, unsigned long long out_pos,
+                          unsigned long long in_pos, unsigned int crc32) {
+    struct pack_flushes_t *flushes = (struct pack_flushes_t *)arg;
+    if (flushes->num_points == flushes->cap_points) {
+        size_t cap = flushes->cap_points ? flushes->cap_points * 2 : 64;
+        struct pack_flush_t *points = (struct pack_flush_t *)realloc(
+            flushes->points, cap * sizeof(struct pack_flush_t));
+        if (points == NULL) {
+            perror("realloc()");
+            return -1;
+        }
+        flushes->points = points;
+        flushes->cap_points = cap;
+    }
+    struct pack_flush_t *point = &flushes->points[flushes->num_points++];
+    point->index = flushes->index;
+    point->out_pos = out_pos;
+    point->in_pos = in_pos;
+    point->crc32 = crc32;
+    return 0;
+}
+
+// Orders entries by directory, then by name, so that the entries of a
+// directory are contiguous.
+static int pack_entry_cmp(const void *a, const void *b) {
+    const struct pack_entry_t *x = (const struct pack_entry_t *)a;
+    const struct pack_entry_t *y = (const struct pack_entry_t *)b;
+
+    size_t len = x->parent_len < y->parent_len ? x->parent_len : y->parent_len;
+    int cmp = memcmp(x->name, y->name, len);
+    if (cmp == 0 && x->parent_len != y->parent_len) {
+        cmp = x->parent_len < y->parent_len ? -1 : 1;
+    }
+    if (cmp == 0) {
+        cmp = strcmp(x->name + x->parent_len, y->name + y->parent_len);
+    }
+    // Duplicate names keep their order.
+    return cmp != 0 ? cmp : x->index - y->index;
+}
+
+static struct pack_entry_t *
+pack_entries_sort(const struct zip_entry_table_t *table) {
+    struct pack_entry_t *entries = (struct pack_entry_t *)malloc(
+        table->num_entries * sizeof(struct pack_entry_t) + 1);
+    if (entries == NULL) {
+        perror("malloc()");
+        return NULL;
+    }
+
+    for (size_t i = 0; i < table->num_entries; ++i) {
+        const char *name = zip_entry_table_name(table, i);
+        size_t len = table->name_lens[i];
+        // The trailing slash of a directory is part of its own name.
+        if (len > 0 && name[len - 1] == '/') {
+            --len;
+        }
+        while (len > 0 && name[len - 1] != '/') {
+            --len;
+        }
+        entries[i].index = (int)i;
+        entries[i].name = name;
+        entries[i].parent_len = len;
+    }
+    qsort(entries, table->num_entries, sizeof(struct pack_entry_t),
+          pack_entry_cmp);
+    return entries;
+}
+
+static int pack_copy(const char *in_path, const char *out_path,
+                     size_t alignment, size_t flush_size, int level,
+                     struct pack_flushes_t *flushes) {
+    struct zip_t *in = zip_open(in_path, 0, 'r');
+    if (in == NULL) {
+        eprintfln("Open ZIP file '%s' error", in_path);
+        return -1;
+    }
+    struct zip_entry_table_t *table = zip_entry_table_create(in);
+    if (table == NULL) {
+        eprintfln("Read central directory of '%s' error", in_path);
+        zip_close(in);
+        return -1;
+    }
+    struct pack_entry_t *entries = pack_entries_sort(table);
+    struct zip_t *out = zip_open(out_path, level, 'w');
+    if (entries == NULL || out == NULL) {
+        eprintfln("Create ZIP file '%s' error", out_path);
+        free(entries);
+        zip_entry_table_free(table);
+        zip_close(in);
+        return -1;
+    }
+
+    int ret = 0;
+    unsigned long long num_aligned = 0;
+    unsigned long long num_split = 0;
+    for (size_t i = 0; ret == 0 && i < table->num_entries; ++i) {
+        int index = entries[i].index;
+        int stored = table->methods[index] == 0 && !table->isdirs[index] &&
+                     table->uncomp_sizes[index] > 0;
+        int split = flush_size > 0 && table->methods[index] == 8 &&
+                    table->uncomp_sizes[index] > flush_size;
+
+        flushes->index = i;
+        if (zip_set_alignment(out, stored ? (unsigned int)alignment : 0) !=
+                0 ||
+            zip_entry_copy(out, in, index, split ? flush_size : 0,
+                           pack_flush_add, flushes) != 0) {
+            eprintfln("Copy entry '%s' error", entries[i].name);
+            ret = -1;
+        }
+        num_aligned += stored && alignment > 0;
+        num_split += split;
+    }
+    zip_close(out);
+    if (ret == 0) {
+        eprintfln("%zu entries written, %llu stored entries aligned, %llu "
+                  "entries split into blocks",
+                  table->num_entries, num_aligned, num_split);
+    }
+
+    free(entries);
+    zip_entry_table_free(table);
+    zip_close(in);
+    return ret;
+}
+
+static size_t pack_read(void *opaque, unsigned long long offset, void *buf,
+                        size_t size) {
+    ssize_t n = pread(*(int *)opaque, buf, size, (off_t)offset);
+    return n < 0 ? 0 : (size_t)n;
+}
+
+// Writes the sidecar file zipfs mounts the archive with, indexing every entry
+// which zipfs would stream. The flush points of entries deflated anew are
+// added to their indexes, without a window, so that zipfs resumes inflating
+// and splits the work of --parallel at them.
+static int pack_index(const char *zip_path, const char *index_path,
+                      size_t spacing, size_t stream_min_size,
+                      const struct pack_flushes_t *flushes) {
+    struct stat st;
+    struct zip_t *zip = zip_open(zip_path, 0, 'r');
+    int fd = open(zip_path, O_RDONLY);
+    if (zip == NULL || fd < 0 || fstat(fd, &st) != 0) {
+        eprintfln("Open ZIP file '%s' error", zip_path);
+        zip_close(zip);
+        if (fd >= 0) {
+            close(fd);
+        }
+        return -1;
+    }
+
+    int ret = -1;
+    struct tree_t *tree = NULL;
+    struct seek_table_t *seeks = NULL;
+    struct zip_entry_table_t *entries = zip_entry_table_create(zip);
+    if (entries != NULL) {
+        tree = tree_build(entries, st.st_mtime);
+        seeks = seek_table_create(entries->num_entries, spacing);
+    }
+    if (tree == NULL || seeks == NULL) {
+        eprintfln("Build directory tree error");
+        goto cleanup;
+    }
+
+    size_t flush = 0;
+    for (int i = 0; (size_t)i < entries->num_entries; ++i) {
+        while (flush < flushes->num_points &&
+               flushes->points[flush].index < (size_t)i) {
+            ++flush;
+        }
+        if (entries->isdirs[i] || entries->methods[i] != 8 ||
+            entries->uncomp_sizes[i] < stream_min_size) {
+            continue;
+        }
+
+        long long data_offset = -1;
+        if (zip_entry_openbyindex(zip, i) == 0) {
+            data_offset = zip_entry_data_offset(zip);
+            zip_entry_close(zip);
+        }
+        struct stream_t *stream = NULL;
+        if (data_offset >= 0) {
+            stream = stream_create(INDEX_WINDOW_SIZE, data_offset,
+                                   entries->comp_sizes[i],
+                                   entries->uncomp_sizes[i],
+                                   entries->crc32s[i],
+                                   seek_table_get(seeks, i));
+        }
+        if (stream == NULL || stream_finish(stream, pack_read, &fd) != 0) {
+            eprintfln("Index entry '%s' error",
+                      zip_entry_table_name(entries, i));
+            stream_free(stream);
+            goto cleanup;
+        }
+        stream_free(stream);
+
+        struct stream_index_t *index = seek_table_get(seeks, i);
+        for (; index != NULL && flush < flushes->num_points &&
+               flushes->points[flush].index == (size_t)i;
+             ++flush) {
+            const struct pack_flush_t *point = &flushes->points[flush];
+            // Fails if a point of the spacing falls on it already, which
+            // serves as well.
+            stream_index_add(index, point->out_pos, point->in_pos,
+                             point->crc32);
+        }
+    }
+
+    struct sidecar_key_t key;
+    sidecar_key_init(&key, zip, &st);
+    ret = sidecar_save(index_path, &key, entries, tree, seeks);
+    if (ret != 0) {
+        eprintfln("Write index file '%s' error", index_path);
+    }
+
+cleanup:
+    seek_table_free(seeks);
+    tree_free(tree);
+    zip_entry_table_free(entries);
+    zip_close(zip);
+    close(fd);
+    return ret;
+}
+
+static void pack_usage(const char *progname) {
+    eprintfln(
+        "usage: %s [options] <zip-file> <output-zip-file>\n"
+        "\n"
+        "    -a <size>   Alignment of the data of stored entries, 0 for none\n"
+        "                (default: " DEFAULT_ALIGNMENT ")\n"
+        "    -f <size>   Deflate deflated entries larger than this anew, "
+        "with a\n"
+        "                full flush every so many bytes, instead of copying "
+        "them,\n"
+        "                and index the flushes with -i, for zipfs to resume "
+        "and\n"
+        "                split --parallel inflating at\n"
+        "    -l <level>  Level to deflate entries anew at (default: %d)\n"
+        "    -i <file>   Sidecar file to write for zipfs --index, with "
+        "complete\n"
+        "                seek indexes\n"
+        "    -s <size>   Distance between seek points (default: "
+        "" DEFAULT_INDEX_SPACING ")\n"
+        "    -m <size>   Minimal size of deflated entries to index, as "
+        "zipfs\n"
+        "                --stream-min (default: " DEFAULT_STREAM_MIN_SIZE ")",
+        progname, DEFAULT_LEVEL);
+}
+
+int main(int argc, char **argv) {
+    size_t alignment;
+    size_t flush_size = 0;
+    size_t spacing;
+    size_t stream_min_size;
+    int level = DEFAULT_LEVEL;
+    const char *index_path = NULL;
+    size_parse(DEFAULT_ALIGNMENT, &alignment);
+    size_parse(DEFAULT_INDEX_SPACING, &spacing);
+    size_parse(DEFAULT_STREAM_MIN_SIZE, &stream_min_size);
+
+    int opt;
+    while ((opt = getopt(argc, argv, "a:f:l:i:s:m:")) != -1) {
+        int ret = 0;
+        switch (opt) {
+        case 'a':
+            ret = size_parse(optarg, &alignment) != 0 ||
+                  (alignment & (alignment - 1)) != 0 ||
+                  alignment > (1U << 31);
+            break;
+        case 'f':
+            ret = size_parse(optarg, &flush_size);
+            break;
+        case 'l':
+            level = atoi(optarg);
+            ret = level < 1 || level > 9;
+            break;
+        case 'i':
+            index_path = optarg;
+            break;
+        case 's':
+            ret = size_parse(optarg, &spacing);
+            break;
+        case 'm':
+            ret = size_parse(optarg, &stream_min_size);
+            break;
+        default:
+            ret = 1;
+            break;
+        }
+        if (ret != 0) {
+            pack_usage(argv[0]);
+            return 1;
+        }
+    }
+    if (argc - optind != 2) {
+        pack_usage(argv[0]);
+        return 1;
+    }
+    const char *in_path = argv[optind];
+    const char *out_path = argv[optind + 1];
+
+    struct pack_flushes_t flushes;
+    memset(&flushes, 0, sizeof(flushes));
+    int ret = 0;
+    if (pack_copy(in_path, out_path, alignment, flush_size, level,
+                  &flushes) != 0) {
+        remove(out_path);
+        ret = 1;
+    } else if (index_path != NULL &&
+               pack_index(out_path, index_path, spacing, stream_min_size,
+                          &flushes) != 0) {
+        ret = 1;
+    }
+    free(flushes.points);
+    return ret;
+}